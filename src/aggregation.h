@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+
+#include "distance_metric.h"
+
+// how the rows of one object are folded into the object's score. every query vector is scored against all of the
+// object's rows and the per-query-vector scores are summed, lower is better:
+//   max_sim -- the closest row per query vector. one query vector gives the plain best-chunk distance, several
+//              query (token) vectors give ColBERT-style late interaction MaxSim, in distance form
+//   sum     -- minus the summed similarity of all rows, so objects with many matching rows rank higher.
+//              similarity is 1 - distance for cosine and -distance for L1/L2
+enum class Aggregation {
+    max_sim,
+    sum
+};
+
+float similarity_from_distance(float distance, DistanceMetric metric){
+    return metric == DistanceMetric::cosine_similarity ? 1 - distance : -distance;
+}
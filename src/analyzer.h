@@ -0,0 +1,502 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <cctype>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "inverted_index_utils.h"
+
+// tokens are built in a fixed buffer; longer words are cut at a character boundary
+const uint32_t MAX_TOKEN_BYTES = 64;
+const uint32_t MAX_NGRAM_SIZE = 8;
+// n-gram tokens start with this, so they never collide with a word token of the same letters
+const char NGRAM_PREFIX = '#';
+
+// how text is turned into index keys. all zero is the original analyzer: ascii lowercase, every non-alphanumeric
+// byte deleted, split on spaces -- stores written before the analyzer was configurable use it
+struct AnalyzerOptions {
+    bool unicode = false;    // decode utf-8, fold latin accents to ascii, lowercase greek / cyrillic, split on punctuation
+    bool stem = false;       // porter stemmer on ascii words
+    uint32_t ngram_size = 0; // also emit the character n-grams of every word, for fuzzy matching. 0 = off
+};
+
+// martin porter's 1980 algorithm, after his reference c implementation (including its two departures: -bli and
+// -logi). works in place on b[0, k], k the index of the last letter, and returns the new k
+class PorterStemmer {
+    private:
+    char* b;
+    int k;
+    int j;
+
+    bool cons(int i){
+        switch(b[i]){
+            case 'a': case 'e': case 'i': case 'o': case 'u':
+                return false;
+            case 'y':
+                return i == 0 ? true : !cons(i - 1);
+            default:
+                return true;
+        }
+    }
+
+    // the number of vc sequences in b[0, j]
+    int m(){
+        int n = 0;
+        int i = 0;
+        while(true){
+            if(i > j)
+                return n;
+            if(!cons(i))
+                break;
+            i++;
+        }
+        i++;
+        while(true){
+            while(true){
+                if(i > j)
+                    return n;
+                if(cons(i))
+                    break;
+                i++;
+            }
+            i++;
+            n++;
+            while(true){
+                if(i > j)
+                    return n;
+                if(!cons(i))
+                    break;
+                i++;
+            }
+            i++;
+        }
+    }
+
+    bool vowel_in_stem(){
+        for(int i = 0; i <= j; i++){
+            if(!cons(i))
+                return true;
+        }
+        return false;
+    }
+
+    bool double_consonant(int i){
+        return i >= 1 && b[i] == b[i - 1] && cons(i);
+    }
+
+    // consonant - vowel - consonant ending at i, where the last consonant is not w, x or y
+    bool cvc(int i){
+        if(i < 2 || !cons(i) || cons(i - 1) || !cons(i - 2))
+            return false;
+        return b[i] != 'w' && b[i] != 'x' && b[i] != 'y';
+    }
+
+    bool ends(std::string_view s){
+        int length = s.size();
+        if(length > k + 1 || s.back() != b[k])
+            return false;
+        if(memcmp(b + k - length + 1, s.data(), length) != 0)
+            return false;
+        j = k - length;
+        return true;
+    }
+
+    void set_to(std::string_view s){
+        memcpy(b + j + 1, s.data(), s.size());
+        k = j + s.size();
+    }
+
+    void replace(std::string_view s){
+        if(m() > 0)
+            set_to(s);
+    }
+
+    void step1ab(){
+        if(b[k] == 's'){
+            if(ends("sses")){
+                k -= 2;
+            }else if(ends("ies")){
+                set_to("i");
+            }else if(b[k - 1] != 's'){
+                k--;
+            }
+        }
+        if(ends("eed")){
+            if(m() > 0)
+                k--;
+        }else if((ends("ed") || ends("ing")) && vowel_in_stem()){
+            k = j;
+            if(ends("at")){
+                set_to("ate");
+            }else if(ends("bl")){
+                set_to("ble");
+            }else if(ends("iz")){
+                set_to("ize");
+            }else if(double_consonant(k)){
+                k--;
+                if(b[k] == 'l' || b[k] == 's' || b[k] == 'z')
+                    k++;
+            }else if(m() == 1 && cvc(k)){
+                set_to("e");
+            }
+        }
+    }
+
+    void step1c(){
+        if(ends("y") && vowel_in_stem())
+            b[k] = 'i';
+    }
+
+    void step2(){
+        switch(b[k - 1]){
+            case 'a':
+                if(ends("ational")){ replace("ate"); break; }
+                if(ends("tional")){ replace("tion"); break; }
+                break;
+            case 'c':
+                if(ends("enci")){ replace("ence"); break; }
+                if(ends("anci")){ replace("ance"); break; }
+                break;
+            case 'e':
+                if(ends("izer")){ replace("ize"); break; }
+                break;
+            case 'l':
+                if(ends("bli")){ replace("ble"); break; }
+                if(ends("alli")){ replace("al"); break; }
+                if(ends("entli")){ replace("ent"); break; }
+                if(ends("eli")){ replace("e"); break; }
+                if(ends("ousli")){ replace("ous"); break; }
+                break;
+            case 'o':
+                if(ends("ization")){ replace("ize"); break; }
+                if(ends("ation")){ replace("ate"); break; }
+                if(ends("ator")){ replace("ate"); break; }
+                break;
+            case 's':
+                if(ends("alism")){ replace("al"); break; }
+                if(ends("iveness")){ replace("ive"); break; }
+                if(ends("fulness")){ replace("ful"); break; }
+                if(ends("ousness")){ replace("ous"); break; }
+                break;
+            case 't':
+                if(ends("aliti")){ replace("al"); break; }
+                if(ends("iviti")){ replace("ive"); break; }
+                if(ends("biliti")){ replace("ble"); break; }
+                break;
+            case 'g':
+                if(ends("logi")){ replace("log"); break; }
+                break;
+        }
+    }
+
+    void step3(){
+        switch(b[k]){
+            case 'e':
+                if(ends("icate")){ replace("ic"); break; }
+                if(ends("ative")){ replace(""); break; }
+                if(ends("alize")){ replace("al"); break; }
+                break;
+            case 'i':
+                if(ends("iciti")){ replace("ic"); break; }
+                break;
+            case 'l':
+                if(ends("ical")){ replace("ic"); break; }
+                if(ends("ful")){ replace(""); break; }
+                break;
+            case 's':
+                if(ends("ness")){ replace(""); break; }
+                break;
+        }
+    }
+
+    void step4(){
+        switch(b[k - 1]){
+            case 'a':
+                if(ends("al")) break;
+                return;
+            case 'c':
+                if(ends("ance")) break;
+                if(ends("ence")) break;
+                return;
+            case 'e':
+                if(ends("er")) break;
+                return;
+            case 'i':
+                if(ends("ic")) break;
+                return;
+            case 'l':
+                if(ends("able")) break;
+                if(ends("ible")) break;
+                return;
+            case 'n':
+                if(ends("ant")) break;
+                if(ends("ement")) break;
+                if(ends("ment")) break;
+                if(ends("ent")) break;
+                return;
+            case 'o':
+                if(ends("ion") && j >= 0 && (b[j] == 's' || b[j] == 't')) break;
+                if(ends("ou")) break; // takes care of -ous
+                return;
+            case 's':
+                if(ends("ism")) break;
+                return;
+            case 't':
+                if(ends("ate")) break;
+                if(ends("iti")) break;
+                return;
+            case 'u':
+                if(ends("ous")) break;
+                return;
+            case 'v':
+                if(ends("ive")) break;
+                return;
+            case 'z':
+                if(ends("ize")) break;
+                return;
+            default:
+                return;
+        }
+        if(m() > 1)
+            k = j;
+    }
+
+    void step5(){
+        j = k;
+        if(b[k] == 'e'){
+            int a = m();
+            if(a > 1 || (a == 1 && !cvc(k - 1)))
+                k--;
+        }
+        if(b[k] == 'l' && double_consonant(k) && m() > 1)
+            k--;
+    }
+
+    public:
+
+    // stems the lowercase ascii word in word[0, length) in place and returns its new length
+    uint32_t stem(char* word, uint32_t length){
+        if(length <= 2)
+            return length;
+        b = word;
+        k = length - 1;
+        j = 0;
+        step1ab();
+        if(k > 0){
+            step1c();
+            step2();
+            step3();
+            step4();
+            step5();
+        }
+        return k + 1;
+    }
+};
+
+// the ascii letters latin-1 (U+00C0 - U+00FF) and latin extended-a (U+0100 - U+017F) fold to, lowercased. ß, æ,
+// œ, þ and the like become two letters; × and ÷ are separators (' ')
+const char* LATIN1_FOLD[64] = {
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th", "ss",
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th", "y"
+};
+const char LATIN_EXTENDED_A_FOLD[] =
+    "aaaaaa" "cccccccc" "dddd" "eeeeeeeeee" "gggggggg" "hhhh" "iiiiiiiiii" "ii" "jj" "kkk" "llllllllll" "nnnnnnnnn"
+    "oooooo" "oo" "rrrrrr" "ssssssss" "tttttt" "uuuuuuuuuuuu" "ww" "yyy" "zzzzzz" "s";
+static_assert(sizeof(LATIN_EXTENDED_A_FOLD) == 0x80 + 1, "one letter per code point");
+
+// turns text into index keys in one pass over it. a token is assembled in a stack buffer and handed out as a
+// string_view, so nothing is allocated per token; keys() is a convenience that does copy.
+// positions count every word, common words included, so phrases line up across the words that are dropped
+class Analyzer {
+    private:
+    AnalyzerOptions options;
+    std::vector<std::string> common_words; // sorted
+
+    bool is_common_word(std::string_view word) const {
+        return std::binary_search(common_words.begin(), common_words.end(), word, [](std::string_view a, std::string_view b){
+            return a < b;
+        });
+    }
+
+    static uint32_t decode_utf8(std::string_view text, size_t& i){
+        unsigned char c = text[i];
+        uint32_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 0;
+        if(length == 0 || i + length > text.size()){
+            i++;
+            return 0; // invalid: a separator
+        }
+        uint32_t cp = length == 1 ? c : c & (0x7f >> length);
+        for(uint32_t n = 1; n < length; n++){
+            unsigned char cont = text[i + n];
+            if((cont >> 6) != 0x2){
+                i++;
+                return 0;
+            }
+            cp = (cp << 6) | (cont & 0x3f);
+        }
+        i += length;
+        return cp;
+    }
+
+    static uint32_t encode_utf8(uint32_t cp, char* out){
+        if(cp < 0x80){
+            out[0] = cp;
+            return 1;
+        }
+        if(cp < 0x800){
+            out[0] = 0xc0 | (cp >> 6);
+            out[1] = 0x80 | (cp & 0x3f);
+            return 2;
+        }
+        if(cp < 0x10000){
+            out[0] = 0xe0 | (cp >> 12);
+            out[1] = 0x80 | ((cp >> 6) & 0x3f);
+            out[2] = 0x80 | (cp & 0x3f);
+            return 3;
+        }
+        out[0] = 0xf0 | (cp >> 18);
+        out[1] = 0x80 | ((cp >> 12) & 0x3f);
+        out[2] = 0x80 | ((cp >> 6) & 0x3f);
+        out[3] = 0x80 | (cp & 0x3f);
+        return 4;
+    }
+
+    // the normalized form of one code point: bytes to append to the word, "" to drop it (apostrophes, combining
+    // accents -- so decomposed and precomposed accents agree), or " " to end the word
+    static std::string_view fold(uint32_t cp, char* scratch){
+        if(cp < 0x80){
+            if(std::isalnum(cp)){
+                scratch[0] = std::tolower(cp);
+                return std::string_view(scratch, 1);
+            }
+            return cp == '\'' ? "" : " ";
+        }
+        if(cp == 0x2019 || (cp >= 0x300 && cp <= 0x36f))
+            return "";
+        if(cp < 0xc0 || (cp >= 0x2000 && cp <= 0x2e7f) || (cp >= 0x3000 && cp <= 0x303f) || (cp >= 0xff00 && cp <= 0xff0f))
+            return " "; // latin-1 and general / cjk punctuation, symbols, spaces
+        if(cp < 0x100)
+            return LATIN1_FOLD[cp - 0xc0];
+        if(cp == 0x132 || cp == 0x133)
+            return "ij";
+        if(cp == 0x152 || cp == 0x153)
+            return "oe";
+        if(cp < 0x180)
+            return std::string_view(LATIN_EXTENDED_A_FOLD + (cp - 0x100), 1);
+        if(cp >= 0x391 && cp <= 0x3a9)
+            cp += 0x20; // greek capitals
+        else if(cp >= 0x410 && cp <= 0x42f)
+            cp += 0x20; // cyrillic capitals
+        else if(cp >= 0x400 && cp <= 0x40f)
+            cp += 0x50;
+        return std::string_view(scratch, encode_utf8(cp, scratch));
+    }
+
+    template <typename Fn>
+    void finish_word(char* word, uint32_t length, bool ascii_letters, uint32_t position, char* gram, Fn& emit) const {
+        if(length == 0 || is_common_word(std::string_view(word, length)))
+            return;
+
+        if(options.ngram_size > 0){
+            // n-grams of the unstemmed word, stepping over whole utf-8 characters
+            uint32_t starts[MAX_TOKEN_BYTES + 1];
+            uint32_t num_chars = 0;
+            for(uint32_t i = 0; i < length; i++){
+                if(((unsigned char) word[i] >> 6) != 0x2)
+                    starts[num_chars++] = i;
+            }
+            starts[num_chars] = length;
+            for(uint32_t c = 0; c + options.ngram_size <= num_chars; c++){
+                uint32_t gram_length = starts[c + options.ngram_size] - starts[c];
+                memcpy(gram + 1, word + starts[c], gram_length);
+                emit(std::string_view(gram, gram_length + 1), position, true);
+            }
+        }
+
+        if(options.stem && ascii_letters){
+            length = PorterStemmer().stem(word, length);
+        }
+        emit(std::string_view(word, length), position, false);
+    }
+
+    public:
+
+    Analyzer(const AnalyzerOptions& options = AnalyzerOptions()) :
+        options(options),
+        common_words(read_common_words())
+    {
+        this->options.ngram_size = std::min(options.ngram_size, MAX_NGRAM_SIZE);
+        std::sort(common_words.begin(), common_words.end());
+    }
+
+    const AnalyzerOptions& get_options() const {
+        return options;
+    }
+
+    // calls emit(std::string_view token, uint32_t position, bool is_ngram) for every key of text, in order. the
+    // view is only valid during the call
+    template <typename Fn>
+    void analyze(std::string_view text, Fn emit) const {
+        char word[MAX_TOKEN_BYTES];
+        char gram[1 + MAX_NGRAM_SIZE * 4];
+        gram[0] = NGRAM_PREFIX;
+        char scratch[4];
+        uint32_t length = 0;
+        bool ascii_letters = true;
+        uint32_t position = 0;
+
+        auto end_word = [&](){
+            if(length > 0){
+                finish_word(word, length, ascii_letters, position, gram, emit);
+                position++;
+            }
+            length = 0;
+            ascii_letters = true;
+        };
+
+        size_t i = 0;
+        while(i < text.size()){
+            std::string_view folded;
+            if(!options.unicode){
+                // the original cleanup: only a space separates, anything else that isn't alphanumeric is deleted
+                unsigned char c = text[i++];
+                if(c == ' '){
+                    folded = " ";
+                }else if(std::isalnum(c)){
+                    scratch[0] = std::tolower(c);
+                    folded = std::string_view(scratch, 1);
+                }
+            }else{
+                folded = fold(decode_utf8(text, i), scratch);
+            }
+
+            if(folded == " "){
+                end_word();
+                continue;
+            }
+            if(!folded.empty() && length + folded.size() <= MAX_TOKEN_BYTES){ // empty: a deleted character
+                memcpy(word + length, folded.data(), folded.size());
+                length += folded.size();
+                for(char c : folded){
+                    ascii_letters = ascii_letters && c >= 'a' && c <= 'z';
+                }
+            }
+        }
+        end_word();
+    }
+
+    // every key of text, n-grams included, duplicates kept -- what goes into the inverted index
+    std::vector<std::string> keys(std::string_view text) const {
+        std::vector<std::string> out;
+        analyze(text, [&out](std::string_view token, uint32_t position, bool is_ngram){
+            out.emplace_back(token);
+        });
+        return out;
+    }
+};
@@ -0,0 +1,533 @@
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <map>
+#include <tuple>
+#include <filesystem>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "embedding_store.h"
+#include "inverted_index.h"
+
+namespace fs = std::filesystem;
+
+// all datasets are synthetic and generated on first use under the temp dir, then reused by every benchmark
+// that asks for the same shape. nothing here touches the network or the research/ data
+fs::path bench_root(){
+    static fs::path root = [](){
+        fs::path p = fs::temp_directory_path() / ("embedding_search_bench_" + std::to_string(getpid()));
+        fs::remove_all(p);
+        fs::create_directories(p);
+        return p;
+    }();
+    return root;
+}
+
+std::vector<float> random_embedding(std::mt19937& gen, uint32_t dims){
+    std::normal_distribution<float> dist(0, 1);
+    std::vector<float> embedding(dims);
+    float norm = 0;
+    for(float& f : embedding){
+        f = dist(gen);
+        norm += f * f;
+    }
+    norm = std::sqrt(norm);
+    for(float& f : embedding)
+        f /= norm;
+    return embedding;
+}
+
+// zipf-ish text so the inverted index sees a realistic mix of hot and rare keys
+std::string random_text(std::mt19937& gen, uint32_t num_words){
+    static const std::vector<std::string> vocabulary = [](){
+        std::vector<std::string> words;
+        for(int i = 0; i < 5000; i++)
+            words.push_back("term" + std::to_string(i));
+        return words;
+    }();
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::string text;
+    for(uint32_t i = 0; i < num_words; i++){
+        size_t rank = (size_t) (std::pow(vocabulary.size(), uniform(gen))) - 1;
+        text += vocabulary[std::min(rank, vocabulary.size() - 1)] + " ";
+    }
+    return text;
+}
+
+struct Dataset {
+    fs::path dir;
+    uint32_t dims;
+    uint32_t rows;
+    bool hybrid;
+    std::vector<std::vector<float>> queries;
+};
+
+uint32_t store_size_for(uint32_t dims, uint32_t rows){
+    return (uint64_t) dims * sizeof(float) * rows + 4096;
+}
+
+const Dataset& get_dataset(uint32_t dims, uint32_t rows, bool hybrid = false){
+    static std::map<std::tuple<uint32_t, uint32_t, bool>, std::unique_ptr<Dataset>> datasets;
+    auto key = std::make_tuple(dims, rows, hybrid);
+    auto it = datasets.find(key);
+    if(it != datasets.end())
+        return *it->second;
+
+    auto dataset = std::make_unique<Dataset>();
+    dataset->dir = bench_root() / ("d" + std::to_string(dims) + "_r" + std::to_string(rows) + (hybrid ? "_h" : ""));
+    dataset->dims = dims;
+    dataset->rows = rows;
+    dataset->hybrid = hybrid;
+
+    std::mt19937 gen(dims * 31 + rows);
+    {
+        EmbeddingStore store(dataset->dir.c_str(), dims, store_size_for(dims, rows), rows * 256 + 4096, hybrid);
+        for(uint32_t i = 0; i < rows; i++){
+            store.add_embedding(random_embedding(gen, dims), hybrid ? random_text(gen, 8) : std::to_string(i));
+        }
+    }
+    for(int i = 0; i < 64; i++){
+        dataset->queries.push_back(random_embedding(gen, dims));
+    }
+
+    return *(datasets[key] = std::move(dataset));
+}
+
+// per-query latency percentiles on top of google benchmark's mean time
+class LatencyRecorder {
+    std::vector<double> latencies_us;
+    std::chrono::steady_clock::time_point start;
+
+    public:
+
+    void begin(){
+        start = std::chrono::steady_clock::now();
+    }
+
+    void end(){
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        latencies_us.push_back(std::chrono::duration<double, std::micro>(elapsed).count());
+    }
+
+    void report(benchmark::State& state){
+        if(latencies_us.empty())
+            return;
+        std::sort(latencies_us.begin(), latencies_us.end());
+        auto percentile = [&](double p){
+            return latencies_us[std::min(latencies_us.size() - 1, (size_t) (p * latencies_us.size()))];
+        };
+        state.counters["p50_us"] = percentile(0.50);
+        state.counters["p90_us"] = percentile(0.90);
+        state.counters["p99_us"] = percentile(0.99);
+        state.counters["QPS"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+    }
+};
+
+// drops the page cache for a file so the next mmap access has to go to disk
+void evict_from_page_cache(const fs::path& path){
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+DistanceMetric metric_from_arg(int64_t arg){
+    return static_cast<DistanceMetric>(arg);
+}
+
+// --- ingest ---
+
+static void BM_Ingest(benchmark::State& state){
+    uint32_t dims = state.range(0);
+    bool hybrid = state.range(1);
+    uint32_t rows_per_iteration = 1000;
+
+    std::mt19937 gen(7);
+    std::vector<std::vector<float>> embeddings;
+    std::vector<std::string> values;
+    for(uint32_t i = 0; i < rows_per_iteration; i++){
+        embeddings.push_back(random_embedding(gen, dims));
+        values.push_back(random_text(gen, 8));
+    }
+
+    int run = 0;
+    for(auto _ : state){
+        state.PauseTiming();
+        fs::path dir = bench_root() / ("ingest_" + std::to_string(run++));
+        {
+            EmbeddingStore store(dir.c_str(), dims, store_size_for(dims, rows_per_iteration), rows_per_iteration * 256, hybrid);
+            state.ResumeTiming();
+            for(uint32_t i = 0; i < rows_per_iteration; i++){
+                benchmark::DoNotOptimize(store.add_embedding(embeddings[i], values[i]));
+            }
+            state.PauseTiming();
+        }
+        fs::remove_all(dir);
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * rows_per_iteration);
+    state.SetBytesProcessed(state.iterations() * rows_per_iteration * dims * sizeof(float));
+}
+BENCHMARK(BM_Ingest)
+    ->ArgNames({"dims", "hybrid"})
+    ->ArgsProduct({{128, 768}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+// --- brute force scan ---
+
+static void BM_BruteForce(benchmark::State& state){
+    uint32_t dims = state.range(0);
+    uint32_t rows = state.range(1);
+    uint32_t num_threads = state.range(2);
+    DistanceMetric metric = metric_from_arg(state.range(3));
+
+    const Dataset& dataset = get_dataset(dims, rows);
+    EmbeddingStore store(dataset.dir.c_str(), dims);
+    store.warm_up();
+
+    LatencyRecorder latencies;
+    size_t q = 0;
+    for(auto _ : state){
+        latencies.begin();
+        benchmark::DoNotOptimize(store.get_k_closest(dataset.queries[q++ % dataset.queries.size()], 10, num_threads, metric));
+        latencies.end();
+    }
+
+    latencies.report(state);
+    state.SetItemsProcessed(state.iterations() * rows);
+    state.SetBytesProcessed(state.iterations() * rows * dims * sizeof(float));
+}
+BENCHMARK(BM_BruteForce)
+    ->ArgNames({"dims", "rows", "threads", "metric"})
+    ->ArgsProduct({
+        {128, 768},
+        {10000, 100000},
+        {1, 4},
+        {(int64_t) DistanceMetric::cosine_similarity, (int64_t) DistanceMetric::l2_squared}
+    })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// --- hybrid ---
+
+static void BM_HybridQuery(benchmark::State& state){
+    uint32_t dims = state.range(0);
+    uint32_t rows = state.range(1);
+    float keyword_weight = state.range(2) / 100.f;
+
+    const Dataset& dataset = get_dataset(dims, rows, true);
+    EmbeddingStore store(dataset.dir.c_str(), dims, store_size_for(dims, rows), rows * 256 + 4096, true);
+
+    std::mt19937 gen(11);
+    std::vector<std::string> search_strs;
+    for(int i = 0; i < 64; i++)
+        search_strs.push_back(random_text(gen, 3));
+
+    LatencyRecorder latencies;
+    size_t q = 0;
+    for(auto _ : state){
+        latencies.begin();
+        benchmark::DoNotOptimize(store.get_k_closest_hybrid_weighted(
+            search_strs[q % search_strs.size()], dataset.queries[q % dataset.queries.size()], 10, 1,
+            DistanceMetric::cosine_similarity, keyword_weight
+        ));
+        latencies.end();
+        q++;
+    }
+
+    latencies.report(state);
+}
+BENCHMARK(BM_HybridQuery)
+    ->ArgNames({"dims", "rows", "keyword_weight_pct"})
+    ->ArgsProduct({{128}, {10000}, {20, 80}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// --- inverted index ---
+
+static void BM_InvertedIndexInsert(benchmark::State& state){
+    uint32_t num_keys = state.range(0);
+
+    std::vector<std::string> keys;
+    std::mt19937 gen(3);
+    for(uint32_t i = 0; i < num_keys; i++)
+        keys.push_back("term" + std::to_string(gen() % (num_keys / 4 + 1)));
+
+    int run = 0;
+    for(auto _ : state){
+        state.PauseTiming();
+        fs::path dir = bench_root() / ("ii_insert_" + std::to_string(run++));
+        fs::create_directories(dir);
+        {
+            InvertedIndex index(dir.c_str(), num_keys * DEFAULT_BLOCK_SIZE + 4096);
+            state.ResumeTiming();
+            for(uint32_t i = 0; i < num_keys; i++)
+                index.insert(keys[i], {i});
+            state.PauseTiming();
+        }
+        fs::remove_all(dir);
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * num_keys);
+}
+BENCHMARK(BM_InvertedIndexInsert)
+    ->ArgName("keys")
+    ->Arg(1000)->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_InvertedIndexSearch(benchmark::State& state){
+    uint32_t num_keys = state.range(0);
+
+    // google benchmark calls this once per trial run, so start from an empty index every time
+    fs::path dir = bench_root() / ("ii_search_" + std::to_string(num_keys));
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    InvertedIndex index(dir.c_str(), num_keys * DEFAULT_BLOCK_SIZE + 4096);
+    std::mt19937 gen(5);
+    for(uint32_t i = 0; i < num_keys; i++)
+        index.insert("term" + std::to_string(gen() % (num_keys / 4 + 1)), {i});
+
+    LatencyRecorder latencies;
+    uint32_t q = 0;
+    for(auto _ : state){
+        latencies.begin();
+        benchmark::DoNotOptimize(index.search("term" + std::to_string(q++ % (num_keys / 4 + 1))));
+        latencies.end();
+    }
+
+    latencies.report(state);
+}
+BENCHMARK(BM_InvertedIndexSearch)
+    ->ArgName("keys")
+    ->Arg(1000)->Arg(10000)
+    ->Unit(benchmark::kMicrosecond);
+
+// --- cold vs warm mmap ---
+
+static void BM_FirstQuery(benchmark::State& state){
+    uint32_t dims = state.range(0);
+    uint32_t rows = state.range(1);
+    bool warm = state.range(2);
+
+    const Dataset& dataset = get_dataset(dims, rows);
+
+    LatencyRecorder latencies;
+    for(auto _ : state){
+        state.PauseTiming();
+        for(const char* fn : {EMBEDDING_STORE_FN, EMBEDDING_TO_OBJECT_MAP_FN, OBJECT_STORE_FN}){
+            evict_from_page_cache(dataset.dir / fn);
+        }
+        {
+            EmbeddingStore store(dataset.dir.c_str(), dims);
+            if(warm)
+                store.warm_up();
+            state.ResumeTiming();
+
+            latencies.begin();
+            benchmark::DoNotOptimize(store.get_k_closest(dataset.queries[0], 10, 1, DistanceMetric::cosine_similarity));
+            latencies.end();
+
+            state.PauseTiming();
+        }
+        state.ResumeTiming();
+    }
+
+    latencies.report(state);
+}
+BENCHMARK(BM_FirstQuery)
+    ->ArgNames({"dims", "rows", "warm"})
+    ->ArgsProduct({{768}, {100000}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(5)
+    ->UseRealTime();
+
+// --- disk-resident scan ---
+
+// a query against a cold page cache: the mmap scan (mode 0) faults the file in a page at a time, the disk scan reads
+// it in 4 MB chunks through io_uring (1), io_uring with O_DIRECT (2) or the pread fallback (3)
+static void BM_ColdScan(benchmark::State& state){
+    int mode = state.range(0);
+    uint32_t queue_depth = state.range(1);
+    uint32_t dims = 768;
+    uint32_t rows = 100000;
+
+    const Dataset& dataset = get_dataset(dims, rows);
+    DiskScanOptions options;
+    options.queue_depth = queue_depth;
+    options.direct = mode == 2;
+    options.use_io_uring = mode != 3;
+
+    LatencyRecorder latencies;
+    size_t q = 0;
+    for(auto _ : state){
+        // pages mapped by an open store can't be evicted, so every iteration opens the store afresh
+        state.PauseTiming();
+        evict_from_page_cache(dataset.dir / EMBEDDING_STORE_FN);
+        EmbeddingStore store(dataset.dir.c_str(), dims);
+        state.ResumeTiming();
+
+        latencies.begin();
+        const auto& query = dataset.queries[q++ % dataset.queries.size()];
+        if(mode == 0){
+            benchmark::DoNotOptimize(store.get_k_closest(query, 10));
+        }else{
+            benchmark::DoNotOptimize(store.get_k_closest_disk(query, 10, 1, DistanceMetric::cosine_similarity, options));
+        }
+        latencies.end();
+    }
+
+    latencies.report(state);
+    state.SetBytesProcessed(state.iterations() * rows * dims * sizeof(float));
+}
+BENCHMARK(BM_ColdScan)
+    ->ArgNames({"mode", "queue_depth"})
+    ->Args({0, 0})
+    ->Args({1, 1})->Args({1, 8})->Args({1, 32})
+    ->Args({2, 1})->Args({2, 8})->Args({2, 32})
+    ->Args({3, 0})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(5)
+    ->UseRealTime();
+
+// --- reduced-dimension coarse search ---
+
+// random vectors have a flat spectrum, which no projection can compress -- real embeddings don't. these get a
+// power-law spectrum (component i scaled by 1 / sqrt(i + 1)) so PCA has something to find
+const fs::path& get_spectrum_dataset(uint32_t dims, uint32_t rows){
+    static std::map<std::pair<uint32_t, uint32_t>, fs::path> datasets;
+    auto key = std::make_pair(dims, rows);
+    auto it = datasets.find(key);
+    if(it != datasets.end())
+        return it->second;
+
+    fs::path dir = bench_root() / ("spectrum_d" + std::to_string(dims) + "_r" + std::to_string(rows));
+    std::mt19937 gen(dims * 17 + rows);
+    EmbeddingStore store(dir.c_str(), dims, store_size_for(dims, rows), rows * 16 + 4096);
+    for(uint32_t i = 0; i < rows; i++){
+        std::vector<float> embedding = random_embedding(gen, dims);
+        for(uint32_t d = 0; d < dims; d++){
+            embedding[d] /= std::sqrt(d + 1.0f);
+        }
+        store.add_embedding(embedding, std::to_string(i));
+    }
+    return datasets[key] = dir;
+}
+
+// latency of the reduced copy + exact re-rank, with recall@10 against the full scan as a counter. the full-scan
+// baseline for the same data is method 0
+static void BM_ReducedSearch(benchmark::State& state){
+    Reduction reduction = static_cast<Reduction>(state.range(0));
+    uint32_t reduced_dims = state.range(1);
+    uint32_t oversample = state.range(2);
+    uint32_t dims = 768;
+    uint32_t rows = 50000;
+    uint32_t k = 10;
+
+    const fs::path& base = get_spectrum_dataset(dims, rows);
+    fs::path dir = bench_root() / ("reduced_" + std::to_string((int) reduction) + "_" + std::to_string(reduced_dims));
+    if(!fs::exists(dir)){
+        EmbeddingStore source(base.c_str(), dims);
+        source.snapshot(dir.c_str());
+        if(reduction != Reduction::none){
+            EmbeddingStore copy(dir.c_str(), dims);
+            copy.enable_reduced_search(reduced_dims, reduction);
+        }
+    }
+    EmbeddingStore store(dir.c_str(), dims);
+    store.warm_up();
+
+    std::mt19937 gen(99);
+    std::vector<std::vector<float>> queries;
+    std::vector<std::vector<std::pair<float, std::string>>> exact;
+    for(int i = 0; i < 32; i++){
+        queries.push_back(random_embedding(gen, dims));
+        for(uint32_t d = 0; d < dims; d++){
+            queries.back()[d] /= std::sqrt(d + 1.0f);
+        }
+        exact.push_back(store.get_k_closest(queries.back(), k));
+    }
+
+    LatencyRecorder latencies;
+    size_t q = 0;
+    double hits = 0;
+    for(auto _ : state){
+        size_t i = q++ % queries.size();
+        latencies.begin();
+        auto result = store.get_k_closest_reduced(queries[i], k, oversample);
+        latencies.end();
+        for(const auto& r : result){
+            for(const auto& e : exact[i]){
+                hits += r.second == e.second;
+            }
+        }
+    }
+
+    latencies.report(state);
+    state.counters["recall"] = hits / (state.iterations() * k);
+}
+BENCHMARK(BM_ReducedSearch)
+    ->ArgNames({"method", "reduced_dims", "oversample"})
+    ->Args({(int64_t) Reduction::none, 0, 1})
+    ->ArgsProduct({
+        {(int64_t) Reduction::pca, (int64_t) Reduction::random_projection},
+        {64, 128},
+        {4, 16}
+    })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// --- numa placement ---
+
+// scan bandwidth with the workers floating, interleaved or partitioned across nodes. simulated_nodes 0 uses the
+// machine's real topology; on a single-socket box 2 splits the cpus into two fake nodes, which shows the pinning
+// overhead but no locality gain -- the pages can only move between real nodes
+static void BM_NumaPlacement(benchmark::State& state){
+    NumaPlacement placement = static_cast<NumaPlacement>(state.range(0));
+    uint32_t num_threads = state.range(1);
+    uint32_t simulated_nodes = state.range(2);
+    uint32_t dims = 768;
+    uint32_t rows = 100000;
+
+    const Dataset& dataset = get_dataset(dims, rows);
+    EmbeddingStore store(dataset.dir.c_str(), dims);
+    store.warm_up();
+    store.set_numa_placement(placement, simulated_nodes);
+
+    size_t q = 0;
+    for(auto _ : state){
+        benchmark::DoNotOptimize(store.get_k_closest(dataset.queries[q++ % dataset.queries.size()], 10, num_threads));
+    }
+
+    state.counters["nodes"] = simulated_nodes > 0 ? simulated_nodes : NumaTopology::detect().num_nodes();
+    state.SetItemsProcessed(state.iterations() * rows);
+    state.SetBytesProcessed(state.iterations() * rows * dims * sizeof(float));
+}
+BENCHMARK(BM_NumaPlacement)
+    ->ArgNames({"placement", "threads", "simulated_nodes"})
+    ->ArgsProduct({
+        {(int64_t) NumaPlacement::none, (int64_t) NumaPlacement::interleave, (int64_t) NumaPlacement::partition},
+        {4, 16},
+        {0, 2}
+    })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+int main(int argc, char** argv){
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    fs::remove_all(bench_root());
+    return 0;
+}
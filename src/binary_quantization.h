@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// sign-bit copy of an embedding: bit i is set when component i is positive. rows are padded to whole
+// 64-bit words so the hamming loop never has to handle a tail
+uint32_t binary_row_size(uint32_t embedding_size){
+    return (embedding_size + 63) / 64 * sizeof(uint64_t);
+}
+
+void quantize_to_bits(const float* embedding, uint32_t embedding_size, std::vector<char>& bits){
+    bits.assign(binary_row_size(embedding_size), 0);
+    for(uint32_t i = 0; i < embedding_size; i++){
+        if(embedding[i] > 0){
+            bits[i / 8] |= (char) (1 << (i % 8));
+        }
+    }
+}
+
+uint32_t hamming_distance_generic(const char* bits1, const char* bits2, uint32_t num_bytes){
+    uint32_t distance = 0;
+    for(uint32_t i = 0; i < num_bytes; i += sizeof(uint64_t)){
+        uint64_t w1, w2;
+        memcpy(&w1, bits1 + i, sizeof(uint64_t));
+        memcpy(&w2, bits2 + i, sizeof(uint64_t));
+        distance += __builtin_popcountll(w1 ^ w2);
+    }
+    return distance;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// same loop, but lets the compiler emit a single popcnt instead of the bit-twiddling fallback
+__attribute__((target("popcnt")))
+uint32_t hamming_distance_popcnt(const char* bits1, const char* bits2, uint32_t num_bytes){
+    uint32_t distance = 0;
+    for(uint32_t i = 0; i < num_bytes; i += sizeof(uint64_t)){
+        uint64_t w1, w2;
+        memcpy(&w1, bits1 + i, sizeof(uint64_t));
+        memcpy(&w2, bits2 + i, sizeof(uint64_t));
+        distance += __builtin_popcountll(w1 ^ w2);
+    }
+    return distance;
+}
+#endif
+
+using HammingFn = uint32_t (*)(const char*, const char*, uint32_t);
+
+HammingFn get_hamming_distance_fn(){
+#if defined(__x86_64__) || defined(__i386__)
+    static const HammingFn fn = __builtin_cpu_supports("popcnt") ? hamming_distance_popcnt : hamming_distance_generic;
+    return fn;
+#else
+    return hamming_distance_generic;
+#endif
+}
@@ -3,6 +3,8 @@
 
 using OBJECT_STORE_IDX_TYPE = uint32_t;
 const uint32_t OBJECT_STORE_IDX_TYPE_SIZE = sizeof(OBJECT_STORE_IDX_TYPE);
+// set on an object store size prefix when the value behind it is compressed
+const uint32_t COMPRESSED_VALUE_FLAG = 0x80000000;
 
 const uint32_t DEFAULT_WRITE_IDX = sizeof(uint32_t);
 
@@ -10,6 +12,24 @@ const char* EMBEDDING_STORE_FN = "embedding_store.bin";
 const char* EMBEDDING_TO_OBJECT_MAP_FN = "embedding_to_object_map.bin";
 const char* OBJECT_STORE_FN = "object_store.bin";
 const char* INVERTED_INDEX_FN = "inverted_index.bin";
+const char* POSITIONAL_INDEX_FN = "positional_index.bin";
+const char* STORE_HEADER_FN = "store_header.bin";
+const char* BINARY_STORE_FN = "binary_store.bin";
+const char* VALUE_DICTIONARY_FN = "value_dictionary.bin";
+const char* STANDING_QUERIES_FN = "standing_queries.bin";
+const char* REDUCED_STORE_FN = "reduced_store.bin";
+const char* PROJECTION_FN = "projection.bin";
+
+// columnar export -- see EmbeddingStore::export_columnar
+const char* EXPORT_VECTORS_FN = "vectors.npy";
+const char* EXPORT_IDS_FN = "ids.npy";
+const char* EXPORT_VALUES_FN = "values.bin";
+const char* EXPORT_VALUE_OFFSETS_FN = "value_offsets.npy";
+const uint32_t EXPORT_CHUNK_BYTES = 4 * 1024 * 1024;
+
+// diversified search (EmbeddingStore::get_k_closest_diverse) re-ranks this many candidates per requested result
+// unless told otherwise
+const uint32_t MMR_CANDIDATES_PER_RESULT = 4;
 
 uint32_t DEFAULT_MAX_EMBEDDING_STORE_SIZE = 1024 * 1024; // 1024 vectors of 1024 bytes each
 uint32_t DEFAULT_MAX_OBJECT_STORE_SIZE = 1024 * 1024; // 1024 objects of 1024 bytes each
@@ -0,0 +1,139 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// how the reduced copy used by get_k_closest_reduced is made
+enum class Reduction : uint32_t {
+    none = 0,
+    pca = 1,               // the top principal directions of a sample of the rows
+    random_projection = 2  // random orthonormal directions -- no training, distances preserved only on average
+};
+
+const uint32_t REDUCTION_DEFAULT_SAMPLE_ROWS = 4096;
+const uint32_t REDUCTION_PCA_ITERATIONS = 5;
+const uint32_t REDUCTION_SEED = 0x5eed;
+
+// output_dims orthonormal rows of input_dims each. orthonormal rows keep dot products and distances inside the
+// spanned subspace exact, so the reduced copy works with every metric without rescaling
+struct Projection {
+    uint32_t input_dims = 0;
+    uint32_t output_dims = 0;
+    std::vector<float> matrix; // row-major, output_dims x input_dims
+
+    void apply(const float* in, float* out) const {
+        for(uint32_t j = 0; j < output_dims; j++){
+            const float* row = matrix.data() + (size_t) j * input_dims;
+            float sum = 0;
+            for(uint32_t i = 0; i < input_dims; i++){
+                sum += row[i] * in[i];
+            }
+            out[j] = sum;
+        }
+    }
+
+    // [u32 input dims][u32 output dims][matrix]
+    bool save(const fs::path& path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write((const char*) &input_dims, sizeof(uint32_t));
+        file.write((const char*) &output_dims, sizeof(uint32_t));
+        file.write((const char*) matrix.data(), matrix.size() * sizeof(float));
+        return file.good();
+    }
+
+    bool load(const fs::path& path){
+        std::ifstream file(path, std::ios::binary);
+        file.read((char*) &input_dims, sizeof(uint32_t));
+        file.read((char*) &output_dims, sizeof(uint32_t));
+        matrix.resize((size_t) input_dims * output_dims);
+        file.read((char*) matrix.data(), matrix.size() * sizeof(float));
+        return file.good();
+    }
+};
+
+// modified gram-schmidt over the rows of m (rows x cols). a row that collapses (dependent on the ones before it)
+// is replaced with a fresh random one
+void orthonormalize_rows(std::vector<float>& m, uint32_t rows, uint32_t cols, std::mt19937& gen){
+    std::normal_distribution<float> dist(0, 1);
+    for(uint32_t r = 0; r < rows; r++){
+        float* row = m.data() + (size_t) r * cols;
+        for(int attempt = 0; attempt < 4; attempt++){
+            for(uint32_t p = 0; p < r; p++){
+                const float* prev = m.data() + (size_t) p * cols;
+                double dot = 0;
+                for(uint32_t i = 0; i < cols; i++){
+                    dot += (double) row[i] * prev[i];
+                }
+                for(uint32_t i = 0; i < cols; i++){
+                    row[i] -= dot * prev[i];
+                }
+            }
+            double norm = 0;
+            for(uint32_t i = 0; i < cols; i++){
+                norm += (double) row[i] * row[i];
+            }
+            if(norm > 1e-12){
+                float inv = 1.0 / std::sqrt(norm);
+                for(uint32_t i = 0; i < cols; i++){
+                    row[i] *= inv;
+                }
+                break;
+            }
+            for(uint32_t i = 0; i < cols; i++){
+                row[i] = dist(gen);
+            }
+        }
+    }
+}
+
+Projection random_projection(uint32_t input_dims, uint32_t output_dims){
+    std::mt19937 gen(REDUCTION_SEED);
+    std::normal_distribution<float> dist(0, 1);
+    Projection projection;
+    projection.input_dims = input_dims;
+    projection.output_dims = output_dims;
+    projection.matrix.resize((size_t) input_dims * output_dims);
+    for(float& f : projection.matrix){
+        f = dist(gen);
+    }
+    orthonormalize_rows(projection.matrix, output_dims, input_dims, gen);
+    return projection;
+}
+
+// the top output_dims directions of the (uncentered) second moment of the sample rows, by subspace iteration:
+// Q <- orthonormalize(Q X^T X), streaming the rows so neither the sample nor the covariance is materialized.
+// row_fn(i, out) writes sample row i in float32. uncentered so cosine and dot-product geometry is kept as is
+template <typename RowFn>
+Projection learn_pca(uint32_t input_dims, uint32_t output_dims, uint32_t num_rows, RowFn row_fn){
+    Projection projection = random_projection(input_dims, output_dims);
+    if(num_rows == 0)
+        return projection;
+
+    std::mt19937 gen(REDUCTION_SEED + 1);
+    std::vector<float> row(input_dims);
+    std::vector<float> projected(output_dims);
+    std::vector<float> next((size_t) input_dims * output_dims);
+    for(uint32_t iteration = 0; iteration < REDUCTION_PCA_ITERATIONS; iteration++){
+        std::fill(next.begin(), next.end(), 0.0f);
+        for(uint32_t r = 0; r < num_rows; r++){
+            row_fn(r, row.data());
+            projection.apply(row.data(), projected.data());
+            for(uint32_t j = 0; j < output_dims; j++){
+                float* out = next.data() + (size_t) j * input_dims;
+                float scale = projected[j];
+                for(uint32_t i = 0; i < input_dims; i++){
+                    out[i] += scale * row[i];
+                }
+            }
+        }
+        orthonormalize_rows(next, output_dims, input_dims, gen);
+        projection.matrix.swap(next);
+    }
+    return projection;
+}
@@ -0,0 +1,397 @@
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <vector>
+#include <memory>
+#include <future>
+#include <filesystem>
+#include <algorithm>
+
+#include "constants.h"
+#include "scan_kernel.h"
+
+namespace fs = std::filesystem;
+
+// disk-resident scans: instead of faulting the embedding mmap in one page at a time, rows are read in large
+// aligned chunks into two buffers -- the next chunk is in flight while distances are computed on the current one.
+// reads go through io_uring (raw syscalls, no liburing) with up to queue_depth requests per chunk in flight, or
+// through pread on a helper thread where io_uring is unavailable
+struct DiskScanOptions {
+    uint32_t chunk_bytes = 4 * 1024 * 1024; // per buffer; two buffers per scan thread
+    uint32_t queue_depth = 8;               // io_uring reads in flight per chunk
+    bool direct = false;                    // O_DIRECT: bypass (and don't pollute) the page cache, where supported
+    bool use_io_uring = true;               // false forces the pread fallback
+};
+
+const uint32_t DISK_SCAN_ALIGNMENT = 4096; // O_DIRECT needs offsets, sizes and buffers aligned to the block size
+
+// the bare minimum of io_uring: queue reads, submit, reap completions
+class IoUring {
+    private:
+    int ring_fd = -1;
+    char* sq_ring = nullptr;
+    char* cq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    io_uring_cqe* cqes;
+    uint32_t to_submit = 0;
+
+    public:
+
+    // is_open() is false if the kernel doesn't allow io_uring
+    IoUring(uint32_t entries){
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if(ring_fd < 0){
+            ring_fd = -1;
+            return;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap){
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        void* sq = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        void* cq = single_mmap ? sq : mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* s = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if(sq == MAP_FAILED || cq == MAP_FAILED || s == MAP_FAILED){
+            if(sq != MAP_FAILED) munmap(sq, sq_ring_size);
+            if(cq != MAP_FAILED && !single_mmap) munmap(cq, cq_ring_size);
+            if(s != MAP_FAILED) munmap(s, sqes_size);
+            close(ring_fd);
+            ring_fd = -1;
+            return;
+        }
+        sq_ring = (char*) sq;
+        cq_ring = single_mmap ? nullptr : (char*) cq; // only unmapped when separate
+        sqes = (io_uring_sqe*) s;
+
+        sq_head = (uint32_t*) ((char*) sq + params.sq_off.head);
+        sq_tail = (uint32_t*) ((char*) sq + params.sq_off.tail);
+        sq_mask = *(uint32_t*) ((char*) sq + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        sq_array = (uint32_t*) ((char*) sq + params.sq_off.array);
+        cq_head = (uint32_t*) ((char*) cq + params.cq_off.head);
+        cq_tail = (uint32_t*) ((char*) cq + params.cq_off.tail);
+        cq_mask = *(uint32_t*) ((char*) cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*) ((char*) cq + params.cq_off.cqes);
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring(){
+        if(ring_fd == -1)
+            return;
+        munmap(sqes, sqes_size);
+        munmap(sq_ring, sq_ring_size);
+        if(cq_ring)
+            munmap(cq_ring, cq_ring_size);
+        close(ring_fd);
+    }
+
+    bool is_open() const {
+        return ring_fd != -1;
+    }
+
+    // false if the submission queue is full -- submit first
+    bool queue_read(int fd, void* buf, uint32_t length, uint64_t offset, uint64_t user_data){
+        uint32_t tail = *sq_tail;
+        if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+            return false;
+        uint32_t index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t) buf;
+        sqe->len = length;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        to_submit++;
+        return true;
+    }
+
+    // submits what was queued and blocks until at least wait_for completions are ready. < 0 on error
+    int submit(uint32_t wait_for){
+        uint32_t flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int rc = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_for, flags, NULL, 0);
+        if(rc >= 0)
+            to_submit -= std::min((uint32_t) rc, to_submit);
+        return rc;
+    }
+
+    // fn(user_data, result) for every completion ready now
+    template <typename Fn>
+    uint32_t reap(Fn fn){
+        uint32_t head = *cq_head;
+        uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        uint32_t count = 0;
+        for(; head != tail; head++, count++){
+            const io_uring_cqe& cqe = cqes[head & cq_mask];
+            fn(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+};
+
+// reads every byte of [offset, offset + length) with pread, zero-filling past file_size (which also keeps an
+// O_DIRECT fd from retrying at the unaligned offset a short read leaves at eof). false on a read error
+bool pread_fully(int fd, char* buf, size_t length, uint64_t offset, uint64_t file_size){
+    while(length > 0){
+        if(offset >= file_size){
+            memset(buf, 0, length);
+            return true;
+        }
+        ssize_t n = pread(fd, buf, length, offset);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return false;
+        if(n == 0){
+            memset(buf, 0, length);
+            return true;
+        }
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// streams rows [start, end) of a file laid out as [header_size bytes][row][row]... through two aligned buffers.
+// next() hands out one chunk of rows and starts reading the one after it, so the caller computes on a chunk while
+// the following one is read
+class DiskRowReader {
+    private:
+    struct Slot {
+        char* buffer = nullptr;
+        uint32_t first_row = 0;
+        uint32_t num_rows = 0;
+        uint64_t file_offset = 0;    // aligned start of the read
+        uint32_t data_offset = 0;    // where first_row starts in buffer
+        uint32_t length = 0;         // aligned bytes read
+        uint32_t pending = 0;        // io_uring pieces still in flight
+        std::future<bool> read;      // pread fallback
+    };
+
+    int fd = -1;
+    uint64_t file_size = 0;
+    uint32_t row_size;
+    uint32_t header_size;
+    DiskScanOptions options;
+    uint32_t chunk_rows;
+    uint32_t piece_size;
+    std::unique_ptr<IoUring> ring;
+    Slot slots[2];
+
+    uint32_t next_row = 0;   // first row not yet requested
+    uint32_t end_row = 0;
+    uint32_t current = 0;    // slot handed out by the last next()
+    bool started = false;
+    bool failed_ = false;
+
+    public:
+
+    DiskRowReader(const fs::path& path, uint32_t row_size, uint32_t header_size, const DiskScanOptions& options) :
+        row_size(row_size), header_size(header_size), options(options)
+    {
+        if(options.direct)
+            fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+        if(fd == -1) // no O_DIRECT on this filesystem (tmpfs, ...) -- buffered reads still work
+            fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if(fd == -1 || fstat(fd, &st) != 0)
+            return;
+        file_size = st.st_size;
+
+        chunk_rows = std::max(1u, options.chunk_bytes / row_size);
+        uint32_t buffer_size = align_up((uint64_t) chunk_rows * row_size) + 2 * DISK_SCAN_ALIGNMENT;
+        for(Slot& slot : slots){
+            slot.buffer = (char*) aligned_alloc(DISK_SCAN_ALIGNMENT, buffer_size);
+        }
+
+        uint32_t queue_depth = std::max(1u, options.queue_depth);
+        piece_size = std::max(DISK_SCAN_ALIGNMENT, align_up(buffer_size / queue_depth));
+        if(options.use_io_uring){
+            ring = std::make_unique<IoUring>(2 * queue_depth);
+            if(!ring->is_open())
+                ring.reset();
+        }
+    }
+
+    DiskRowReader(const DiskRowReader&) = delete;
+    DiskRowReader& operator=(const DiskRowReader&) = delete;
+
+    ~DiskRowReader(){
+        // nothing may still be writing into the buffers
+        for(Slot& slot : slots){
+            if(slot.read.valid())
+                slot.read.wait();
+        }
+        if(ring){
+            while(slots[0].pending + slots[1].pending > 0 && ring->submit(1) >= 0){
+                ring->reap([&](uint64_t user_data, int32_t res){ slots[user_data >> 32].pending--; });
+            }
+        }
+        ring.reset();
+        for(Slot& slot : slots){
+            free(slot.buffer);
+        }
+        if(fd != -1)
+            close(fd);
+    }
+
+    bool is_open() const {
+        return fd != -1 && slots[0].buffer && slots[1].buffer;
+    }
+
+    bool using_io_uring() const {
+        return ring != nullptr;
+    }
+
+    // true once any read failed -- the rows handed out so far are still valid
+    bool failed() const {
+        return failed_;
+    }
+
+    void begin(uint32_t start, uint32_t end){
+        next_row = start;
+        end_row = end;
+        started = false;
+        request(0);
+        request(1);
+    }
+
+    // the next chunk of rows: rows points at row first_row, num_rows of them. false when done or after a failure
+    bool next(const char*& rows, uint32_t& first_row, uint32_t& num_rows){
+        if(started){
+            request(current); // the caller is done with it -- refill it while the other one is consumed
+            current ^= 1;
+        }
+        started = true;
+        Slot& slot = slots[current];
+        if(slot.num_rows == 0 || !wait(slot))
+            return false;
+        rows = slot.buffer + slot.data_offset;
+        first_row = slot.first_row;
+        num_rows = slot.num_rows;
+        return true;
+    }
+
+    private:
+
+    static uint32_t align_up(uint64_t n){
+        return (n + DISK_SCAN_ALIGNMENT - 1) / DISK_SCAN_ALIGNMENT * DISK_SCAN_ALIGNMENT;
+    }
+
+    void request(uint32_t s){
+        Slot& slot = slots[s];
+        slot.num_rows = std::min(chunk_rows, end_row - next_row);
+        slot.first_row = next_row;
+        next_row += slot.num_rows;
+        if(slot.num_rows == 0 || failed_)
+            return;
+
+        uint64_t begin = header_size + (uint64_t) slot.first_row * row_size;
+        uint64_t end = begin + (uint64_t) slot.num_rows * row_size;
+        slot.file_offset = begin / DISK_SCAN_ALIGNMENT * DISK_SCAN_ALIGNMENT;
+        slot.data_offset = begin - slot.file_offset;
+        slot.length = align_up(end - slot.file_offset);
+
+        if(!ring){
+            slot.read = std::async(std::launch::async, pread_fully, fd, slot.buffer, slot.length, slot.file_offset, file_size);
+            return;
+        }
+        for(uint32_t offset = 0; offset < slot.length; offset += piece_size){
+            uint32_t length = std::min(piece_size, slot.length - offset);
+            uint64_t user_data = (uint64_t) s << 32 | offset;
+            // a full submission queue is flushed and tried once more. a piece that still can't be queued fails the
+            // read -- counting it as pending would leave wait() blocked on a completion that never comes
+            bool queued = ring->queue_read(fd, slot.buffer + offset, length, slot.file_offset + offset, user_data)
+                || (ring->submit(0) >= 0 && ring->queue_read(fd, slot.buffer + offset, length, slot.file_offset + offset, user_data));
+            if(!queued){
+                failed_ = true;
+                break;
+            }
+            slot.pending++;
+        }
+        if(ring->submit(0) < 0)
+            failed_ = true; // what was queued is still drained by the destructor
+    }
+
+    bool wait(Slot& slot){
+        if(!ring){
+            failed_ |= !slot.read.valid() || !slot.read.get();
+            return !failed_;
+        }
+        while(slot.pending > 0 && !failed_){
+            if(ring->submit(1) < 0){
+                failed_ = true;
+                break;
+            }
+            ring->reap([&](uint64_t user_data, int32_t res){
+                Slot& done = slots[user_data >> 32];
+                uint32_t offset = user_data & MAX_UINT32;
+                uint32_t length = std::min(piece_size, done.length - offset);
+                done.pending--;
+                // short reads only happen at eof, errors e.g. where O_DIRECT is refused -- finish those with pread
+                if(res < 0 || (uint32_t) res < length){
+                    uint32_t got = std::max(res, 0);
+                    if(!pread_fully(fd, done.buffer + offset + got, length - got, done.file_offset + offset + got, file_size))
+                        failed_ = true;
+                }
+            });
+        }
+        return !failed_;
+    }
+};
+
+// scan_rows over rows [start, end) of the embedding file at path, read through a DiskRowReader. the heap,
+// counters and results are exactly those of the mmap scan. -1 if the file could not be read
+template <DistanceMetric METRIC, uint32_t DIM, typename ScoreFn>
+int scan_rows_from_disk(
+    const fs::path& path, float* query, uint32_t row_size, uint32_t embedding_size, ElementType element_type,
+    uint32_t start, uint32_t end, uint32_t k, ScoreFn score_fn,
+    std::vector<ScoredRow>& heap, ScanCounters& counters, const DiskScanOptions& options
+){
+    DiskRowReader reader(path, row_size, DEFAULT_WRITE_IDX, options);
+    if(!reader.is_open())
+        return -1;
+    reader.begin(start, end);
+    const char* rows;
+    uint32_t first_row, num_rows;
+    while(reader.next(rows, first_row, num_rows)){
+        scan_rows<METRIC, DIM>(
+            query, const_cast<char*>(rows), row_size, embedding_size, element_type,
+            first_row, first_row + num_rows, k, score_fn, heap, counters, first_row
+        );
+    }
+    return reader.failed() ? -1 : 0;
+}
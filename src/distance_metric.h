@@ -4,7 +4,11 @@
 #include <iostream>
 #include <stdint.h>
 #include <limits>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
 
+#include "element_type.h"
 #include "utils.h"
 
 enum class DistanceMetric {
@@ -13,69 +17,238 @@ enum class DistanceMetric {
     l2_squared
 };
 
+// half precision rows are widened this many components at a time into a stack buffer
+const uint32_t DECODE_CHUNK_SIZE = 64;
 
-float compute_cosine_similarity_distance(float* embedding1, char* embedding2, uint32_t embedding_size){
-    uint32_t float_size = sizeof(float);
-    
-    float dot_product = 0;
-    float norm1 = 0;
-    float norm2 = 0;
+// calls fn(query_chunk, row_chunk, len) over the row in float32, converting fp16/bf16 rows on the fly.
+// returning false from fn stops the walk early
+template <typename ChunkFn>
+void for_each_decoded_chunk(float* embedding1, char* embedding2, uint32_t embedding_size, ElementType element_type, ChunkFn fn){
+    if(element_type == ElementType::float32){
+        fn(embedding1, reinterpret_cast<const float*>(embedding2), embedding_size);
+        return;
+    }
 
-    for(uint32_t i = 0; i < embedding_size; i++){
-        float f1 = *(embedding1 + i);
-        float f2 = char_to_float(embedding2 + i * float_size, float_size);
+    uint32_t elem_size = element_size(element_type);
+    float buf[DECODE_CHUNK_SIZE];
+    for(uint32_t start = 0; start < embedding_size; start += DECODE_CHUNK_SIZE){
+        uint32_t len = std::min(DECODE_CHUNK_SIZE, embedding_size - start);
+        decode_elements(element_type, embedding2 + start * elem_size, buf, len);
+        if(!fn(embedding1 + start, buf, len))
+            return;
+    }
+}
 
-        dot_product += f1 * f2;
-        norm1 += f1 * f1;
-        norm2 += f2 * f2; 
+float cosine_distance_from_sums(double dot_product, double norm1, double norm2){
+    if(norm1 == 0 || norm2 == 0){
+        return 1; // undefined for zero vectors -- treat as orthogonal rather than letting NaN into the heap
     }
-    return 1 - dot_product / (sqrt(norm1) * sqrt(norm2));
+    // a single sqrt of the product keeps that exactness; clamp what rounding can still push below 0
+    return std::max(0.0, 1 - dot_product / sqrt(norm1 * norm2));
 }
 
+float compute_cosine_similarity_distance(
+    float* embedding1, char* embedding2, uint32_t embedding_size, ElementType element_type = ElementType::float32
+){
+    // accumulate in double: products of two floats are exact, so parallel vectors come out at exactly 0
+    double dot_product = 0;
+    double norm1 = 0;
+    double norm2 = 0;
+
+    for_each_decoded_chunk(embedding1, embedding2, embedding_size, element_type,
+        [&](const float* chunk1, const float* chunk2, uint32_t len){
+            for(uint32_t i = 0; i < len; i++){
+                float f1 = chunk1[i];
+                float f2 = char_to_float((char*) (chunk2 + i), sizeof(float));
+
+                dot_product += (double) f1 * f2;
+                norm1 += (double) f1 * f1;
+                norm2 += (double) f2 * f2;
+            }
+            return true;
+        }
+    );
+
+    return cosine_distance_from_sums(dot_product, norm1, norm2);
+}
+
+template <typename DistanceMetricFn>
 float compute_increasing_distance_metric_helper(
     float* embedding1, char* embedding2, uint32_t embedding_size, float thres,
-    std::function<float(float, float)> distance_metric_fn
+    ElementType element_type, DistanceMetricFn distance_metric_fn
 ){
-    uint32_t float_size = sizeof(float);
-
     float distance = 0;
-    for(uint32_t i = 0; i < embedding_size; i++){
-        float f1 = *(embedding1 + i);
-        float f2 = char_to_float(embedding2 + i * float_size, float_size);
+    bool exceeded = false;
+    for_each_decoded_chunk(embedding1, embedding2, embedding_size, element_type,
+        [&](const float* chunk1, const float* chunk2, uint32_t len){
+            for(uint32_t i = 0; i < len; i++){
+                float f1 = chunk1[i];
+                float f2 = char_to_float((char*) (chunk2 + i), sizeof(float));
 
-        distance += distance_metric_fn(f1, f2);
-        if(distance > thres){
-            return std::numeric_limits<float>::max();
+                distance += distance_metric_fn(f1, f2);
+                if(distance > thres){
+                    exceeded = true;
+                    return false;
+                }
+            }
+            return true;
         }
-    }
+    );
 
-    return distance;
+    return exceeded ? std::numeric_limits<float>::max() : distance;
 }
 
-float compute_manhattan_distance(float* embedding1, char* embedding2, uint32_t embedding_size, float thres){
+float compute_manhattan_distance(
+    float* embedding1, char* embedding2, uint32_t embedding_size, float thres, ElementType element_type = ElementType::float32
+){
     return compute_increasing_distance_metric_helper(
-        embedding1, embedding2, embedding_size, thres, 
+        embedding1, embedding2, embedding_size, thres, element_type,
         [](float a, float b){return std::abs(a - b);}
-    ); 
+    );
 }
 
-float compute_l2_squared_distance(float* embedding1, char* embedding2, uint32_t embedding_size, float thres){
+float compute_l2_squared_distance(
+    float* embedding1, char* embedding2, uint32_t embedding_size, float thres, ElementType element_type = ElementType::float32
+){
     return compute_increasing_distance_metric_helper(
-        embedding1, embedding2, embedding_size, thres, 
+        embedding1, embedding2, embedding_size, thres, element_type,
         [](float a, float b){return (a - b) * (a - b);}
     );
 }
 
 
-float compute_distance(float* embedding1, char* embedding2, uint32_t embedding_size, DistanceMetric metric, float thres = 0){
+// the dimensions we deploy get their own kernels with a compile-time trip count. the loops run KERNEL_LANES
+// independent accumulators so the compiler can keep them in vector registers without reassociating anything,
+// and L1/L2 only test the early-exit bound every THRES_CHECK_STRIDE components
+const uint32_t KERNEL_LANES = 8;
+const uint32_t THRES_CHECK_STRIDE = 64;
+
+// calls fn with std::integral_constant<uint32_t, embedding_size> for a specialized size, and with 0 otherwise
+template <typename Fn>
+decltype(auto) with_dimension(uint32_t embedding_size, Fn fn){
+    switch(embedding_size){
+        case 128: return fn(std::integral_constant<uint32_t, 128>());
+        case 256: return fn(std::integral_constant<uint32_t, 256>());
+        case 384: return fn(std::integral_constant<uint32_t, 384>());
+        case 512: return fn(std::integral_constant<uint32_t, 512>());
+        case 768: return fn(std::integral_constant<uint32_t, 768>());
+        case 1024: return fn(std::integral_constant<uint32_t, 1024>());
+        case 1536: return fn(std::integral_constant<uint32_t, 1536>());
+        case 3072: return fn(std::integral_constant<uint32_t, 3072>());
+        default: return fn(std::integral_constant<uint32_t, 0>());
+    }
+}
+
+// calls fn with std::integral_constant<DistanceMetric, metric>, so a kernel can take the metric as a template parameter
+template <typename Fn>
+decltype(auto) with_metric(DistanceMetric metric, Fn fn){
     switch(metric){
-        case DistanceMetric::cosine_similarity:
-            return compute_cosine_similarity_distance(embedding1, embedding2, embedding_size);
-        case DistanceMetric::manhattan:
-            return compute_manhattan_distance(embedding1, embedding2, embedding_size, thres);
-        case DistanceMetric::l2_squared:
-            return compute_l2_squared_distance(embedding1, embedding2, embedding_size, thres);
-        default:
-            throw std::invalid_argument("Invalid distance metric");
+        case DistanceMetric::manhattan: return fn(std::integral_constant<DistanceMetric, DistanceMetric::manhattan>());
+        case DistanceMetric::l2_squared: return fn(std::integral_constant<DistanceMetric, DistanceMetric::l2_squared>());
+        default: return fn(std::integral_constant<DistanceMetric, DistanceMetric::cosine_similarity>());
     }
 }
+
+uint32_t get_kernel_dimension(uint32_t embedding_size){
+    return with_dimension(embedding_size, [](auto dim){ return dim.value; });
+}
+
+template <uint32_t DIM>
+float compute_cosine_similarity_distance_fixed(const float* embedding1, const float* embedding2){
+    static_assert(DIM % KERNEL_LANES == 0, "specialized dimensions must be a multiple of KERNEL_LANES");
+    double dot_product[KERNEL_LANES] = {};
+    double norm1[KERNEL_LANES] = {};
+    double norm2[KERNEL_LANES] = {};
+    for(uint32_t i = 0; i < DIM; i += KERNEL_LANES){
+        for(uint32_t l = 0; l < KERNEL_LANES; l++){
+            double f1 = embedding1[i + l];
+            double f2 = embedding2[i + l];
+            dot_product[l] += f1 * f2;
+            norm1[l] += f1 * f1;
+            norm2[l] += f2 * f2;
+        }
+    }
+
+    double dot_product_sum = 0, norm1_sum = 0, norm2_sum = 0;
+    for(uint32_t l = 0; l < KERNEL_LANES; l++){
+        dot_product_sum += dot_product[l];
+        norm1_sum += norm1[l];
+        norm2_sum += norm2[l];
+    }
+    return cosine_distance_from_sums(dot_product_sum, norm1_sum, norm2_sum);
+}
+
+template <uint32_t DIM, typename DistanceMetricFn>
+float compute_increasing_distance_fixed(
+    const float* embedding1, const float* embedding2, float thres, DistanceMetricFn distance_metric_fn
+){
+    static_assert(DIM % THRES_CHECK_STRIDE == 0, "specialized dimensions must be a multiple of THRES_CHECK_STRIDE");
+    float acc[KERNEL_LANES] = {};
+    auto total = [&acc](){
+        float sum = 0;
+        for(uint32_t l = 0; l < KERNEL_LANES; l++)
+            sum += acc[l];
+        return sum;
+    };
+
+    for(uint32_t block = 0; block < DIM; block += THRES_CHECK_STRIDE){
+        for(uint32_t i = block; i < block + THRES_CHECK_STRIDE; i += KERNEL_LANES){
+            for(uint32_t l = 0; l < KERNEL_LANES; l++){
+                acc[l] += distance_metric_fn(embedding1[i + l], embedding2[i + l]);
+            }
+        }
+        if(thres != std::numeric_limits<float>::max() && total() > thres){
+            return std::numeric_limits<float>::max();
+        }
+    }
+    return total();
+}
+
+// compile-time metric (and, when DIM != 0, dimension) for the scan kernels, so the per-row call has no switch
+template <DistanceMetric METRIC, uint32_t DIM = 0>
+float compute_distance(
+    float* embedding1, char* embedding2, uint32_t embedding_size, float thres, ElementType element_type
+){
+    if constexpr(DIM != 0){
+        const float* row = reinterpret_cast<const float*>(embedding2);
+        float decoded[DIM];
+        if(element_type != ElementType::float32){
+            decode_elements(element_type, embedding2, decoded, DIM);
+            row = decoded;
+        }
+
+        if constexpr(METRIC == DistanceMetric::cosine_similarity){
+            return compute_cosine_similarity_distance_fixed<DIM>(embedding1, row);
+        }else if constexpr(METRIC == DistanceMetric::manhattan){
+            return compute_increasing_distance_fixed<DIM>(embedding1, row, thres, [](float a, float b){return std::abs(a - b);});
+        }else{
+            return compute_increasing_distance_fixed<DIM>(embedding1, row, thres, [](float a, float b){return (a - b) * (a - b);});
+        }
+    }else if constexpr(METRIC == DistanceMetric::cosine_similarity){
+        return compute_cosine_similarity_distance(embedding1, embedding2, embedding_size, element_type);
+    }else if constexpr(METRIC == DistanceMetric::manhattan){
+        return compute_manhattan_distance(embedding1, embedding2, embedding_size, thres, element_type);
+    }else{
+        return compute_l2_squared_distance(embedding1, embedding2, embedding_size, thres, element_type);
+    }
+}
+
+// thres lets L1/L2 stop as soon as the partial sum can no longer beat it; the default never stops early
+float compute_distance(
+    float* embedding1, char* embedding2, uint32_t embedding_size, DistanceMetric metric,
+    float thres = std::numeric_limits<float>::max(), ElementType element_type = ElementType::float32
+){
+    // same kernels as the scan, so every search path agrees on the score of a row to the last bit
+    return with_dimension(embedding_size, [&](auto dim) -> float {
+        switch(metric){
+            case DistanceMetric::cosine_similarity:
+                return compute_distance<DistanceMetric::cosine_similarity, dim.value>(embedding1, embedding2, embedding_size, thres, element_type);
+            case DistanceMetric::manhattan:
+                return compute_distance<DistanceMetric::manhattan, dim.value>(embedding1, embedding2, embedding_size, thres, element_type);
+            case DistanceMetric::l2_squared:
+                return compute_distance<DistanceMetric::l2_squared, dim.value>(embedding1, embedding2, embedding_size, thres, element_type);
+            default:
+                throw std::invalid_argument("Invalid distance metric");
+        }
+    });
+}
@@ -0,0 +1,224 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+#include <immintrin.h>
+
+// on-disk type of each embedding component -- queries always stay float32 and rows are converted on the fly
+enum class ElementType : uint32_t {
+    float32 = 0,
+    float16 = 1,
+    bfloat16 = 2
+};
+
+uint32_t element_size(ElementType element_type){
+    switch(element_type){
+        case ElementType::float32:
+            return sizeof(float);
+        case ElementType::float16:
+        case ElementType::bfloat16:
+            return sizeof(uint16_t);
+        default:
+            throw std::invalid_argument("Invalid element type");
+    }
+}
+
+float half_to_float(uint16_t h){
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    uint32_t bits;
+    if(exponent == 0x1f){ // inf / nan
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }else if(exponent != 0){
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }else if(mantissa == 0){
+        bits = sign;
+    }else{ // subnormal -- renormalize
+        exponent = 113;
+        while(!(mantissa & 0x400)){
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+uint16_t float_to_half(float f){
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if(((bits >> 23) & 0xff) == 0xff){ // inf / nan
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    if(exponent >= 0x1f){ // overflow
+        return sign | 0x7c00;
+    }
+    if(exponent <= 0){ // subnormal or underflow to zero
+        if(exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(remainder > halfway || (remainder == halfway && (half_mantissa & 1)))
+            half_mantissa++;
+        return sign | half_mantissa;
+    }
+
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    if(remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        half++; // round to nearest even, may carry into the exponent which is still correct
+    return half;
+}
+
+float bfloat16_to_float(uint16_t b){
+    uint32_t bits = (uint32_t) b << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+uint16_t float_to_bfloat16(float f){
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+    if((bits & 0x7fffffff) > 0x7f800000) // keep nans quiet instead of rounding them to inf
+        return (bits >> 16) | 0x40;
+    bits += 0x7fff + ((bits >> 16) & 1); // round to nearest even
+    return bits >> 16;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EMBEDDING_SEARCH_X86 1
+#endif
+
+#ifdef EMBEDDING_SEARCH_X86
+__attribute__((target("avx,f16c")))
+void decode_float16_f16c(const char* src, float* dst, uint32_t n){
+    uint32_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        __m128i h = _mm_loadu_si128((const __m128i*) (src + i * sizeof(uint16_t)));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    for(; i < n; i++){
+        uint16_t h; memcpy(&h, src + i * sizeof(uint16_t), sizeof(uint16_t));
+        dst[i] = half_to_float(h);
+    }
+}
+
+__attribute__((target("avx512f,avx512bf16")))
+void decode_bfloat16_avx512(const char* src, float* dst, uint32_t n){
+    uint32_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m256i b = _mm256_loadu_si256((const __m256i*) (src + i * sizeof(uint16_t)));
+        _mm512_storeu_ps(dst + i, _mm512_cvtpbh_ps((__m256bh) b));
+    }
+    for(; i < n; i++){
+        uint16_t b; memcpy(&b, src + i * sizeof(uint16_t), sizeof(uint16_t));
+        dst[i] = bfloat16_to_float(b);
+    }
+}
+
+__attribute__((target("avx2")))
+void decode_bfloat16_avx2(const char* src, float* dst, uint32_t n){
+    uint32_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i * sizeof(uint16_t)));
+        __m256i widened = _mm256_slli_epi32(_mm256_cvtepu16_epi32(b), 16);
+        _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(widened));
+    }
+    for(; i < n; i++){
+        uint16_t b; memcpy(&b, src + i * sizeof(uint16_t), sizeof(uint16_t));
+        dst[i] = bfloat16_to_float(b);
+    }
+}
+#endif
+
+void decode_float16_scalar(const char* src, float* dst, uint32_t n){
+    for(uint32_t i = 0; i < n; i++){
+        uint16_t h; memcpy(&h, src + i * sizeof(uint16_t), sizeof(uint16_t));
+        dst[i] = half_to_float(h);
+    }
+}
+
+void decode_bfloat16_scalar(const char* src, float* dst, uint32_t n){
+    for(uint32_t i = 0; i < n; i++){
+        uint16_t b; memcpy(&b, src + i * sizeof(uint16_t), sizeof(uint16_t));
+        dst[i] = bfloat16_to_float(b);
+    }
+}
+
+using DecodeFn = void (*)(const char*, float*, uint32_t);
+
+// resolved once per process from cpuid, so the build doesn't need -march flags to get the fast paths
+DecodeFn get_float16_decoder(){
+#ifdef EMBEDDING_SEARCH_X86
+    static const DecodeFn decoder = __builtin_cpu_supports("f16c") ? decode_float16_f16c : decode_float16_scalar;
+    return decoder;
+#else
+    return decode_float16_scalar;
+#endif
+}
+
+DecodeFn get_bfloat16_decoder(){
+#ifdef EMBEDDING_SEARCH_X86
+    static const DecodeFn decoder = __builtin_cpu_supports("avx512bf16") ? decode_bfloat16_avx512
+        : __builtin_cpu_supports("avx2") ? decode_bfloat16_avx2 : decode_bfloat16_scalar;
+    return decoder;
+#else
+    return decode_bfloat16_scalar;
+#endif
+}
+
+// converts n elements starting at src into dst
+void decode_elements(ElementType element_type, const char* src, float* dst, uint32_t n){
+    switch(element_type){
+        case ElementType::float32:
+            memcpy(dst, src, n * sizeof(float));
+            return;
+        case ElementType::float16:
+            get_float16_decoder()(src, dst, n);
+            return;
+        case ElementType::bfloat16:
+            get_bfloat16_decoder()(src, dst, n);
+            return;
+        default:
+            throw std::invalid_argument("Invalid element type");
+    }
+}
+
+// packs a float32 embedding into its on-disk representation
+void encode_elements(ElementType element_type, const float* src, uint32_t n, std::vector<char>& dst){
+    dst.resize(n * element_size(element_type));
+    switch(element_type){
+        case ElementType::float32:
+            memcpy(dst.data(), src, n * sizeof(float));
+            return;
+        case ElementType::float16:
+            for(uint32_t i = 0; i < n; i++){
+                uint16_t h = float_to_half(src[i]);
+                memcpy(dst.data() + i * sizeof(uint16_t), &h, sizeof(uint16_t));
+            }
+            return;
+        case ElementType::bfloat16:
+            for(uint32_t i = 0; i < n; i++){
+                uint16_t b = float_to_bfloat16(src[i]);
+                memcpy(dst.data() + i * sizeof(uint16_t), &b, sizeof(uint16_t));
+            }
+            return;
+        default:
+            throw std::invalid_argument("Invalid element type");
+    }
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <string>
+#include <csignal>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "embedding_store.h"
+#include "query_server.h"
+
+// usage: embedding_search_server --dir <store dir> --dims <embedding size> [--socket <path>] [--threads <n>]
+//                                [--hybrid] [--float16 | --bfloat16] [--warm-up]
+//                                [--max-embedding-store-size <bytes>] [--max-object-store-size <bytes>]
+// the sizes only matter for a new store (default 1 MB each); an existing store keeps the size of its files
+
+QueryServer* running_server = nullptr;
+
+void handle_signal(int){
+    if(running_server)
+        running_server->stop();
+}
+
+void print_usage(const char* name){
+    std::cerr << "usage: " << name << " --dir <store dir> --dims <embedding size> [--socket <path>] [--threads <n>]"
+              << " [--hybrid] [--float16 | --bfloat16] [--warm-up]"
+              << " [--max-embedding-store-size <bytes>] [--max-object-store-size <bytes>]" << std::endl;
+}
+
+int main(int argc, char** argv){
+    std::string dir;
+    uint32_t dims = 0;
+    std::string socket_path = DEFAULT_SOCKET_PATH;
+    uint32_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    bool hybrid = false;
+    bool warm_up = false;
+    uint32_t max_embedding_store_size = DEFAULT_MAX_EMBEDDING_STORE_SIZE;
+    uint32_t max_object_store_size = DEFAULT_MAX_OBJECT_STORE_SIZE;
+    ElementType element_type = ElementType::float32;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(arg == "--dir" && has_value){
+            dir = argv[++i];
+        }else if(arg == "--dims" && has_value){
+            dims = atoi(argv[++i]);
+        }else if(arg == "--socket" && has_value){
+            socket_path = argv[++i];
+        }else if(arg == "--threads" && has_value){
+            num_threads = atoi(argv[++i]);
+        }else if(arg == "--hybrid"){
+            hybrid = true;
+        }else if(arg == "--float16"){
+            element_type = ElementType::float16;
+        }else if(arg == "--bfloat16"){
+            element_type = ElementType::bfloat16;
+        }else if(arg == "--warm-up"){
+            warm_up = true;
+        }else if(arg == "--max-embedding-store-size" && has_value){
+            max_embedding_store_size = strtoul(argv[++i], nullptr, 10);
+        }else if(arg == "--max-object-store-size" && has_value){
+            max_object_store_size = strtoul(argv[++i], nullptr, 10);
+        }else{
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(dir.empty() || dims == 0 || max_embedding_store_size == 0 || max_object_store_size == 0){
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        EmbeddingStore store(dir.c_str(), dims, max_embedding_store_size, max_object_store_size, hybrid, element_type);
+        if(warm_up){
+            store.warm_up();
+        }
+
+        QueryServer server(store, socket_path, num_threads);
+        running_server = &server;
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+
+        std::cout << "serving " << dir << " (" << store.get_num_embeddings() << " embeddings) on " << socket_path << std::endl;
+        server.run();
+        running_server = nullptr;
+
+        std::cout << "served " << server.get_requests_served() << " requests" << std::endl;
+        store.close_store();
+    } catch(const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -10,19 +10,40 @@
 #include <queue>
 
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
 #include <thread>
 #include <functional>
 #include <filesystem>
 #include <iostream>
 #include <unordered_map>
+#include <memory>
+#include <fstream>
+#include <optional>
+#include <string_view>
 
 #include "constants.h"
 #include "distance_metric.h"
 #include "hybrid_metric.h"
 #include "file_wrapper.h"
+#include "element_type.h"
+#include "store_header.h"
+#include "binary_quantization.h"
+#include "store_stats.h"
+#include "query_cache.h"
+#include "scan_kernel.h"
+#include "value_compression.h"
+#include "aggregation.h"
 
 #include "inverted_index.h"
 #include "inverted_index_utils.h"
+#include "inverted_index_builder.h"
+#include "positional_index.h"
+#include "analyzer.h"
+#include "npy_format.h"
+#include "numa_placement.h"
+#include "disk_scan.h"
+#include "standing_queries.h"
 
 #include "utils.h"
 
@@ -34,18 +55,49 @@ namespace fs = std::filesystem;
 class EmbeddingStore {
     private:
     uint32_t embedding_size;
+    ElementType element_type;
+    uint32_t row_size; // bytes per embedding in embedding_store.bin
+    uint32_t kernel_dimension; // embedding_size if it has specialized distance kernels, 0 for the generic ones
 
     uint32_t max_object_store_size;
     uint32_t max_embedding_store_size;
     uint32_t max_embedding_to_object_map_size;
 
-    InvertedIndex* inverted_index = nullptr; // stores keys to object store idxs 
+    fs::path dir_path;
+    StoreHeader header;
+    MmapOptions mmap_options;
+
+    std::unique_ptr<InvertedIndex> inverted_index; // stores keys to object store idxs 
+    std::unique_ptr<PositionalIndex> positional_index; // word positions per object, for boolean / phrase queries
+    std::unique_ptr<StandingQueries> standing_queries; // only once a standing query has been added
+    Analyzer analyzer; // text -> keys for both indexes, configured by the store header
 
     FileWrapper embedding_store;
     FileWrapper embedding_to_object_map;
     FileWrapper object_store;
+    FileWrapper binary_store; // optional sign-bit copy of embedding_store for the coarse first pass
+    FileWrapper reduced_store; // optional float32 copy in fewer dimensions, see enable_reduced_search
+    Projection projection;     // full rows -> reduced_store rows
+    std::string value_dictionary; // preset dictionary for compressed values, fixed once compression is on
+    ZstdValueCodec zstd_codec;    // value_dictionary, digested
+
+    // rows searches may read. add_object stores it with release only once every file of the object is written and
+    // searches load it with acquire, so a row below it is complete -- behind a pointer so the store stays movable
+    std::unique_ptr<std::atomic<uint32_t>> num_embeddings = std::make_unique<std::atomic<uint32_t>>(0);
 
-    uint32_t num_embeddings;
+    std::unique_ptr<StoreStats> stats_ = std::make_unique<StoreStats>(); // behind a pointer so the store stays movable
+    std::unique_ptr<QueryCache> query_cache; // off unless enable_query_cache() is called
+    std::unique_ptr<std::mutex> write_mutex = std::make_unique<std::mutex>(); // writers vs. snapshot()
+    // queries read positional_index's in-memory postings, which add_object and the rebuild change -- queries take it
+    // shared, those two exclusive (always after write_mutex)
+    std::unique_ptr<std::shared_mutex> positional_mutex = std::make_unique<std::shared_mutex>();
+    // the same for inverted_index: hybrid queries read it, add_object inserts into it and the rebuild replaces it.
+    // taken before positional_mutex when both are needed
+    std::unique_ptr<std::shared_mutex> inverted_mutex = std::make_unique<std::shared_mutex>();
+
+    NumaPlacement numa_placement = NumaPlacement::none; // see set_numa_placement
+    NumaTopology numa_topology;
+    std::vector<uint32_t> numa_part_starts; // first row of each node's part, for NumaPlacement::partition
 
     public:
 
@@ -53,17 +105,20 @@ class EmbeddingStore {
         const char* dir, uint32_t embedding_size, 
         uint32_t max_embedding_store_size = DEFAULT_MAX_EMBEDDING_STORE_SIZE,
         uint32_t max_object_store_size = DEFAULT_MAX_OBJECT_STORE_SIZE,
-        bool hybrid_search_enabled = false
+        bool hybrid_search_enabled = false,
+        ElementType element_type = ElementType::float32,
+        const MmapOptions& mmap_options = MmapOptions()
     ) : 
         embedding_size(embedding_size),
+        element_type(element_type),
         max_object_store_size(max_object_store_size),
         max_embedding_store_size(max_embedding_store_size),
         max_embedding_to_object_map_size(max_embedding_store_size / embedding_size * sizeof(uint32_t)),
-        inverted_index(nullptr),
-        num_embeddings(0)
+        dir_path(dir),
+        mmap_options(mmap_options),
+        inverted_index(nullptr)
     {
-        fs::path dir_path = dir;
-        if(!fs::exists(dir_path)){
+        if(!fs::exists(dir_path) && !mmap_options.read_only){
             fs::create_directories(dir_path);
         }
 
@@ -75,14 +130,67 @@ class EmbeddingStore {
         if(num_paths_exist != 0 && num_paths_exist != 3){
             throw std::runtime_error("All or none of the files should exist, but this is not the case. Invalid state.");
         }
+        if(mmap_options.read_only && num_paths_exist == 0){
+            throw std::runtime_error("Cannot open a store read-only before it has been created.");
+        }
 
-        embedding_store = FileWrapper(embedding_store_path, max_embedding_store_size);
-        embedding_to_object_map = FileWrapper(embedding_to_object_map_path, max_embedding_to_object_map_size);
-        object_store = FileWrapper(object_store_path, max_object_store_size);
+        // the element type of an existing store always comes from its header, like the file sizes do
+        fs::path store_header_path = dir_path / STORE_HEADER_FN;
+        if(read_store_header(store_header_path, header)){
+            if(header.embedding_size != embedding_size){
+                throw std::runtime_error(
+                    "Store was created with embedding size " + std::to_string(header.embedding_size) + 
+                    ", not " + std::to_string(embedding_size) + ".");
+            }
+            this->element_type = header.element_type;
+        }else{
+            if(num_paths_exist == 3){
+                this->element_type = ElementType::float32; // store predates the header
+            }
+            header.embedding_size = embedding_size;
+            header.element_type = this->element_type;
+            if(!mmap_options.read_only){
+                write_store_header(store_header_path, header);
+            }
+        }
+        row_size = embedding_size * ::element_size(this->element_type);
+        analyzer = Analyzer(get_analyzer_options());
+        kernel_dimension = get_kernel_dimension(embedding_size);
+
+        // the embedding store is the only file that is scanned end to end, so it is the only one that gets
+        // the access pattern / hugepage hints -- the others are hit at random when materializing results
+        MmapOptions lookup_options;
+        lookup_options.read_only = mmap_options.read_only;
+
+        embedding_store = FileWrapper(embedding_store_path, max_embedding_store_size, mmap_options);
+        embedding_to_object_map = FileWrapper(embedding_to_object_map_path, max_embedding_to_object_map_size, lookup_options);
+        object_store = FileWrapper(object_store_path, max_object_store_size, lookup_options);
+
+        num_embeddings->store((embedding_store.write_idx - DEFAULT_WRITE_IDX) / row_size, std::memory_order_release);
+
+        if(header.binary_quantization_enabled){
+            open_binary_store();
+        }
+        if(header.reduced_dims > 0){
+            if(!projection.load(dir_path / PROJECTION_FN) || projection.input_dims != embedding_size){
+                throw std::runtime_error("Missing or invalid " + std::string(PROJECTION_FN) + ".");
+            }
+            open_reduced_store();
+        }
+        if(header.value_codec != ValueCodec::none){
+            std::ifstream dictionary_file(dir_path / VALUE_DICTIONARY_FN, std::ios::binary);
+            value_dictionary.assign(std::istreambuf_iterator<char>(dictionary_file), std::istreambuf_iterator<char>());
+            zstd_codec = ZstdValueCodec(value_dictionary);
+        }
 
         if(hybrid_search_enabled){
-            // todo: scrutinize this default a bit more
-            inverted_index = new InvertedIndex(dir, (max_embedding_store_size / embedding_size) * DEFAULT_BLOCK_SIZE);
+            open_text_indexes();
+            index_missing_rows();
+        }
+
+        if(fs::exists(dir_path / STANDING_QUERIES_FN)){
+            standing_queries = std::make_unique<StandingQueries>(dir_path, embedding_size, get_num_embeddings(), lookup_options);
+            standing_queries->score_rows(embedding_store.get_start_addr(), row_size, this->element_type, kernel_dimension, get_num_embeddings());
         }
     }
 
@@ -90,33 +198,126 @@ class EmbeddingStore {
         const char* dir, uint32_t embedding_size, 
         uint32_t max_embedding_store_size = DEFAULT_MAX_EMBEDDING_STORE_SIZE,
         uint32_t max_object_store_size = DEFAULT_MAX_OBJECT_STORE_SIZE,
-        bool hybrid_search_enabled = false
+        bool hybrid_search_enabled = false,
+        ElementType element_type = ElementType::float32
     ){
-        return EmbeddingStore(dir, embedding_size, max_embedding_store_size, max_object_store_size, hybrid_search_enabled);
+        return EmbeddingStore(dir, embedding_size, max_embedding_store_size, max_object_store_size, hybrid_search_enabled, element_type);
+    }
+
+    // query-serving replicas: nothing is resized or written, so any number of processes can map the same files
+    static EmbeddingStore open_read_only(
+        const char* dir, uint32_t embedding_size,
+        bool hybrid_search_enabled = false,
+        MmapOptions mmap_options = MmapOptions()
+    ){
+        mmap_options.read_only = true;
+        return EmbeddingStore(
+            dir, embedding_size, DEFAULT_MAX_EMBEDDING_STORE_SIZE, DEFAULT_MAX_OBJECT_STORE_SIZE, 
+            hybrid_search_enabled, ElementType::float32, mmap_options
+        );
+    }
+
+    // explicit alternative to MmapOptions::populate -- can be called after open, e.g. off the serving path
+    void warm_up(){
+        embedding_store.warm_up();
+        embedding_to_object_map.warm_up();
+        object_store.warm_up();
+        binary_store.warm_up();
+        reduced_store.warm_up();
+    }
+
+    int advise(MmapAdvice advice){
+        return embedding_store.advise(advice);
     }
 
     int add_embedding(std::vector<float> embedding, std::string value){
         if(embedding.size() != embedding_size)
             return -1;
-        // todo: everything is messed up if you write past eof on one file -- no good recovery rn
-        uint32_t value_size = value.size();
-        if(embedding_store.write(embedding.data(), embedding_size * sizeof(float)) < 0)
+        return add_object({std::move(embedding)}, value);
+    }
+
+    // one value with several vectors (chunks, passages, token embeddings, ...). the value is stored once and every
+    // row points at it, so searches can aggregate per object -- see get_k_closest_objects. with hybrid search, -8
+    // means the inverted index might not have room for the value's keys, and nothing was added
+    int add_object(const std::vector<std::vector<float>>& embeddings, const std::string& value){
+        if(embeddings.empty())
+            return -1;
+        for(const auto& embedding : embeddings){
+            if(embedding.size() != embedding_size)
+                return -1;
+        }
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        auto ingest_start = stats_->now();
+
+        // every file is checked before anything is written, so a full one never leaves a partial object behind
+        uint32_t num_rows = embeddings.size();
+        uint32_t first_row = get_num_embeddings(); // only writers change it, and they hold write_mutex
+        if(embedding_store.write_idx + (uint64_t) num_rows * row_size > embedding_store.mmap_size)
             return -2;
-        if(embedding_to_object_map.write(&object_store.write_idx, OBJECT_STORE_IDX_TYPE_SIZE) < 0)
+        if(embedding_to_object_map.write_idx + (uint64_t) num_rows * OBJECT_STORE_IDX_TYPE_SIZE > embedding_to_object_map.mmap_size)
             return -3;
-        if(object_store.write(&value_size, OBJECT_STORE_IDX_TYPE_SIZE) < 0)
-            return -4;
-        if(object_store.write(value.c_str(), value_size) < 0) // won't copy null terminating char
-            return -5;
+        if(binary_store.mmap_addr && binary_store.write_idx + (uint64_t) num_rows * binary_row_size(embedding_size) > binary_store.mmap_size)
+            return -6;
+        if(reduced_store.mmap_addr && reduced_store.write_idx + (uint64_t) num_rows * header.reduced_dims * sizeof(float) > reduced_store.mmap_size)
+            return -7;
+        // the value's keys as the index stores them, padded. every insert may need new blocks, so room for all of
+        // them is checked here too -- otherwise a full index would silently drop keys of a stored object
+        std::vector<char> keys;
+        if(inverted_index){
+            uint32_t key_length = inverted_index->get_key_length();
+            analyzer.analyze(value, [&](std::string_view token, uint32_t position, bool is_ngram){
+                keys.resize(keys.size() + key_length);
+                inverted_index->get_padded_buf(token, keys.data() + keys.size() - key_length);
+            });
+            if(!inverted_index->has_room_for(keys.size() / key_length, num_rows))
+                return -8;
+        }
+
+        uint32_t object_store_offset = object_store.write_idx;
+        int code = write_value(value);
+        if(code != 0)
+            return code;
+
+        std::vector<char> row;
+        std::vector<char> bits;
+        std::vector<float> reduced(header.reduced_dims);
+        std::vector<uint32_t> row_ids;
+        for(const auto& embedding : embeddings){
+            encode_elements(element_type, embedding.data(), embedding_size, row);
+            embedding_store.write(row.data(), row_size);
+            embedding_to_object_map.write(&object_store_offset, OBJECT_STORE_IDX_TYPE_SIZE);
+            if(binary_store.mmap_addr){
+                quantize_to_bits(embedding.data(), embedding_size, bits);
+                binary_store.write(bits.data(), bits.size());
+            }
+            if(reduced_store.mmap_addr){
+                projection.apply(embedding.data(), reduced.data());
+                reduced_store.write(reduced.data(), reduced.size() * sizeof(float));
+            }
+            row_ids.push_back(first_row + row_ids.size()); // row idx serves as a unique id for now, assuming no deletes
+        }
 
         if(inverted_index){
-            std::vector<std::string> keys = get_keys_from_string(value);
-            for(const std::string& key : keys){
-                inverted_index->insert(key, {num_embeddings}); // num_embeddings serves as a unique id for now, assuming no deletes
+            std::unique_lock<std::shared_mutex> inverted_lock(*inverted_mutex);
+            uint32_t key_length = inverted_index->get_key_length();
+            for(size_t offset = 0; offset < keys.size(); offset += key_length){
+                [[maybe_unused]] int insert_code = inverted_index->insert(std::string_view(keys.data() + offset, key_length), row_ids);
+                assert(insert_code == 0); // has_room_for made sure of it
             }
         }
+        if(positional_index){
+            std::unique_lock<std::shared_mutex> positional_lock(*positional_mutex);
+            positional_index->insert(first_row, num_rows, value, analyzer); // a full log is caught up on the next open
+        }
 
-        num_embeddings++;
+        if(standing_queries){
+            standing_queries->score_rows(embedding_store.get_start_addr(), row_size, element_type, kernel_dimension, first_row + num_rows);
+        }
+
+        num_embeddings->store(first_row + num_rows, std::memory_order_release); // publishes the rows to searches
+        stats_->add(stats_->rows_ingested, num_rows);
+        stats_->add(stats_->bytes_ingested, (row_size + OBJECT_STORE_IDX_TYPE_SIZE) * num_rows + OBJECT_STORE_IDX_TYPE_SIZE + value.size());
+        stats_->record(stats_->ingest_latency, ingest_start);
         return 0;    
     }   
 
@@ -126,6 +327,7 @@ class EmbeddingStore {
         uint32_t num_threads = 1, DistanceMetric distance_metric = DistanceMetric::cosine_similarity,
         float keyword_weight = 0.5
     ){
+        std::shared_lock<std::shared_mutex> inverted_lock(*inverted_mutex); // until the keys are looked up
         if(!inverted_index){
             return {};
         }
@@ -137,13 +339,24 @@ class EmbeddingStore {
         if(keyword_weight == 0)
             return get_k_closest(embedding, k, num_threads, distance_metric);
 
+        uint64_t generation = get_num_embeddings(); // read before the scan, so rows appended meanwhile invalidate the entry
+        QueryKey cache_key;
+        if(query_cache){
+            cache_key = make_query_key(embedding, k, (uint32_t) distance_metric, search_str, keyword_weight);
+            std::vector<std::pair<float, std::string>> cached;
+            if(query_cache->lookup(cache_key, generation, cached))
+                return cached;
+        }
+
         std::unordered_map<uint32_t, uint32_t> idx_to_count;
-        std::vector<std::string> keys = get_keys_from_string(search_str);
-        for(const std::string& key : keys){
-            std::vector<uint32_t> vals = inverted_index->search(key);
-            for(auto val: vals)
+        uint64_t num_lookups = 0;
+        analyzer.analyze(search_str, [&](std::string_view token, uint32_t position, bool is_ngram){
+            for(auto val: inverted_index->search(token))
                 idx_to_count[val]++;
-        }
+            num_lookups++;
+        });
+        inverted_lock.unlock();
+        stats_->add(stats_->inverted_index_lookups, num_lookups);
 
         // for(auto [idx, count]: idx_to_count){
         //     std::cout << "idx: " << idx << " count: " << count << std::endl;
@@ -152,8 +365,9 @@ class EmbeddingStore {
         auto comp = [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b){
                 return a.second < b.second;
             };
-        uint32_t min_count = std::min_element(idx_to_count.begin(), idx_to_count.end(), comp)->second;
-        uint32_t max_count = std::max_element(idx_to_count.begin(), idx_to_count.end(), comp)->second;
+        // no key matched anything: every row gets the same keyword score
+        uint32_t min_count = idx_to_count.empty() ? 0 : std::min_element(idx_to_count.begin(), idx_to_count.end(), comp)->second;
+        uint32_t max_count = idx_to_count.empty() ? 0 : std::max_element(idx_to_count.begin(), idx_to_count.end(), comp)->second;
         std::unordered_map<uint32_t, float> idx_to_score;
 
         for(auto [idx, count]: idx_to_count){
@@ -161,110 +375,1511 @@ class EmbeddingStore {
             idx_to_score[idx] = weight; // max score is 1, closest to 0 is best
         }
 
-        return get_k_closest_helper(embedding, k, num_threads, distance_metric, 
+        auto result = get_k_closest_helper(embedding, k, num_threads, distance_metric, 
             [&idx_to_score, &keyword_weight](uint32_t idx, float distance){
-                return (1.0f - idx_to_score[idx]) * keyword_weight + distance * (1 - keyword_weight);
+                auto it = idx_to_score.find(idx); // find, not [] -- this runs on every scan thread
+                float keyword_score = it == idx_to_score.end() ? 0 : it->second;
+                return (1.0f - keyword_score) * keyword_weight + distance * (1 - keyword_weight);
             }
         );
+        if(query_cache)
+            query_cache->insert(cache_key, generation, result);
+        return result;
+    }
+
+    // row ids of every row whose value matches a boolean / phrase query, ascending -- see BooleanQueryParser for
+    // the syntax. empty without hybrid search
+    std::vector<uint32_t> match_query(const std::string& query){
+        std::vector<uint32_t> rows;
+        match_query_rows(query, rows);
+        return rows;
+    }
+
+    // nearest neighbours among the rows matching query only; fewer than k if fewer rows match. a selective query
+    // scores just its matching rows, a broad one scans the store with the rest masked out
+    std::vector<std::pair<float, std::string>> get_k_closest_matching(
+        std::string query, std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        std::vector<uint32_t> rows;
+        if(embedding.size() != embedding_size || !match_query_rows(query, rows)){
+            return {};
+        }
+        std::vector<ScoredRow> top_k;
+        if((uint64_t) rows.size() * MATCHED_ROWS_SCAN_DIVISOR < get_num_embeddings()){
+            top_k = top_k_of_rows(embedding.data(), rows, k, metric);
+        }else{
+            std::vector<uint8_t> allowed = get_row_mask(rows);
+            top_k = scan_top_k(embedding, k, num_threads, metric, RowFilterScore{&allowed});
+        }
+        std::vector<std::pair<float, std::string>> result;
+        for(auto [score, idx] : top_k){
+            if(score == std::numeric_limits<float>::infinity())
+                break;
+            result.push_back(std::make_pair(score, get_value(idx)));
+        }
+        return result;
+    }
 
+    // hybrid search with a boolean / phrase query: rows matching it get the full keyword score, the rest none,
+    // blended with the distance like get_k_closest_hybrid_weighted
+    std::vector<std::pair<float, std::string>> get_k_closest_hybrid_query(
+        std::string query, std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity,
+        float keyword_weight = 0.5
+    ){
+        std::vector<uint32_t> rows;
+        if(embedding.size() != embedding_size || !match_query_rows(query, rows)){
+            return {};
+        }
+        std::vector<uint8_t> matched = get_row_mask(rows);
+        return get_k_closest_helper(embedding, k, num_threads, metric,
+            [&matched, keyword_weight](uint32_t idx, float distance){
+                float keyword_score = idx < matched.size() ? matched[idx] : 0;
+                return (1.0f - keyword_score) * keyword_weight + distance * (1 - keyword_weight);
+            }
+        );
     }
 
     std::vector<std::pair<float, std::string>> get_k_closest(
         std::vector<float> embedding, uint32_t k, 
         uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity
     ){
-        return get_k_closest_helper(embedding, k, num_threads, metric, [](uint32_t idx, float distance){
-            return distance;
-        });
+        if(embedding.size() != embedding_size){
+            return {};
+        }
+
+        uint64_t generation = get_num_embeddings();
+        QueryKey cache_key;
+        if(query_cache){
+            cache_key = make_query_key(embedding, k, (uint32_t) metric);
+            std::vector<std::pair<float, std::string>> cached;
+            if(query_cache->lookup(cache_key, generation, cached))
+                return cached;
+        }
+
+        auto result = get_k_closest_helper(embedding, k, num_threads, metric, DistanceScore());
+        if(query_cache)
+            query_cache->insert(cache_key, generation, result);
+        return result;
+    }
+
+    // get_k_closest as (distance, row idx), best first, without touching the object store -- pair it with
+    // get_value_view to read the values in place instead of copying them into the results
+    std::vector<ScoredRow> get_k_closest_rows(
+        std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        if(embedding.size() != embedding_size){
+            return {};
+        }
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+        PageFaultScope page_faults(*stats_);
+        std::vector<ScoredRow> rows = scan_top_k(embedding, k, num_threads, metric, DistanceScore());
+        stats_->record(stats_->query_latency, query_start);
+        return rows;
+    }
+
+    // get_k_closest for stores bigger than memory: embedding_store.bin is read in large chunks with io_uring (queue
+    // depth, chunk size and O_DIRECT in options), double buffered so the distances of one chunk are computed while
+    // the next is read, instead of faulting the mmap in a page at a time. each thread streams its own range.
+    // results match get_k_closest. throws std::runtime_error if the file could not be read, so a failed read is never
+    // mistaken for an empty store
+    std::vector<std::pair<float, std::string>> get_k_closest_disk(
+        std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity,
+        const DiskScanOptions& options = DiskScanOptions()
+    ){
+        if(embedding.size() != embedding_size){
+            return {};
+        }
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+
+        std::vector<std::pair<float, std::string>> result;
+        for(auto [score, idx] : scan_top_k(embedding, k, num_threads, metric, DistanceScore(), &options)){
+            result.push_back(std::make_pair(score, get_value(idx)));
+        }
+        stats_->record(stats_->query_latency, query_start);
+        return result;
+    }
+
+    // registers a query whose top-k is kept current as rows are added: each add scores only its new rows against
+    // the standing queries, and what enters or leaves a top-k is queued for take_standing_query_changes. the queries
+    // and their results are persisted in standing_queries.bin. returns the query id, -1 for a bad embedding or k,
+    // -2 if the store is read-only or the standing query file is full
+    int add_standing_query(
+        std::vector<float> embedding, uint32_t k, DistanceMetric metric = DistanceMetric::cosine_similarity,
+        uint32_t num_threads = 1
+    ){
+        if(embedding.size() != embedding_size || k == 0)
+            return -1;
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(mmap_options.read_only)
+            return -2;
+        if(!standing_queries)
+            standing_queries = std::make_unique<StandingQueries>(dir_path, embedding_size, get_num_embeddings(), MmapOptions());
+        std::vector<ScoredRow> top_k = scan_top_k(embedding, k, num_threads, metric, DistanceScore());
+        int64_t id = standing_queries->add(embedding, k, metric, top_k);
+        return id < 0 ? -2 : id;
+    }
+
+    // -1 if there is no such standing query
+    int remove_standing_query(uint32_t id){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(!standing_queries || mmap_options.read_only)
+            return -1;
+        return standing_queries->remove(id);
+    }
+
+    // the standing query's current top-k as (distance, value), best first
+    std::vector<std::pair<float, std::string>> get_standing_query_results(uint32_t id){
+        std::vector<ScoredRow> top_k;
+        {
+            std::lock_guard<std::mutex> lock(*write_mutex);
+            if(standing_queries)
+                top_k = standing_queries->get(id);
+        }
+        std::vector<std::pair<float, std::string>> result;
+        for(auto [distance, idx] : top_k){
+            result.push_back(std::make_pair(distance, get_value(idx)));
+        }
+        return result;
+    }
+
+    // rows that entered or left a standing query's top-k since the last call, in the order they happened
+    std::vector<StandingQueryChange> take_standing_query_changes(){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(!standing_queries)
+            return {};
+        return standing_queries->take_changes();
+    }
+
+    uint32_t get_num_standing_queries(){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        return standing_queries ? standing_queries->size() : 0;
+    }
+
+    // rebuilds inverted_index.bin and positional_index.bin from the object store, e.g. after they were lost or to add
+    // hybrid search to a store opened without it -- the indexes are created if missing, so the store need not be
+    // opened with hybrid search first (which would index every row serially on open). each thread tokenizes the
+    // objects that start in its share of the rows once for both indexes: (key, row) pairs go to sorted runs spilled
+    // to disk every run_entries pairs, positional log records to a file of their own. the runs are k-way merged into
+    // a new inverted index, the record files concatenated into a new log -- no per-key memmove as with add.
+    // writers wait; searches keep running and see each new index once it is swapped in. returns -1 when read-only,
+    // -2 if the new index could not be written
+    int rebuild_inverted_index(uint32_t num_threads = 1, uint32_t run_entries = POSTING_RUN_SPILL_ENTRIES){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(mmap_options.read_only)
+            return -1;
+        if(!inverted_index){
+            std::unique_lock<std::shared_mutex> inverted_lock(*inverted_mutex);
+            std::unique_lock<std::shared_mutex> positional_lock(*positional_mutex);
+            open_text_indexes();
+        }
+
+        uint32_t key_length = inverted_index->get_key_length();
+        uint32_t block_size = inverted_index->get_block_size();
+        uint32_t num_rows = get_num_embeddings();
+        num_threads = std::max(1u, std::min(num_threads, std::max(1u, num_rows)));
+        run_entries = std::max(1u, run_entries);
+        auto ranges = split_rows(num_rows, num_threads, 1);
+        fs::path run_prefix = dir_path / (std::string(INVERTED_INDEX_FN) + ".run");
+        fs::path log_prefix = dir_path / (std::string(POSITIONAL_INDEX_FN) + ".rebuild");
+        std::vector<std::vector<fs::path>> run_paths(num_threads);
+        std::vector<uint8_t> failed(num_threads, 0);
+
+        auto tokenize = [&](uint32_t t){
+            auto [start, end] = ranges[t];
+            PostingRun run(key_length);
+            auto spill = [&](){
+                fs::path path = run_prefix.string() + "." + std::to_string(t) + "." + std::to_string(run_paths[t].size());
+                run_paths[t].push_back(path);
+                if(run.spill(path) != 0)
+                    failed[t] = 1;
+            };
+            std::ofstream log_part(log_prefix.string() + "." + std::to_string(t), std::ios::binary | std::ios::trunc);
+            std::vector<char> key(key_length);
+            for(uint32_t row = start; row < end; row++){
+                uint32_t offset = get_object_store_offset(row);
+                if(row > 0 && get_object_store_offset(row - 1) == offset)
+                    continue; // the object started in an earlier range
+                uint32_t object_end = row + 1;
+                while(object_end < num_rows && get_object_store_offset(object_end) == offset){
+                    object_end++;
+                }
+                std::string value = read_value(offset);
+                analyzer.analyze(value, [&](std::string_view token, uint32_t position, bool is_ngram){
+                    inverted_index->get_padded_buf(token, key.data());
+                    for(uint32_t r = row; r < object_end; r++){
+                        run.add(key.data(), r);
+                    }
+                });
+                std::string record = PositionalIndex::make_record(row, object_end - row, value, analyzer);
+                log_part.write(record.data(), record.size());
+                if(run.size() >= run_entries)
+                    spill();
+            }
+            if(run.size() > 0)
+                spill();
+            failed[t] = failed[t] || !log_part.flush();
+        };
+        std::vector<std::thread> threads;
+        for(uint32_t t = 1; t < num_threads; t++){
+            threads.emplace_back(tokenize, t);
+        }
+        tokenize(0);
+        for(auto& t : threads){
+            t.join();
+        }
+
+        // runs in row order, so ties in the merge keep the rows of a key ascending
+        std::vector<SpilledRun> runs;
+        bool ok = std::find(failed.begin(), failed.end(), 1) == failed.end();
+        for(const auto& paths : run_paths){
+            for(const fs::path& path : paths){
+                if(ok)
+                    runs.emplace_back(path, key_length);
+            }
+        }
+        fs::path index_path = dir_path / INVERTED_INDEX_FN;
+        fs::path rebuild_path = dir_path / (std::string(INVERTED_INDEX_FN) + ".rebuild");
+        uint32_t index_size = inverted_index->get_file().mmap_size;
+        ok = ok && write_inverted_index(rebuild_path, index_size, block_size, key_length, runs) == 0;
+        runs.clear();
+        for(const auto& paths : run_paths){
+            for(const fs::path& path : paths){
+                fs::remove(path);
+            }
+        }
+        if(!ok){
+            fs::remove(rebuild_path);
+            for(uint32_t t = 0; t < num_threads; t++){
+                fs::remove(log_prefix.string() + "." + std::to_string(t));
+            }
+            return -2;
+        }
+
+        MmapOptions lookup_options;
+        {
+            std::unique_lock<std::shared_mutex> inverted_lock(*inverted_mutex);
+            inverted_index.reset();
+            fs::rename(rebuild_path, index_path);
+            inverted_index = std::make_unique<InvertedIndex>(dir_path.c_str(), index_size, block_size, key_length, lookup_options);
+        }
+
+        // the parts go into the new log whole and in order; one that doesn't fit is left to index_missing_rows
+        uint32_t log_size = positional_index->get_file().mmap_size;
+        uint64_t log_bytes = DEFAULT_WRITE_IDX;
+        for(uint32_t t = 0; t < num_threads; t++){
+            log_bytes += fs::file_size(log_prefix.string() + "." + std::to_string(t));
+        }
+        log_size = std::max((uint64_t) log_size, std::min(log_bytes, (uint64_t) MAX_UINT32 / 2));
+        {
+            FileWrapper log(log_prefix, log_size);
+            bool fits = true;
+            for(uint32_t t = 0; t < num_threads; t++){
+                fs::path part_path = log_prefix.string() + "." + std::to_string(t);
+                uint64_t part_size = fs::file_size(part_path);
+                fits = fits && log.write_idx + part_size <= log.mmap_size;
+                if(fits){
+                    std::ifstream part(part_path, std::ios::binary);
+                    part.read(log.mmap_addr + log.write_idx, part_size);
+                    log.write_idx += part_size;
+                }
+                fs::remove(part_path);
+            }
+        }
+        {
+            std::unique_lock<std::shared_mutex> positional_lock(*positional_mutex);
+            positional_index.reset();
+            fs::rename(log_prefix, dir_path / POSITIONAL_INDEX_FN);
+            positional_index = std::make_unique<PositionalIndex>(dir_path.c_str(), log_size, lookup_options);
+            index_missing_rows();
+        }
+
+        if(query_cache)
+            query_cache->clear();
+        return 0;
+    }
+
+    // how values and queries are split into keys. only an empty store can change it, since keys already in the
+    // indexes were made with the old analyzer. returns -1 if read-only, -2 if the store has rows, -3 for an n-gram
+    // size over MAX_NGRAM_SIZE
+    int set_analyzer(const AnalyzerOptions& options){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(mmap_options.read_only)
+            return -1;
+        if(get_num_embeddings() > 0)
+            return -2;
+        if(options.ngram_size > MAX_NGRAM_SIZE)
+            return -3;
+
+        header.analyzer_unicode = options.unicode;
+        header.analyzer_stem = options.stem;
+        header.analyzer_ngram_size = options.ngram_size;
+        write_store_header(dir_path / STORE_HEADER_FN, header);
+        analyzer = Analyzer(options);
+        return 0;
+    }
+
+    AnalyzerOptions get_analyzer_options(){
+        AnalyzerOptions options;
+        options.unicode = header.analyzer_unicode;
+        options.stem = header.analyzer_stem;
+        options.ngram_size = header.analyzer_ngram_size;
+        return options;
+    }
+
+    // caches up to capacity finished get_k_closest / hybrid results; 0 turns the cache off and drops it
+    void enable_query_cache(uint32_t capacity){
+        if(capacity == 0){
+            query_cache.reset();
+        }else{
+            query_cache = std::make_unique<QueryCache>(capacity);
+        }
     }
 
+    bool query_cache_enabled(){
+        return query_cache != nullptr;
+    }
+
+    template <typename ScoreFn>
     std::vector<std::pair<float, std::string>> get_k_closest_helper(
         std::vector<float> embedding, uint32_t k, 
         uint32_t num_threads, DistanceMetric metric,
-        std::function<float(uint32_t, float)> custom_score_function
+        ScoreFn score_fn
     ){
 
         if(embedding.size() != embedding_size){
             return {};
         }
 
-        uint32_t num_rows = (embedding_store.write_idx - DEFAULT_WRITE_IDX) / (embedding_size * sizeof(float));
-        uint32_t num_rows_per_thread = num_rows / num_threads;
-        uint32_t leftover = num_rows % num_threads;
-        assert(num_rows == num_embeddings);
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+        PageFaultScope page_faults(*stats_);
+
+        std::vector<std::pair<float, std::string>> result;
+        for(auto [score, idx] : scan_top_k(embedding, k, num_threads, metric, score_fn)){
+            result.push_back(std::make_pair(score, get_value(idx)));
+        }
+        stats_->record(stats_->query_latency, query_start);
+        return result;
+    }
+
+    // brute force top-k (score, row idx), best first, without touching the object store. every thread scans its
+    // own block-aligned range into its own heap (no shared state in the scan) and the heaps are merged at the end.
+    // the metric and score function are compile-time parameters of the kernel, see scan_kernel.h. with disk set the
+    // rows are read from embedding_store.bin through disk_scan.h instead of the mmap -- empty if a read failed
+    template <typename ScoreFn>
+    std::vector<ScoredRow> scan_top_k(
+        const std::vector<float>& embedding, uint32_t k, uint32_t num_threads, DistanceMetric metric, ScoreFn score_fn,
+        const DiskScanOptions* disk = nullptr
+    ){
+        if(embedding.size() != embedding_size){
+            return {};
+        }
+        float* query = const_cast<float*>(embedding.data());
 
-        // std::cout << "num_rows: " << num_rows << std::endl;
-        // std::cout << "num_rows_per_thread: " << num_rows_per_thread << std::endl;
-        // std::cout << "leftover: " << leftover << std::endl;
+        uint32_t num_rows = get_num_embeddings(); // rows an add is still writing stay out of the scan
+        uint32_t block_rows = get_scan_block_rows(row_size);
+        // no point in a thread that would get less than a block
+        num_threads = std::max(1u, std::min(num_threads, (num_rows + block_rows - 1) / block_rows));
+        auto ranges = split_rows(num_rows, num_threads, block_rows);
 
-        std::mutex pq_mutex;
-        std::priority_queue<std::pair<float, uint32_t>, 
-            std::vector<std::pair<float, uint32_t>>,
-            std::less<std::pair<float, uint32_t>>
-        > pq; // max heap with distance, idx
+        std::vector<std::vector<ScoredRow>> heaps(num_threads);
+        std::vector<ScanCounters> counters(num_threads);
+        std::vector<int> disk_status(num_threads, 0);
 
-        // each thread goes through its rows and adds to pq
+        auto scan_start = stats_->now();
+        auto scan = [&](uint32_t t){
+            auto [start, end] = ranges[t];
+            ThreadPin pin(numa_placement == NumaPlacement::none ? std::vector<int>() : numa_topology.node_cpus[get_numa_node(t, start, end)]);
+            auto run = [&](auto metric_tag){
+                with_dimension(kernel_dimension, [&](auto dim){
+                    if(disk){
+                        disk_status[t] = scan_rows_from_disk<decltype(metric_tag)::value, dim.value>(
+                            dir_path / EMBEDDING_STORE_FN, query, row_size, embedding_size, element_type,
+                            start, end, k, score_fn, heaps[t], counters[t], *disk
+                        );
+                        return;
+                    }
+                    scan_rows<decltype(metric_tag)::value, dim.value>(
+                        query, embedding_store.get_start_addr(), row_size, embedding_size, element_type,
+                        start, end, k, score_fn, heaps[t], counters[t]
+                    );
+                });
+            };
+            with_metric(metric, run);
+        };
 
+        // the calling thread takes the first range itself
         std::vector<std::thread> threads;
-        uint32_t start = 0;
-        for(size_t i = 0 ; i < num_threads; i++){
-            uint32_t end = start + num_rows_per_thread;
-            if(i == num_threads - 1){
-                end += leftover;
+        for(uint32_t t = 1; t < num_threads; t++){
+            threads.emplace_back(scan, t);
+        }
+        scan(0);
+        for(auto& t : threads){
+            t.join();
+        }
+        stats_->record(stats_->scan_latency, scan_start);
+
+        for(const ScanCounters& c : counters){
+            stats_->add(stats_->distance_evaluations, c.distance_evaluations);
+            stats_->add(stats_->rows_pruned, c.rows_pruned);
+            stats_->add(stats_->heap_operations, c.heap_operations);
+        }
+        if(std::find(disk_status.begin(), disk_status.end(), -1) != disk_status.end())
+            throw std::runtime_error("Could not read " + (dir_path / EMBEDDING_STORE_FN).string() + " from disk.");
+        return merge_heaps(heaps, k);
+    }
+
+    // pins the scan workers to NUMA nodes and moves the resident embedding pages to match, see numa_placement.h.
+    // simulated_nodes > 0 splits the cpus into that many groups instead of using the real nodes -- workers are
+    // pinned but pages can't move. rows added afterwards land wherever the writer faults them, so call this again
+    // after a large load. searches must not run meanwhile. returns -1 if the kernel refused to move the pages
+    // (workers are pinned either way)
+    int set_numa_placement(NumaPlacement placement, uint32_t simulated_nodes = 0){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        numa_placement = placement;
+        numa_topology = simulated_nodes > 0 ? NumaTopology::simulate(simulated_nodes) : NumaTopology::detect();
+        uint32_t num_nodes = numa_topology.num_nodes();
+        numa_part_starts.clear();
+        for(auto [start, end] : split_rows(get_num_embeddings(), num_nodes, get_scan_block_rows(row_size))){
+            numa_part_starts.push_back(start);
+        }
+        if(placement == NumaPlacement::none || numa_topology.simulated || num_nodes < 2 || get_num_embeddings() == 0)
+            return 0;
+
+        embedding_store.warm_up(); // only resident pages can be moved
+        long page_size = sysconf(_SC_PAGESIZE);
+        int64_t moved = move_pages_to_nodes(embedding_store.mmap_addr, embedding_store.write_idx, [&](size_t page){
+            if(placement == NumaPlacement::interleave)
+                return numa_topology.node_ids[page % num_nodes];
+            uint64_t offset = (uint64_t) page * page_size;
+            uint32_t row = offset < DEFAULT_WRITE_IDX ? 0 : (offset - DEFAULT_WRITE_IDX) / row_size;
+            return numa_topology.node_ids[get_numa_part(row)];
+        });
+        return moved < 0 ? -1 : 0;
+    }
+
+    NumaPlacement get_numa_placement(){
+        return numa_placement;
+    }
+
+    // maximal marginal relevance: the num_candidates closest rows (0 = MMR_CANDIDATES_PER_RESULT * k) are picked
+    // from greedily, each pick maximizing lambda * sim(query, row) - (1 - lambda) * max sim(row, picked rows), with
+    // sim from similarity_from_distance. lambda = 1 is plain nearest neighbour order; lower trades relevance for
+    // diversity. candidates are compared to each other straight from the mapped rows with the scan kernels, and only
+    // the k picked values are read. returns (distance to the query, value) in pick order
+    std::vector<std::pair<float, std::string>> get_k_closest_diverse(
+        std::vector<float> embedding, uint32_t k, uint32_t num_candidates = 0, float lambda = 0.5,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        if(embedding.size() != embedding_size || k == 0)
+            return {};
+
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+        PageFaultScope page_faults(*stats_);
+
+        if(num_candidates == 0)
+            num_candidates = k * MMR_CANDIDATES_PER_RESULT;
+        std::vector<ScoredRow> candidates = scan_top_k(embedding, std::max(k, num_candidates), num_threads, metric, DistanceScore());
+
+        uint32_t n = candidates.size();
+        std::vector<float> relevance(n);
+        std::vector<float> max_redundancy(n, -std::numeric_limits<float>::infinity());
+        std::vector<bool> picked(n, false);
+        for(uint32_t c = 0; c < n; c++){
+            relevance[c] = similarity_from_distance(candidates[c].first, metric);
+        }
+
+        std::vector<float> picked_row(embedding_size);
+        std::vector<std::pair<float, std::string>> result;
+        while(result.size() < std::min(k, n)){
+            uint32_t best = n;
+            float best_score = -std::numeric_limits<float>::infinity();
+            for(uint32_t c = 0; c < n; c++){
+                if(picked[c])
+                    continue;
+                float redundancy = result.empty() ? 0 : max_redundancy[c];
+                float score = lambda * relevance[c] - (1 - lambda) * redundancy;
+                if(best == n || score > best_score){ // ties keep scan order
+                    best = c;
+                    best_score = score;
+                }
             }
-            // std::cout << "start: " << start << " end: " << end << std::endl;
+            picked[best] = true;
+            auto [distance, idx] = candidates[best];
+            result.push_back(std::make_pair(distance, get_value(idx)));
+
+            // the picked row is the query side of the kernel, so it has to be float32
+            decode_elements(element_type, embedding_store.get_start_addr() + (size_t) idx * row_size, picked_row.data(), embedding_size);
+            for(uint32_t c = 0; c < n; c++){
+                if(picked[c])
+                    continue;
+                char* row = embedding_store.get_start_addr() + (size_t) candidates[c].second * row_size;
+                float similarity = similarity_from_distance(
+                    compute_distance(picked_row.data(), row, embedding_size, metric, std::numeric_limits<float>::max(), element_type),
+                    metric
+                );
+                max_redundancy[c] = std::max(max_redundancy[c], similarity);
+            }
+            stats_->add(stats_->distance_evaluations, n - result.size());
+        }
+        stats_->record(stats_->query_latency, query_start);
+        return result;
+    }
+
+    // every row within distance r, closest first. the rows go through the same block kernel as scan_top_k, with each
+    // worker appending matches to its own buffer instead of a heap; once max_results matches are found
+    // (0 = unlimited) the scan stops, which means the result is *some* max_results rows within r rather than the
+    // closest ones
+    std::vector<std::pair<float, std::string>> search_radius(
+        std::vector<float> embedding, float r, DistanceMetric metric = DistanceMetric::cosine_similarity,
+        uint32_t max_results = 0, uint32_t num_threads = 1
+    ){
+        if(embedding.size() != embedding_size){
+            return {};
+        }
+
+        float* query = embedding.data();
+
+        uint32_t num_rows = get_num_embeddings();
+        uint32_t block_rows = get_scan_block_rows(row_size);
+        num_threads = std::max(1u, std::min(num_threads, (num_rows + block_rows - 1) / block_rows));
+        auto ranges = split_rows(num_rows, num_threads, block_rows);
+        std::vector<std::vector<ScoredRow>> thread_matches(num_threads);
+        std::vector<ScanCounters> counters(num_threads);
+        std::atomic<uint32_t> num_matches(0);
+
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+        PageFaultScope page_faults(*stats_);
+
+        auto scan = [&](uint32_t t){
+            auto [start, end] = ranges[t];
+            ThreadPin pin(numa_placement == NumaPlacement::none ? std::vector<int>() : numa_topology.node_cpus[get_numa_node(t, start, end)]);
+            with_metric(metric, [&](auto metric_tag){
+                with_dimension(kernel_dimension, [&](auto dim){
+                    scan_rows_within<decltype(metric_tag)::value, dim.value>(
+                        query, embedding_store.get_start_addr(), row_size, embedding_size, element_type,
+                        start, end, r, max_results, num_matches, thread_matches[t], counters[t]
+                    );
+                });
+            });
+        };
+
+        // the calling thread takes the first range itself
+        std::vector<std::thread> threads;
+        for(uint32_t t = 1; t < num_threads; t++){
+            threads.emplace_back(scan, t);
+        }
+        scan(0);
+        for(auto& t : threads){
+            t.join();
+        }
+        for(const ScanCounters& c : counters){
+            stats_->add(stats_->distance_evaluations, c.distance_evaluations);
+            stats_->add(stats_->rows_pruned, c.rows_pruned);
+        }
+
+        std::vector<ScoredRow> matches;
+        for(auto& m : thread_matches){
+            matches.insert(matches.end(), m.begin(), m.end());
+        }
+        std::sort(matches.begin(), matches.end());
+
+        std::vector<std::pair<float, std::string>> result;
+        result.reserve(matches.size());
+        for(auto [dist, idx] : matches){
+            result.push_back(std::make_pair(dist, get_value(idx)));
+        }
+        stats_->record(stats_->query_latency, query_start);
+        return result;
+    }
+
+    // top-k objects rather than rows: every row is scored against every query vector and the rows of one object
+    // are folded together as described in aggregation.h, so an object comes back once however many of its rows
+    // match. pass one query vector for best-chunk search, or a query's token vectors for ColBERT-style MaxSim
+    std::vector<std::pair<float, std::string>> get_k_closest_objects(
+        const std::vector<std::vector<float>>& query_vectors, uint32_t k, uint32_t num_threads = 1,
+        DistanceMetric metric = DistanceMetric::cosine_similarity, Aggregation aggregation = Aggregation::max_sim
+    ){
+        if(query_vectors.empty() || k == 0)
+            return {};
+        for(const auto& q : query_vectors){
+            if(q.size() != embedding_size)
+                return {};
+        }
+
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+        PageFaultScope page_faults(*stats_);
+
+        uint32_t m = query_vectors.size();
+        float initial = aggregation == Aggregation::max_sim ? std::numeric_limits<float>::infinity() : 0;
+        auto fold = [aggregation](float& acc, float value){
+            acc = aggregation == Aggregation::max_sim ? std::min(acc, value) : acc + value;
+        };
+
+        // object offset -> per query vector partial score
+        using Partials = std::unordered_map<uint32_t, std::vector<float>>;
+        uint32_t num_rows = get_num_embeddings();
+        uint32_t block_rows = get_scan_block_rows(row_size);
+        num_threads = std::max(1u, std::min(num_threads, (num_rows + block_rows - 1) / block_rows));
+        auto ranges = split_rows(num_rows, num_threads, block_rows);
+        std::vector<Partials> thread_partials(num_threads);
+
+        auto scan = [&](uint32_t t){
+            auto [start, end] = ranges[t];
+            Partials& partials = thread_partials[t];
+            // rows of an object are usually adjacent, so only go to the map when the object changes
+            uint32_t current = 0;
+            std::vector<float> acc(m, initial);
+            bool have_current = false;
+            auto flush = [&](){
+                if(!have_current)
+                    return;
+                auto [it, inserted] = partials.try_emplace(current, m, initial);
+                for(uint32_t j = 0; j < m; j++)
+                    fold(it->second[j], acc[j]);
+            };
 
-            std::thread t([this, &embedding, &pq, start, end, metric, k, &pq_mutex, custom_score_function](){
-                for(uint32_t i = start; i <= end; i++){
+            for(uint32_t i = start; i < end; i++){
+                uint32_t offset = get_object_store_offset(i);
+                if(!have_current || offset != current){
+                    flush();
+                    current = offset;
+                    have_current = true;
+                    std::fill(acc.begin(), acc.end(), initial);
+                }
+                char* row = embedding_store.get_start_addr() + (size_t) i * row_size;
+                for(uint32_t j = 0; j < m; j++){
                     float distance = compute_distance(
-                        embedding.data(),
-                        this->embedding_store.mmap_addr + DEFAULT_WRITE_IDX + i * this->embedding_size * sizeof(float), 
-                        this->embedding_size, 
-                        metric
+                        const_cast<float*>(query_vectors[j].data()), row, embedding_size, metric,
+                        std::numeric_limits<float>::max(), element_type
                     );
+                    fold(acc[j], aggregation == Aggregation::max_sim ? distance : -similarity_from_distance(distance, metric));
+                }
+            }
+            flush();
+            stats_->add(stats_->distance_evaluations, (uint64_t) (end - start) * m);
+        };
+
+        std::vector<std::thread> threads;
+        for(uint32_t t = 1; t < num_threads; t++){
+            threads.emplace_back(scan, t);
+        }
+        scan(0);
+        for(auto& t : threads){
+            t.join();
+        }
+
+        // an object split across two ranges shows up in both maps
+        Partials& merged = thread_partials[0];
+        for(uint32_t t = 1; t < num_threads; t++){
+            for(auto& [offset, partial] : thread_partials[t]){
+                auto [it, inserted] = merged.try_emplace(offset, m, initial);
+                for(uint32_t j = 0; j < m; j++)
+                    fold(it->second[j], partial[j]);
+            }
+        }
+
+        std::vector<std::pair<float, uint32_t>> scored;
+        scored.reserve(merged.size());
+        for(auto& [offset, partial] : merged){
+            float score = 0;
+            for(float p : partial)
+                score += p;
+            scored.push_back(std::make_pair(score, offset));
+        }
+        uint32_t num_results = std::min((size_t) k, scored.size());
+        std::partial_sort(scored.begin(), scored.begin() + num_results, scored.end());
+
+        std::vector<std::pair<float, std::string>> result;
+        for(uint32_t i = 0; i < num_results; i++){
+            result.push_back(std::make_pair(scored[i].first, read_value(scored[i].second)));
+        }
+        stats_->record(stats_->query_latency, query_start);
+        return result;
+    }
+
+    // throws std::out_of_range if there is no such row
+    std::string get_value(uint32_t idx){
+        check_row(idx);
+        return read_value(get_object_store_offset(idx));
+    }
+
+    // the value's bytes inside the object store mmap, valid until the store is closed -- no copy. nullopt when the
+    // value is stored compressed, use get_value for those. throws std::out_of_range if there is no such row
+    std::optional<std::string_view> get_value_view(uint32_t idx){
+        check_row(idx);
+        return read_value_view(get_object_store_offset(idx));
+    }
+
+    std::string read_value(uint32_t object_store_offset){
+        std::optional<std::string_view> view = read_value_view(object_store_offset);
+        if(view){
+            return std::string(*view);
+        }
+
+        // compressed: [u32 raw size][zstd frame]
+        char* entry = object_store.mmap_addr + object_store_offset;
+        uint32_t stored_size = char_to_uint32_t(entry) & ~COMPRESSED_VALUE_FLAG;
+        if(stored_size < sizeof(uint32_t) || !value_in_bounds(object_store_offset, stored_size)){
+            throw std::runtime_error("Corrupt compressed value at offset " + std::to_string(object_store_offset) + ".");
+        }
+        uint32_t raw_size = char_to_uint32_t(entry + OBJECT_STORE_IDX_TYPE_SIZE);
+        std::string_view compressed(entry + OBJECT_STORE_IDX_TYPE_SIZE + sizeof(uint32_t), stored_size - sizeof(uint32_t));
+        std::string value;
+        if(!zstd_codec.decompress(compressed, raw_size, value)){
+            throw std::runtime_error("Corrupt compressed value at offset " + std::to_string(object_store_offset) + ".");
+        }
+        stats_->add(stats_->values_materialized, 1);
+        stats_->add(stats_->value_bytes_materialized, raw_size);
+        return value;
+    }
+
+    std::optional<std::string_view> read_value_view(uint32_t object_store_offset){
+        if(!value_in_bounds(object_store_offset, 0)){
+            throw std::runtime_error("Object store offset " + std::to_string(object_store_offset) + " is out of bounds.");
+        }
+        char* entry = object_store.mmap_addr + object_store_offset;
+        uint32_t value_size = char_to_uint32_t(entry); 
+        if(value_size & COMPRESSED_VALUE_FLAG)
+            return std::nullopt;
+        if(!value_in_bounds(object_store_offset, value_size)){
+            throw std::runtime_error("Corrupt value at offset " + std::to_string(object_store_offset) + ".");
+        }
+        stats_->add(stats_->values_materialized, 1);
+        stats_->add(stats_->value_bytes_materialized, value_size);
+        return std::string_view(entry + OBJECT_STORE_IDX_TYPE_SIZE, value_size);
+    }
+
+    // trains the preset dictionary on samples (typical values -- a few hundred is plenty) and compresses every
+    // value added from now on. existing values stay as they are. the dictionary can never change afterwards since
+    // stored values refer into it, so this works once per store
+    int enable_value_compression(const std::vector<std::string>& samples){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(header.value_codec != ValueCodec::none)
+            return 0;
+        if(mmap_options.read_only)
+            return -1;
+
+        value_dictionary = train_value_dictionary(samples);
+        std::ofstream dictionary_file(dir_path / VALUE_DICTIONARY_FN, std::ios::binary | std::ios::trunc);
+        dictionary_file.write(value_dictionary.data(), value_dictionary.size());
+        if(!dictionary_file.good())
+            return -2;
+        dictionary_file.close();
+
+        zstd_codec = ZstdValueCodec(value_dictionary);
+        header.value_codec = ValueCodec::zstd;
+        write_store_header(dir_path / STORE_HEADER_FN, header);
+        return 0;
+    }
+
+    bool value_compression_enabled(){
+        return header.value_codec != ValueCodec::none;
+    }
+
+    // builds the sign-bit copy for all existing rows and keeps it up to date on every add from now on
+    int enable_binary_quantization(){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(binary_store.mmap_addr)
+            return 0;
+        if(mmap_options.read_only)
+            return -1;
+
+        fs::remove(dir_path / BINARY_STORE_FN); // left over from an attempt that did not fit
+        open_binary_store();
+
+        uint32_t num_rows = get_num_embeddings();
+        std::vector<float> row(embedding_size);
+        std::vector<char> bits;
+        for(uint32_t i = 0; i < num_rows; i++){
+            decode_elements(element_type, embedding_store.get_start_addr() + (size_t) i * row_size, row.data(), embedding_size);
+            quantize_to_bits(row.data(), embedding_size, bits);
+            if(binary_store.write(bits.data(), bits.size()) < 0){
+                binary_store = FileWrapper();
+                return -2;
+            }
+        }
+        // the header goes last, so a store never opens with a binary copy that is missing rows
+        header.binary_quantization_enabled = 1;
+        write_store_header(dir_path / STORE_HEADER_FN, header);
+        return 0;
+    }
+
+    bool binary_quantization_enabled(){
+        return binary_store.mmap_addr != nullptr;
+    }
+
+    // two stage search: hamming distance over the sign bits picks k * oversample candidates,
+    // which are then re-ranked exactly against embedding_store.bin
+    std::vector<std::pair<float, std::string>> get_k_closest_binary(
+        std::vector<float> embedding, uint32_t k, uint32_t oversample = 4,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        if(!binary_store.mmap_addr){
+            return get_k_closest(embedding, k, num_threads, metric);
+        }
+        if(embedding.size() != embedding_size || k == 0){
+            return {};
+        }
+
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+        PageFaultScope page_faults(*stats_);
 
-                    float score = custom_score_function(i, distance);
+        std::vector<char> query_bits;
+        quantize_to_bits(embedding.data(), embedding_size, query_bits);
+        uint32_t bits_row_size = binary_row_size(embedding_size);
+        uint32_t num_candidates = std::max(k, k * std::max(oversample, (uint32_t) 1));
+        HammingFn hamming_distance = get_hamming_distance_fn();
 
-                    std::lock_guard<std::mutex> lock(pq_mutex);
-                    if(pq.size() != k || score < pq.top().first){
-                        pq.push(std::make_pair(score, i));
-                        if(pq.size() > k){
+        using Candidate = std::pair<uint32_t, uint32_t>; // hamming distance, idx
+        uint32_t num_rows = get_num_embeddings();
+        num_threads = std::max((uint32_t) 1, std::min(num_threads, num_rows));
+        std::vector<std::vector<Candidate>> thread_candidates(num_threads);
+
+        // coarse pass -- each thread keeps its own heap, so there is no lock on the hot path
+        std::vector<std::thread> threads;
+        for(uint32_t t = 0; t < num_threads; t++){
+            uint32_t start = (uint64_t) num_rows * t / num_threads;
+            uint32_t end = (uint64_t) num_rows * (t + 1) / num_threads;
+            threads.emplace_back([&, t, start, end](){
+                std::priority_queue<Candidate> pq; // max heap
+                for(uint32_t i = start; i < end; i++){
+                    uint32_t distance = hamming_distance(
+                        query_bits.data(), binary_store.get_start_addr() + i * bits_row_size, bits_row_size
+                    );
+                    if(pq.size() < num_candidates || distance < pq.top().first){
+                        pq.push(std::make_pair(distance, i));
+                        if(pq.size() > num_candidates)
                             pq.pop();
-                        }
                     }
                 }
+                while(!pq.empty()){
+                    thread_candidates[t].push_back(pq.top()); pq.pop();
+                }
             });
-            threads.push_back(std::move(t));
-
-            start = end + 1;
         }
-
         for(auto& t : threads){
             t.join();
         }
 
+        std::vector<Candidate> candidates;
+        for(auto& c : thread_candidates){
+            candidates.insert(candidates.end(), c.begin(), c.end());
+        }
+        if(candidates.size() > num_candidates){
+            std::nth_element(candidates.begin(), candidates.begin() + num_candidates, candidates.end());
+            candidates.resize(num_candidates);
+        }
+
+        // exact re-rank
+        stats_->add(stats_->distance_evaluations, candidates.size());
+        std::priority_queue<std::pair<float, uint32_t>> pq;
+        for(auto [hamming, idx] : candidates){
+            float thres = pq.size() == k ? pq.top().first : std::numeric_limits<float>::max();
+            float distance = compute_distance(
+                embedding.data(), embedding_store.get_start_addr() + idx * row_size, 
+                embedding_size, metric, thres, element_type
+            );
+            if(pq.size() < k || std::make_pair(distance, idx) < pq.top()){
+                pq.push(std::make_pair(distance, idx));
+                if(pq.size() > k)
+                    pq.pop();
+            }
+        }
+
         std::vector<std::pair<float, std::string>> result;
         while(!pq.empty()){
             auto [dist, idx] = pq.top(); pq.pop();
-            uint32_t object_store_offset = char_to_uint32_t(embedding_to_object_map.mmap_addr + DEFAULT_WRITE_IDX + idx * OBJECT_STORE_IDX_TYPE_SIZE);
-            // object store offset is an index which includes DEFAULT_WRITE_IDX
-            uint32_t value_size = char_to_uint32_t(object_store.mmap_addr + object_store_offset); 
-            std::string value = std::string(
-                object_store.mmap_addr + object_store_offset + OBJECT_STORE_IDX_TYPE_SIZE,
-                value_size
+            result.push_back(std::make_pair(dist, get_value(idx)));
+        }
+        reverse(result.begin(), result.end());
+        stats_->record(stats_->query_latency, query_start);
+        return result;
+    }
+
+    // learns a projection to reduced_dims dimensions from sample_rows rows spread over the store (PCA) or draws a
+    // random orthonormal one, and keeps a float32 copy of every row in reduced_dims -- existing rows now, new ones
+    // on add. get_k_closest_reduced searches the copy first. the projection is fixed from then on, like the store's
+    // other settings, so learn it once the store holds representative data. returns -1 for bad arguments, a
+    // read-only store, or PCA with fewer sample rows than reduced_dims (the missing directions would be random),
+    // -2 if the copy did not fit, -3 if a copy sized for every row the store can hold would pass 4 GB
+    int enable_reduced_search(
+        uint32_t reduced_dims, Reduction reduction = Reduction::pca, uint32_t sample_rows = REDUCTION_DEFAULT_SAMPLE_ROWS
+    ){
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        if(reduced_store.mmap_addr)
+            return 0;
+        if(mmap_options.read_only || reduced_dims == 0 || reduced_dims >= embedding_size || reduction == Reduction::none)
+            return -1;
+        if(reduced_store_size(reduced_dims) > MAX_UINT32)
+            return -3;
+
+        uint32_t num_rows = get_num_embeddings();
+        if(reduction == Reduction::pca){
+            uint32_t num_samples = std::min(sample_rows, num_rows);
+            if(num_samples < reduced_dims)
+                return -1;
+            projection = learn_pca(embedding_size, reduced_dims, num_samples, [&](uint32_t i, float* out){
+                uint32_t row = (uint64_t) i * num_rows / num_samples;
+                decode_elements(element_type, embedding_store.get_start_addr() + (size_t) row * row_size, out, embedding_size);
+            });
+        }else{
+            projection = random_projection(embedding_size, reduced_dims);
+        }
+        if(!projection.save(dir_path / PROJECTION_FN))
+            return -2;
+        header.reduced_dims = reduced_dims;
+        header.reduction = reduction;
+        fs::remove(dir_path / REDUCED_STORE_FN); // left over from an attempt that did not fit
+        open_reduced_store();
+
+        std::vector<float> row(embedding_size);
+        std::vector<float> reduced(reduced_dims);
+        for(uint32_t i = 0; i < num_rows; i++){
+            decode_elements(element_type, embedding_store.get_start_addr() + (size_t) i * row_size, row.data(), embedding_size);
+            projection.apply(row.data(), reduced.data());
+            if(reduced_store.write(reduced.data(), reduced_dims * sizeof(float)) < 0){
+                header.reduced_dims = 0;
+                header.reduction = Reduction::none;
+                reduced_store = FileWrapper();
+                return -2;
+            }
+        }
+        // the header goes last, so a store never opens with a reduced copy that is missing rows
+        write_store_header(dir_path / STORE_HEADER_FN, header);
+        return 0;
+    }
+
+    Reduction get_reduction(){
+        return header.reduction;
+    }
+
+    // two stage search like get_k_closest_binary: the reduced copy picks k * oversample candidates with the same
+    // scan kernels as a full search, which are then re-ranked exactly against embedding_store.bin. the distances
+    // returned are the exact ones. falls back to get_k_closest without a reduced copy
+    std::vector<std::pair<float, std::string>> get_k_closest_reduced(
+        std::vector<float> embedding, uint32_t k, uint32_t oversample = 4,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        if(!reduced_store.mmap_addr){
+            return get_k_closest(embedding, k, num_threads, metric);
+        }
+        if(embedding.size() != embedding_size || k == 0){
+            return {};
+        }
+
+        auto query_start = stats_->now();
+        stats_->add(stats_->queries, 1);
+        PageFaultScope page_faults(*stats_);
+
+        uint32_t reduced_dims = header.reduced_dims;
+        std::vector<float> query(reduced_dims);
+        projection.apply(embedding.data(), query.data());
+        uint32_t num_candidates = std::max(k, k * std::max(oversample, (uint32_t) 1));
+        uint32_t reduced_row_size = reduced_dims * sizeof(float);
+
+        // coarse pass -- per-thread ranges and heaps, as in scan_top_k
+        uint32_t num_rows = get_num_embeddings();
+        uint32_t block_rows = get_scan_block_rows(reduced_row_size);
+        num_threads = std::max(1u, std::min(num_threads, (num_rows + block_rows - 1) / block_rows));
+        auto ranges = split_rows(num_rows, num_threads, block_rows);
+        std::vector<std::vector<ScoredRow>> heaps(num_threads);
+        std::vector<ScanCounters> counters(num_threads);
+        uint32_t reduced_kernel_dimension = get_kernel_dimension(reduced_dims);
+        auto scan = [&](uint32_t t){
+            auto [start, end] = ranges[t];
+            ThreadPin pin(numa_placement == NumaPlacement::none ? std::vector<int>() : numa_topology.node_cpus[get_numa_node(t, start, end)]);
+            with_metric(metric, [&](auto metric_tag){
+                with_dimension(reduced_kernel_dimension, [&](auto dim){
+                    scan_rows<decltype(metric_tag)::value, dim.value>(
+                        query.data(), reduced_store.get_start_addr(), reduced_row_size, reduced_dims, ElementType::float32,
+                        start, end, num_candidates, DistanceScore(), heaps[t], counters[t]
+                    );
+                });
+            });
+        };
+        std::vector<std::thread> threads;
+        for(uint32_t t = 1; t < num_threads; t++){
+            threads.emplace_back(scan, t);
+        }
+        scan(0);
+        for(auto& t : threads){
+            t.join();
+        }
+        std::vector<ScoredRow> candidates = merge_heaps(heaps, num_candidates);
+
+        // exact re-rank
+        for(const ScanCounters& c : counters){
+            stats_->add(stats_->distance_evaluations, c.distance_evaluations);
+        }
+        stats_->add(stats_->distance_evaluations, candidates.size());
+        std::vector<ScoredRow> exact;
+        for(auto [reduced_distance, idx] : candidates){
+            float distance = compute_distance(
+                embedding.data(), embedding_store.get_start_addr() + (size_t) idx * row_size,
+                embedding_size, metric, std::numeric_limits<float>::max(), element_type
             );
-            result.push_back(std::make_pair(dist, value));
+            exact.push_back(std::make_pair(distance, idx));
         }
+        uint32_t num_results = std::min((size_t) k, exact.size());
+        std::partial_sort(exact.begin(), exact.begin() + num_results, exact.end());
 
-        reverse(result.begin(), result.end());
+        std::vector<std::pair<float, std::string>> result;
+        for(uint32_t i = 0; i < num_results; i++){
+            result.push_back(std::make_pair(exact[i].first, get_value(exact[i].second)));
+        }
+        stats_->record(stats_->query_latency, query_start);
         return result;
     }
 
+    private:
+
+    void check_row(uint32_t idx){
+        uint32_t num_rows = get_num_embeddings();
+        if(idx >= num_rows){
+            throw std::out_of_range("Row " + std::to_string(idx) + " is out of range for " + std::to_string(num_rows) + " rows.");
+        }
+    }
+
+    // whether a size prefix at offset, followed by size bytes, lies inside the object store mapping
+    bool value_in_bounds(uint32_t object_store_offset, uint32_t size){
+        return object_store_offset >= DEFAULT_WRITE_IDX &&
+            (uint64_t) object_store_offset + OBJECT_STORE_IDX_TYPE_SIZE + size <= object_store.mmap_size;
+    }
+
+    // appends [u32 size][value], or [u32 size | COMPRESSED_VALUE_FLAG][u32 raw size][zstd frame] when compression is
+    // on and pays off. values that don't shrink are stored raw, so they keep zero-copy access
+    int write_value(const std::string& value){
+        uint32_t value_size = value.size();
+        if(value_size & COMPRESSED_VALUE_FLAG)
+            return -4;
+        std::string compressed;
+        if(header.value_codec == ValueCodec::zstd){
+            compressed = zstd_codec.compress(value);
+        }
+        bool store_compressed = !compressed.empty() && compressed.size() + sizeof(uint32_t) < value_size;
+        uint64_t stored_bytes = store_compressed ? compressed.size() + sizeof(uint32_t) : value_size;
+        // checked up front so a value that doesn't fit leaves no size prefix behind
+        if(object_store.read_only || object_store.write_idx + (uint64_t) OBJECT_STORE_IDX_TYPE_SIZE > object_store.mmap_size)
+            return -4;
+        if(object_store.write_idx + OBJECT_STORE_IDX_TYPE_SIZE + stored_bytes > object_store.mmap_size)
+            return -5;
+        if(store_compressed){
+            uint32_t stored_size = stored_bytes | COMPRESSED_VALUE_FLAG;
+            object_store.write(&stored_size, OBJECT_STORE_IDX_TYPE_SIZE);
+            object_store.write(&value_size, sizeof(uint32_t));
+            object_store.write(compressed.data(), compressed.size());
+        }else{
+            object_store.write(&value_size, OBJECT_STORE_IDX_TYPE_SIZE);
+            object_store.write(value.c_str(), value_size); // won't copy null terminating char
+        }
+        return 0;
+    }
+
+    // one byte per row, 1 for the given rows -- cheap to read from every scan thread
+    std::vector<uint8_t> get_row_mask(const std::vector<uint32_t>& rows){
+        std::vector<uint8_t> mask(get_num_embeddings(), 0);
+        for(uint32_t row : rows){
+            if(row < mask.size())
+                mask[row] = 1;
+        }
+        return mask;
+    }
+
+    // both text indexes, sized from the embedding store -- an existing index keeps its file's size
+    void open_text_indexes(){
+        MmapOptions lookup_options;
+        lookup_options.read_only = mmap_options.read_only;
+        // todo: scrutinize this default a bit more
+        inverted_index = std::make_unique<InvertedIndex>(
+            dir_path.c_str(), (embedding_store.mmap_size / embedding_size) * DEFAULT_BLOCK_SIZE,
+            DEFAULT_BLOCK_SIZE, DEFAULT_KEY_LENGTH, lookup_options
+        );
+        uint64_t positional_index_size = (uint64_t) object_store.mmap_size * POSITIONAL_INDEX_SIZE_FACTOR;
+        positional_index = std::make_unique<PositionalIndex>(
+            dir_path.c_str(), std::min(positional_index_size, (uint64_t) MAX_UINT32 / 2), lookup_options
+        );
+    }
+
+    // rows matching a boolean / phrase query, read under the positional lock. false without a positional index
+    bool match_query_rows(const std::string& query, std::vector<uint32_t>& rows){
+        std::shared_lock<std::shared_mutex> positional_lock(*positional_mutex);
+        if(!positional_index)
+            return false;
+        stats_->add(stats_->inverted_index_lookups, 1);
+        rows = positional_index->match_rows(query, analyzer);
+        return true;
+    }
+
+    // the k closest of rows, best first, each scored on its own with the scan's kernels -- for a few scattered rows,
+    // where a scan would mostly read rows it throws away. ties go to the lower row, like the scan
+    std::vector<ScoredRow> top_k_of_rows(float* query, const std::vector<uint32_t>& rows, uint32_t k, DistanceMetric metric){
+        if(k == 0)
+            return {};
+        std::priority_queue<ScoredRow> pq;
+        for(uint32_t idx : rows){
+            if(idx >= get_num_embeddings())
+                continue;
+            float thres = pq.size() == k ? pq.top().first : std::numeric_limits<float>::max();
+            float distance = compute_distance(
+                query, embedding_store.get_start_addr() + (size_t) idx * row_size, embedding_size, metric, thres, element_type
+            );
+            if(pq.size() < k || std::make_pair(distance, idx) < pq.top()){
+                pq.push(std::make_pair(distance, idx));
+                if(pq.size() > k)
+                    pq.pop();
+            }
+        }
+        stats_->add(stats_->distance_evaluations, rows.size());
+
+        std::vector<ScoredRow> top_k;
+        while(!pq.empty()){
+            top_k.push_back(pq.top());
+            pq.pop();
+        }
+        std::reverse(top_k.begin(), top_k.end());
+        return top_k;
+    }
+
+    // rows added before the positional index existed, or past the end of its log, are indexed from the object
+    // store. consecutive rows with the same object offset are one object
+    void index_missing_rows(){
+        uint32_t row = positional_index->get_num_rows();
+        while(row < get_num_embeddings()){
+            uint32_t offset = get_object_store_offset(row);
+            uint32_t end = row + 1;
+            while(end < get_num_embeddings() && get_object_store_offset(end) == offset){
+                end++;
+            }
+            positional_index->insert(row, end - row, read_value(offset), analyzer);
+            row = end;
+        }
+    }
+
+    // index into numa_topology of the part holding row
+    uint32_t get_numa_part(uint32_t row){
+        auto it = std::upper_bound(numa_part_starts.begin(), numa_part_starts.end(), row);
+        return it == numa_part_starts.begin() ? 0 : it - numa_part_starts.begin() - 1;
+    }
+
+    // the node scan worker t reads [start, end) from: round-robin when interleaved, else the node of most of the range
+    uint32_t get_numa_node(uint32_t t, uint32_t start, uint32_t end){
+        if(numa_placement == NumaPlacement::interleave || end <= start)
+            return t % numa_topology.num_nodes();
+        return get_numa_part(start + (end - start) / 2);
+    }
+
+    public:
+
+    // object store offsets include DEFAULT_WRITE_IDX. rows of the same object share one
+    uint32_t get_object_store_offset(uint32_t idx){
+        return char_to_uint32_t(embedding_to_object_map.mmap_addr + DEFAULT_WRITE_IDX + idx * OBJECT_STORE_IDX_TYPE_SIZE);
+    }
+
+    private:
+
+    void open_binary_store(){
+        MmapOptions binary_options = mmap_options; // scanned end to end just like the embedding store
+        uint32_t max_rows = embedding_store.mmap_size / row_size; // the file's size, which an existing store keeps
+        binary_store = FileWrapper(dir_path / BINARY_STORE_FN, max_rows * binary_row_size(embedding_size), binary_options);
+    }
+
+    // a float32 row per row the embedding store can hold -- past 4 GB for a half precision store once reduced_dims
+    // is over about half of embedding_size
+    uint64_t reduced_store_size(uint32_t reduced_dims){
+        uint64_t max_rows = embedding_store.mmap_size / row_size; // the file's size, which an existing store keeps
+        return max_rows * reduced_dims * sizeof(float);
+    }
+
+    void open_reduced_store(){
+        // enable_reduced_search refuses a size past MAX_UINT32, so this never truncates
+        reduced_store = FileWrapper(dir_path / REDUCED_STORE_FN, (uint32_t) reduced_store_size(header.reduced_dims), mmap_options);
+    }
+
+    public:
+
+    // counters are only collected when built with EMBEDDING_SEARCH_STATS ("enabled" says which); page cache
+    // residency of the mmaps is always reported
+    std::map<std::string, double> stats(){
+        std::map<std::string, double> out = stats_->to_map();
+        out["num_embeddings"] = get_num_embeddings();
+        out["object_store_bytes"] = object_store.write_idx - DEFAULT_WRITE_IDX;
+        out["embedding_store_resident_fraction"] = resident_fraction(embedding_store.mmap_addr, embedding_store.mmap_size);
+        out["object_store_resident_fraction"] = resident_fraction(object_store.mmap_addr, object_store.mmap_size);
+        if(binary_store.mmap_addr)
+            out["binary_store_resident_fraction"] = resident_fraction(binary_store.mmap_addr, binary_store.mmap_size);
+        if(reduced_store.mmap_addr)
+            out["reduced_store_resident_fraction"] = resident_fraction(reduced_store.mmap_addr, reduced_store.mmap_size);
+        if(query_cache)
+            query_cache->export_to(out); // always counted, the cache is opt-in anyway
+        return out;
+    }
+
+    void reset_stats(){
+        stats_->reset();
+        if(query_cache)
+            query_cache->reset_counters();
+    }
+
+    // copies the store as of the last completed add into dest_dir (which must be new or empty) while it keeps
+    // serving. writers wait for the copy; readers don't. the copy is an ordinary store directory: open it like
+    // any other, read-only or writable, with nothing to rebuild. returns -1 if dest_dir is in use, -2 if a copy failed
+    int snapshot(const char* dest_dir){
+        // checked and created under the lock, so two snapshots into the same dir can't both pass the check
+        std::lock_guard<std::mutex> lock(*write_mutex);
+        fs::path dest(dest_dir);
+        if(fs::exists(dest) && !fs::is_empty(dest))
+            return -1;
+        fs::create_directories(dest);
+
+        std::vector<std::pair<FileWrapper*, const char*>> files = {
+            {&embedding_store, EMBEDDING_STORE_FN},
+            {&embedding_to_object_map, EMBEDDING_TO_OBJECT_MAP_FN},
+            {&object_store, OBJECT_STORE_FN}
+        };
+        if(binary_store.mmap_addr)
+            files.push_back({&binary_store, BINARY_STORE_FN});
+        if(reduced_store.mmap_addr)
+            files.push_back({&reduced_store, REDUCED_STORE_FN});
+        if(inverted_index)
+            files.push_back({&inverted_index->get_file(), INVERTED_INDEX_FN});
+        if(positional_index && positional_index->get_file().mmap_addr)
+            files.push_back({&positional_index->get_file(), POSITIONAL_INDEX_FN});
+        if(standing_queries)
+            files.push_back({&standing_queries->get_file(), STANDING_QUERIES_FN});
+        for(auto [file, name] : files){
+            if(file->copy_to(dest / name) != 0)
+                return -2;
+        }
+
+        // small files that are only rewritten whole, under the same lock
+        for(const char* name : {STORE_HEADER_FN, VALUE_DICTIONARY_FN, PROJECTION_FN}){
+            std::error_code ec;
+            if(fs::exists(dir_path / name) && !fs::copy_file(dir_path / name, dest / name, ec))
+                return -2;
+        }
+        return 0;
+    }
+
+    // streams the store out as columns numpy (or anything else) can map without parsing:
+    //   vectors.npy        (rows, dims) in the store's element type -- bfloat16 as float32, numpy has no bf16
+    //   ids.npy            u32 per row, the object it belongs to (rows of one object share it)
+    //   values.bin         every object's value, back to back
+    //   value_offsets.npy  u64, num_objects + 1 offsets into values.bin
+    // data moves chunk_bytes at a time, float16/32 rows straight from the mmap. writers wait for the export,
+    // readers don't. returns -1 if dest_dir is in use, -2 if a write failed
+    int export_columnar(const char* dest_dir, uint32_t chunk_bytes = EXPORT_CHUNK_BYTES){
+        std::lock_guard<std::mutex> lock(*write_mutex); // before the check, like snapshot
+        fs::path dest(dest_dir);
+        if(fs::exists(dest) && !fs::is_empty(dest))
+            return -1;
+        fs::create_directories(dest);
+
+        uint32_t num_rows = get_num_embeddings();
+        bool native = element_type != ElementType::bfloat16;
+        uint32_t out_row_size = native ? row_size : embedding_size * sizeof(float);
+        uint32_t chunk_rows = std::max(1u, chunk_bytes / out_row_size);
+
+        std::ofstream vectors(dest / EXPORT_VECTORS_FN, std::ios::binary);
+        vectors << npy_header(element_type == ElementType::float16 ? "<f2" : "<f4", {num_rows, embedding_size});
+        std::vector<float> decoded;
+        for(uint32_t start = 0; start < num_rows; start += chunk_rows){
+            uint32_t count = std::min(chunk_rows, num_rows - start);
+            char* rows = embedding_store.get_start_addr() + (size_t) start * row_size;
+            if(native){
+                vectors.write(rows, (size_t) count * row_size);
+            }else{
+                decoded.resize((size_t) count * embedding_size);
+                decode_elements(element_type, rows, decoded.data(), decoded.size());
+                vectors.write((const char*) decoded.data(), decoded.size() * sizeof(float));
+            }
+        }
+        vectors.close();
+
+        // value_offsets.npy's header needs the object count up front -- one pass over the 4-byte row -> object map
+        uint64_t num_objects = 0;
+        for(uint32_t row = 0; row < num_rows; row++){
+            if(row == 0 || get_object_store_offset(row) != get_object_store_offset(row - 1))
+                num_objects++;
+        }
+
+        std::ofstream ids(dest / EXPORT_IDS_FN, std::ios::binary);
+        std::ofstream values(dest / EXPORT_VALUES_FN, std::ios::binary);
+        std::ofstream offsets(dest / EXPORT_VALUE_OFFSETS_FN, std::ios::binary);
+        ids << npy_header("<u4", {num_rows});
+        offsets << npy_header("<u8", {num_objects + 1});
+
+        std::vector<uint32_t> id_chunk;
+        std::vector<uint64_t> offset_chunk = {0};
+        uint32_t chunk_entries = std::max(1u, chunk_bytes / (uint32_t) sizeof(uint64_t));
+        uint32_t object = 0;
+        uint64_t values_size = 0;
+        for(uint32_t row = 0; row < num_rows; row++){
+            uint32_t offset = get_object_store_offset(row);
+            if(row > 0 && offset != get_object_store_offset(row - 1))
+                object++;
+            if(row == 0 || offset != get_object_store_offset(row - 1)){
+                std::optional<std::string_view> view = read_value_view(offset);
+                std::string value = view ? std::string() : read_value(offset);
+                std::string_view bytes = view ? *view : std::string_view(value);
+                values.write(bytes.data(), bytes.size());
+                values_size += bytes.size();
+                offset_chunk.push_back(values_size);
+            }
+            id_chunk.push_back(object);
+
+            if(id_chunk.size() >= chunk_entries || row + 1 == num_rows){
+                ids.write((const char*) id_chunk.data(), id_chunk.size() * sizeof(uint32_t));
+                id_chunk.clear();
+            }
+            if(offset_chunk.size() >= chunk_entries || row + 1 == num_rows){
+                offsets.write((const char*) offset_chunk.data(), offset_chunk.size() * sizeof(uint64_t));
+                offset_chunk.clear();
+            }
+        }
+        if(num_rows == 0)
+            offsets.write((const char*) offset_chunk.data(), sizeof(uint64_t));
+        ids.close();
+        values.close();
+        offsets.close();
+
+        if(!vectors || !ids || !values || !offsets)
+            return -2;
+        return 0;
+    }
+
+    // the reverse of export_columnar, from our files or numpy's: vectors.npy (rows, dims) of float16/32/64, values.bin
+    // and value_offsets.npy (u64 or u32) with one value per object, and optionally ids.npy (integers) giving each row's
+    // object as an index into value_offsets. consecutive rows with the same id are added as one object; without
+    // ids.npy every row is its own object. inputs are mapped and read once in order, never loaded whole.
+    // returns -1 if a file is missing or malformed, -2 if the shapes don't match the store or each other, -3 if an
+    // add failed (the store is full or read-only) -- the objects before it stay added
+    int import_columnar(const char* src_dir){
+        fs::path src(src_dir);
+        MappedFile vectors_file(src / EXPORT_VECTORS_FN);
+        MappedFile values_file(src / EXPORT_VALUES_FN);
+        MappedFile offsets_file(src / EXPORT_VALUE_OFFSETS_FN);
+        bool has_ids = fs::exists(src / EXPORT_IDS_FN);
+        MappedFile ids_file(src / EXPORT_IDS_FN);
+
+        NpyArray vectors, offsets, ids;
+        if(!values_file.is_open()
+            || !parse_npy_header(vectors_file.data(), vectors_file.size(), vectors)
+            || !parse_npy_header(offsets_file.data(), offsets_file.size(), offsets)
+            || (has_ids && !parse_npy_header(ids_file.data(), ids_file.size(), ids)))
+            return -1;
+
+        auto is_int = [](const std::string& descr){
+            return descr == "<u4" || descr == "<i4" || descr == "<u8" || descr == "<i8";
+        };
+        if((vectors.descr != "<f2" && vectors.descr != "<f4" && vectors.descr != "<f8")
+            || !is_int(offsets.descr) || (has_ids && !is_int(ids.descr)))
+            return -1;
+
+        if(vectors.shape.size() != 2 || vectors.shape[1] != embedding_size || offsets.shape.size() != 1
+            || offsets.shape[0] == 0)
+            return -2;
+        uint64_t num_rows = vectors.shape[0];
+        uint64_t num_objects = offsets.shape[0] - 1;
+        if(has_ids ? (ids.shape.size() != 1 || ids.shape[0] != num_rows) : num_objects != num_rows)
+            return -2;
+
+        // little-endian integer column, u32/i32/u64/i64 -- negative ids end up out of range below
+        auto read_int = [](const MappedFile& file, const NpyArray& array, uint64_t i) -> uint64_t {
+            const char* data = file.data() + array.data_offset;
+            if(array.descr[2] == '4'){
+                uint32_t v;
+                memcpy(&v, data + i * sizeof(uint32_t), sizeof(uint32_t));
+                return array.descr[1] == 'i' ? (uint64_t) (int64_t) (int32_t) v : v;
+            }
+            uint64_t v;
+            memcpy(&v, data + i * sizeof(uint64_t), sizeof(uint64_t));
+            return v;
+        };
+
+        const char* vector_data = vectors_file.data() + vectors.data_offset;
+        auto read_row = [&](uint64_t row, std::vector<float>& out){
+            out.resize(embedding_size);
+            const char* src_row = vector_data + row * embedding_size * (vectors.descr[2] - '0');
+            if(vectors.descr == "<f4"){
+                memcpy(out.data(), src_row, embedding_size * sizeof(float));
+            }else if(vectors.descr == "<f2"){
+                decode_elements(ElementType::float16, src_row, out.data(), embedding_size);
+            }else{
+                for(uint32_t i = 0; i < embedding_size; i++){
+                    double d;
+                    memcpy(&d, src_row + i * sizeof(double), sizeof(double));
+                    out[i] = d;
+                }
+            }
+        };
+
+        std::vector<std::vector<float>> object_rows;
+        for(uint64_t row = 0; row < num_rows;){
+            uint64_t object = has_ids ? read_int(ids_file, ids, row) : row;
+            if(object >= num_objects)
+                return -2;
+            uint64_t value_start = read_int(offsets_file, offsets, object);
+            uint64_t value_end = read_int(offsets_file, offsets, object + 1);
+            if(value_start > value_end || value_end > values_file.size())
+                return -2;
+
+            object_rows.clear();
+            do {
+                object_rows.emplace_back();
+                read_row(row, object_rows.back());
+                row++;
+            } while(has_ids && row < num_rows && read_int(ids_file, ids, row) == object);
+
+            std::string value(values_file.data() + value_start, value_end - value_start);
+            if(add_object(object_rows, value) != 0)
+                return -3;
+        }
+        return 0;
+    }
+
+    // row idx decoded to float32, empty if there is no such row
+    std::vector<float> get_embedding(uint32_t idx){
+        if(idx >= get_num_embeddings())
+            return {};
+        std::vector<float> embedding(embedding_size);
+        decode_elements(element_type, embedding_store.get_start_addr() + (size_t) idx * row_size, embedding.data(), embedding_size);
+        return embedding;
+    }
+
+    ElementType get_element_type(){
+        return element_type;
+    }
+
+    uint32_t get_num_embeddings(){
+        return num_embeddings->load(std::memory_order_acquire);
+    }
+
+    uint32_t get_embedding_size(){
+        return embedding_size;
+    }
+
     void close_store(){ // for the python binding
         embedding_store.set_write_idx();
         embedding_to_object_map.set_write_idx();
         object_store.set_write_idx();
-        delete inverted_index; // will call close(fd) -- should be ok?
+        binary_store.set_write_idx();
+        reduced_store.set_write_idx();
+        std::unique_lock<std::shared_mutex> inverted_lock(*inverted_mutex);
+        inverted_index.reset(); // writes the index header and closes its file
+        std::unique_lock<std::shared_mutex> positional_lock(*positional_mutex);
+        positional_index.reset();
+        standing_queries.reset();
     }
 };
 
@@ -5,68 +5,126 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
 
 #include "constants.h"
 #include "utils.h"
 
 namespace fs = std::filesystem;
 
+enum class MmapAdvice {
+    normal,
+    sequential, // MADV_SEQUENTIAL -- aggressive readahead, pages dropped soon after use
+    random,     // MADV_RANDOM -- no readahead
+    willneed    // MADV_WILLNEED -- start reading the whole mapping in the background
+};
+
+struct MmapOptions {
+    bool read_only = false;   // O_RDONLY + PROT_READ, never resized or written -- safe to share across processes
+    MmapAdvice advice = MmapAdvice::normal;
+    bool populate = false;    // MAP_POPULATE: fault in the whole file during open instead of on first query
+    bool huge_pages = false;  // MADV_HUGEPAGE: ask for transparent hugepages to cut TLB misses on full scans
+};
+
 class FileWrapper {
     public:
-    
-    int fd = -1; 
+
+    int fd = -1;
     char* mmap_addr = nullptr;
     uint32_t write_idx = DEFAULT_WRITE_IDX;
     uint32_t mmap_size = 0;
+    bool read_only = false;
 
     FileWrapper() = default;
 
-    FileWrapper(const fs::path& path, uint32_t max_size){
+    FileWrapper(const fs::path& path, uint32_t max_size, const MmapOptions& options = MmapOptions()) :
+        read_only(options.read_only)
+    {
         bool exists = fs::exists(path);
+        if(read_only && !exists){
+            throw std::runtime_error("Cannot open " + path.string() + " read-only: file does not exist.");
+        }
         mmap_size = exists ? fs::file_size(path) : max_size;
-        // std::cout << "mmap_size: " << mmap_size << std::endl;
-        // std::cout << "exists: " << exists << std::endl;
 
         const char* path_c_str = path.c_str();
 
-        // std::cout << "path_c_str: " << path_c_str << std::endl;
-        
-        fd = open(path_c_str, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-        assert(fd != -1);
+        if(read_only){
+            fd = open(path_c_str, O_RDONLY);
+            assert(fd != -1);
+        }else{
+            fd = open(path_c_str, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+            assert(fd != -1);
 
-        int alloc = ftruncate(fd, mmap_size);
-        assert(alloc != -1);
+            int alloc = ftruncate(fd, mmap_size);
+            assert(alloc != -1);
+        }
 
-        mmap_addr = (char*) mmap(
-            NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+        int flags = MAP_SHARED;
+        if(options.populate){
+            flags |= MAP_POPULATE;
+        }
+        mmap_addr = (char*) mmap(NULL, mmap_size, prot, flags, fd, 0);
         assert(mmap_addr != MAP_FAILED);
 
+        if(options.huge_pages){
+            set_huge_pages();
+        }
+        advise(options.advice);
+
         if(!exists){
             memset(mmap_addr, 0, mmap_size);
         }else{
-            write_idx = char_to_uint32_t(mmap_addr);
+            // a header of 0 means the file was never closed cleanly -- treat it as empty rather than underflow
+            write_idx = std::max(char_to_uint32_t(mmap_addr), DEFAULT_WRITE_IDX);
         }
     }
 
+    FileWrapper(const FileWrapper&) = delete;
+    FileWrapper& operator=(const FileWrapper&) = delete;
+
+    FileWrapper(FileWrapper&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    FileWrapper& operator=(FileWrapper&& other) noexcept {
+        if(this != &other){
+            release();
+            fd = std::exchange(other.fd, -1);
+            mmap_addr = std::exchange(other.mmap_addr, nullptr);
+            write_idx = std::exchange(other.write_idx, DEFAULT_WRITE_IDX);
+            mmap_size = std::exchange(other.mmap_size, 0);
+            read_only = std::exchange(other.read_only, false);
+        }
+        return *this;
+    }
+
     void set_write_idx(){
+        if(read_only || !mmap_addr)
+            return;
         memcpy(mmap_addr, &write_idx, DEFAULT_WRITE_IDX);
     }
 
     ~FileWrapper(){
-        set_write_idx();
-        close(fd);
+        release();
     }
 
     int write(const void* data, uint32_t size, uint32_t idx){
+        if(read_only)
+            return -1;
         memcpy(mmap_addr + DEFAULT_WRITE_IDX + idx, data, size);
         return 0;
     }
 
     int write(const void* data, uint32_t size){
-        if(write_idx + size > mmap_size){
-            // std::cout << "write_idx: " << write_idx << " size: " << size << " mmap_size: " << mmap_size << std::endl;
+        if(read_only || write_idx + size > mmap_size){
             return -1;
         }
         memcpy(mmap_addr + write_idx, data, size);
@@ -77,4 +135,105 @@ class FileWrapper {
     char* get_start_addr(){
         return mmap_addr + DEFAULT_WRITE_IDX;
     }
-};
\ No newline at end of file
+
+    int advise(MmapAdvice advice){
+        if(!mmap_addr)
+            return -1;
+        switch(advice){
+            case MmapAdvice::normal:
+                return madvise(mmap_addr, mmap_size, MADV_NORMAL);
+            case MmapAdvice::sequential:
+                return madvise(mmap_addr, mmap_size, MADV_SEQUENTIAL);
+            case MmapAdvice::random:
+                return madvise(mmap_addr, mmap_size, MADV_RANDOM);
+            case MmapAdvice::willneed:
+                return madvise(mmap_addr, mmap_size, MADV_WILLNEED);
+            default:
+                throw std::invalid_argument("Invalid mmap advice");
+        }
+    }
+
+    // only a hint -- file-backed THP needs kernel support, so a failure here is not an error
+    int set_huge_pages(){
+#ifdef MADV_HUGEPAGE
+        if(mmap_addr)
+            return madvise(mmap_addr, mmap_size, MADV_HUGEPAGE);
+#endif
+        return -1;
+    }
+
+    // fault in every written page now so the first query doesn't pay for it
+    void warm_up(){
+        if(!mmap_addr)
+            return;
+        madvise(mmap_addr, mmap_size, MADV_WILLNEED);
+
+        long page_size = sysconf(_SC_PAGESIZE);
+        volatile char sink = 0;
+        for(uint32_t offset = 0; offset < write_idx; offset += page_size){
+            sink ^= mmap_addr[offset];
+        }
+        (void) sink;
+    }
+
+    // writes a point-in-time copy of this file to dest, with the in-memory write_idx as its header, so the copy
+    // opens like a cleanly closed file. a reflink (FICLONE) shares the extents when the filesystem supports it,
+    // otherwise copy_file_range copies only the written prefix in the kernel; plain read/write is the last resort.
+    // the caller must keep writers out while this runs
+    int copy_to(const fs::path& dest){
+        if(!mmap_addr)
+            return -1;
+        int dest_fd = open(dest.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if(dest_fd == -1)
+            return -1;
+
+        bool copied = false;
+#ifdef FICLONE
+        copied = ioctl(dest_fd, FICLONE, fd) == 0;
+#endif
+        if(!copied){
+            copied = copy_range(dest_fd, write_idx);
+        }
+        // full size, so the copy can keep growing when it is opened writable -- the tail stays sparse
+        bool ok = copied && ftruncate(dest_fd, mmap_size) == 0;
+        if(ok && !read_only){
+            ok = pwrite(dest_fd, &write_idx, DEFAULT_WRITE_IDX, 0) == DEFAULT_WRITE_IDX;
+        }
+        close(dest_fd);
+        return ok ? 0 : -2;
+    }
+
+    private:
+
+    bool copy_range(int dest_fd, uint32_t length){
+        loff_t in_offset = 0;
+        loff_t out_offset = 0;
+        while(in_offset < length){
+            ssize_t n = copy_file_range(fd, &in_offset, dest_fd, &out_offset, length - in_offset, 0);
+            if(n <= 0)
+                break;
+        }
+        // EXDEV / ENOSYS / EINVAL on older kernels and some filesystems -- fall back to copying through userspace
+        char buf[64 * 1024];
+        while(in_offset < length){
+            ssize_t n = pread(fd, buf, std::min((loff_t) sizeof(buf), length - in_offset), in_offset);
+            if(n <= 0 || pwrite(dest_fd, buf, n, out_offset) != n)
+                return false;
+            in_offset += n;
+            out_offset += n;
+        }
+        return true;
+    }
+
+    void release(){
+        if(mmap_addr){
+            set_write_idx();
+            munmap(mmap_addr, mmap_size);
+            mmap_addr = nullptr;
+        }
+        if(fd != -1){
+            close(fd);
+            fd = -1;
+        }
+    }
+};
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 #include <algorithm>
@@ -18,6 +19,7 @@
 namespace fs = std::filesystem;
 
 const uint32_t DEFAULT_BLOCK_SIZE = 64;
+const uint32_t DEFAULT_KEY_LENGTH = 16;
 
 class InvertedIndex {
     private:
@@ -25,96 +27,142 @@ class InvertedIndex {
         uint32_t block_size;
         uint32_t key_length;
 
-        void get_padded_buf(const std::string& key, char* buf){
-            memset(buf, 0, key_length);
-            memcpy(buf, key.c_str(), std::min((uint32_t) key.size(), key_length));
-        }
-
     public:
 
     // each block includes the key + values -- with defaults, we can store (64-16) / 4 = 12 values
-    InvertedIndex(const char* dir, uint32_t max_size, uint32_t block_size = DEFAULT_BLOCK_SIZE, uint32_t key_length = 16) : 
-        index(fs::path(dir) / INVERTED_INDEX_FN, max_size),
+    InvertedIndex(
+        const char* dir, uint32_t max_size, uint32_t block_size = DEFAULT_BLOCK_SIZE, uint32_t key_length = DEFAULT_KEY_LENGTH,
+        const MmapOptions& mmap_options = MmapOptions()
+    ) : 
+        index(fs::path(dir) / INVERTED_INDEX_FN, max_size, mmap_options),
         block_size(block_size),
         key_length(key_length)
     {}
 
+    FileWrapper& get_file(){
+        return index;
+    }
+
+    uint32_t get_block_size(){
+        return block_size;
+    }
+
+    uint32_t get_key_length(){
+        return key_length;
+    }
+
+    // a key longer than key_length keeps its prefix and ends in a hash of the whole key, so long keys that
+    // share a prefix still get blocks of their own
+    void get_padded_buf(std::string_view key, char* buf){
+        memset(buf, 0, key_length);
+        if(key.size() <= key_length || key_length <= sizeof(uint32_t)){
+            memcpy(buf, key.data(), std::min((uint32_t) key.size(), key_length));
+            return;
+        }
+        uint32_t prefix_length = key_length - sizeof(uint32_t);
+        uint32_t hash = 2166136261u; // fnv-1a
+        for(unsigned char c : key){
+            hash = (hash ^ c) * 16777619u;
+        }
+        memcpy(buf, key.data(), prefix_length);
+        memcpy(buf + prefix_length, &hash, sizeof(uint32_t));
+    }
+
     uint32_t get_num_keys(){
         // std::cout << "index.write_idx: " << index.write_idx << std::endl;
         return (index.write_idx - DEFAULT_WRITE_IDX) / block_size;
     }
 
-    int insert_block_in_position(uint32_t pos, const std::string& key, const std::vector<uint32_t>& values, bool new_key){
+    // a block holds the key and then this many values -- a key with more takes several consecutive blocks
+    uint32_t get_values_per_block(){
+        return (block_size - key_length) / sizeof(uint32_t);
+    }
+
+    // whether num_inserts inserts of num_values values each are sure to fit: each one needs at most
+    // ceil(num_values / values per block) new blocks, however many of its values the key's free slots take
+    bool has_room_for(uint64_t num_inserts, uint32_t num_values){
+        uint32_t values_per_block = get_values_per_block();
+        uint64_t blocks_per_insert = std::max(1u, (num_values + values_per_block - 1) / values_per_block);
+        return index.write_idx + num_inserts * blocks_per_insert * block_size <= index.mmap_size;
+    }
+
+    // adds values to the key: the free slots of its block at pos take what they can, the rest go into new blocks
+    // right after it (at pos for a new key). returns -1 for a bad pos, -2 if the new blocks don't fit -- checked
+    // before anything is written, so an insert never leaves the key with only part of its values
+    int insert_block_in_position(uint32_t pos, std::string_view key, const std::vector<uint32_t>& values, bool new_key){
         uint32_t num_keys = get_num_keys();
         // std::cout << "num_keys: " << num_keys << std::endl;
         // std::cout << "pos: " << pos << std::endl;
 
-        if(pos > num_keys){
+        if(pos > num_keys || (!new_key && pos == num_keys)){
             return -1; // max should be pos == num_keys
         }
 
-        if(new_key){
-            if(pos != num_keys){
-                // std::cout << "memmove" << std::endl;
-                memmove(
-                    index.get_start_addr() + (pos + 1) * block_size,
-                    index.get_start_addr() + pos * block_size,
-                    (num_keys - pos) * block_size
-                );
-                // std::cout << std::string(index.get_start_addr() + (pos + 1) * block_size, key_length) << std::endl;
+        uint32_t values_per_block = get_values_per_block();
+        uint32_t num_used = 0;
+        if(!new_key){
+            // values fill a block from the front, MAX_UINT32 marks a free slot
+            char* value_start_pos = index.get_start_addr() + pos * block_size + key_length;
+            while(num_used < values_per_block && char_to_uint32_t(value_start_pos + num_used * sizeof(uint32_t)) != MAX_UINT32){
+                num_used++;
             }
+        }
+        uint32_t num_in_place = new_key ? 0 : std::min(values_per_block - num_used, (uint32_t) values.size());
+        uint32_t num_spilled = values.size() - num_in_place;
+        uint32_t num_new_blocks = (num_spilled + values_per_block - 1) / values_per_block;
+        if(new_key){
+            num_new_blocks = std::max(num_new_blocks, 1u);
+        }
+        if(index.write_idx + (uint64_t) num_new_blocks * block_size > index.mmap_size){
+            return -2; // index is full
+        }
 
-            char key_str_buf[key_length];
-            get_padded_buf(key, key_str_buf);
+        uint32_t block_write_idx = pos * block_size + key_length + num_used * sizeof(uint32_t);
+        for(uint32_t i = 0; i < num_in_place; i++){
+            index.write(&values[i], sizeof(uint32_t), block_write_idx);
+            block_write_idx += sizeof(uint32_t);
+        }
+        if(num_new_blocks > 0){
+            insert_new_blocks(new_key ? pos : pos + 1, num_new_blocks, key, values.data() + num_in_place, num_spilled);
+        }
+        return 0;
+    }
 
-            uint32_t block_write_idx = pos * block_size; 
+    // opens num_blocks blocks for key at pos, moving the blocks from pos on back, and fills them with values in
+    // order. the caller has checked that they fit
+    void insert_new_blocks(uint32_t pos, uint32_t num_blocks, std::string_view key, const uint32_t* values, uint32_t num_values){
+        uint32_t num_keys = get_num_keys();
+        if(pos != num_keys){
+            // std::cout << "memmove" << std::endl;
+            memmove(
+                index.get_start_addr() + (pos + num_blocks) * block_size,
+                index.get_start_addr() + pos * block_size,
+                (num_keys - pos) * block_size
+            );
+        }
+
+        char key_str_buf[key_length];
+        get_padded_buf(key, key_str_buf);
+
+        uint32_t values_per_block = get_values_per_block();
+        for(uint32_t b = 0; b < num_blocks; b++){
+            uint32_t block_write_idx = (pos + b) * block_size;
             index.write(key_str_buf, key_length, block_write_idx);
             block_write_idx += key_length;
 
-            for(uint32_t v : values){
-                // std::cout << "v: " << v << std::endl;
-                // std::cout << "block_write_idx: " << block_write_idx << std::endl;
-                index.write(&v, sizeof(uint32_t), block_write_idx);
-                block_write_idx += sizeof(uint32_t);
-            }
+            uint32_t num_block_values = std::min(values_per_block, num_values - b * values_per_block);
+            index.write(values + b * values_per_block, num_block_values * sizeof(uint32_t), block_write_idx);
+            block_write_idx += num_block_values * sizeof(uint32_t);
 
-            uint32_t num_filler_bytes = (block_size - key_length - values.size() * sizeof(uint32_t)) / sizeof(uint32_t);
-            for(size_t i = 0; i < num_filler_bytes; i++){
+            for(uint32_t i = num_block_values; i < values_per_block; i++){
                 index.write(&MAX_UINT32, 4, block_write_idx); // fill remaining block w/ max value
                 block_write_idx += sizeof(uint32_t);
             }
-
-            index.write_idx += block_size;
-        }else{
-            // std::cout << "inserting into existing block" << std::endl;
-            // get num of available spaces in block
-            char* value_start_pos = index.get_start_addr() + pos * block_size + key_length;
-            uint32_t curr_value = char_to_uint32_t(value_start_pos);
-            char* curr_value_pos = value_start_pos;
-            while(curr_value != MAX_UINT32 && (curr_value_pos - value_start_pos) < (block_size - key_length)){
-                curr_value_pos += 4;
-                curr_value = char_to_uint32_t(curr_value_pos);
-            }
-
-            const uint32_t num_available_bytes = block_size - key_length - (curr_value_pos - value_start_pos);
-            uint32_t num_available_spaces = num_available_bytes / sizeof(uint32_t);
-
-            // std::cout << "num_available_spaces: " << num_available_spaces << std::endl;
-
-            uint32_t block_write_idx = pos * block_size + key_length + (curr_value_pos - value_start_pos);
-            for(size_t i = 0 ; i < std::min(num_available_spaces, (uint32_t) values.size()); i++){
-                index.write(&values[i], sizeof(uint32_t), block_write_idx);
-                block_write_idx += sizeof(uint32_t);
-            }
-
-            if(values.size() > num_available_spaces){
-                std::vector<uint32_t> remaining_values(values.begin() + num_available_spaces, values.end());
-                insert_block_in_position(pos + 1, key, remaining_values, true);
-            }
         }
+        index.write_idx += num_blocks * block_size;
     }
 
-    std::pair<uint32_t, bool> bsearch(const std::string& key){
+    std::pair<uint32_t, bool> bsearch(std::string_view key){
         char key_search_buf[key_length];
         get_padded_buf(key, key_search_buf);
 
@@ -143,35 +191,31 @@ class InvertedIndex {
         return std::make_pair(l, false);
     }
 
-    int insert(const std::string& key, const std::vector<uint32_t>& values){
-        if(key.size() > key_length){
+    int insert(std::string_view key, const std::vector<uint32_t>& values){
+        if(index.read_only){
             return -1;
         }
         auto [idx, found] = bsearch(key);
         // std::cout << "idx: " << idx << std::endl;
-        insert_block_in_position(idx, key, values, !found);
-        return 0;
+        return insert_block_in_position(idx, key, values, !found);
     }   
 
     std::vector<uint32_t> get_values_from_block(uint32_t block_idx){
         // std::cout << "block_idx: " << block_idx << std::endl;
         std::vector<uint32_t> values;
         char* start_value_pos = index.get_start_addr() + block_idx * block_size + key_length;
-        char* value_pos = start_value_pos;
-        uint32_t curr_value = char_to_uint32_t(value_pos);
-        while(curr_value != MAX_UINT32 && (value_pos - start_value_pos) < (block_size - key_length)){
-            char print_buf[4];
-            memcpy(print_buf, value_pos, 4);
-            //std::cout << "value_pos: " << print_buf << std::endl;
+        // the bound is checked first: past a full block is the next block, or the end of a full index
+        for(uint32_t i = 0; i < get_values_per_block(); i++){
+            uint32_t curr_value = char_to_uint32_t(start_value_pos + i * sizeof(uint32_t));
+            if(curr_value == MAX_UINT32)
+                break;
             //std::cout << "curr_value: " << curr_value << std::endl;
             values.push_back(curr_value);
-            value_pos += 4;
-            curr_value = char_to_uint32_t(value_pos);
         }
         return values;
     }
 
-    std::vector<uint32_t> search(const std::string& key){
+    std::vector<uint32_t> search(std::string_view key){
         char key_search_buf[key_length];
         get_padded_buf(key, key_search_buf);
 
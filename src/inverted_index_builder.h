@@ -0,0 +1,168 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <filesystem>
+
+#include "file_wrapper.h"
+#include "constants.h"
+
+namespace fs = std::filesystem;
+
+const uint32_t POSTING_RUN_SPILL_ENTRIES = 1 << 22; // entries a builder thread holds before it spills a sorted run
+
+// a sorted run on disk: ([padded key][u32 row])* in key order. it is read back through a read-only mapping, so the
+// merge only keeps the pages it is walking in memory, not every (key, row) of the corpus
+class SpilledRun {
+    private:
+    FileWrapper file;
+    uint32_t entry_size;
+    size_t entries;
+
+    public:
+
+    SpilledRun(const fs::path& path, uint32_t key_length) : entry_size(key_length + sizeof(uint32_t)) {
+        MmapOptions options;
+        options.read_only = true;
+        options.advice = MmapAdvice::sequential;
+        file = FileWrapper(path, 0, options);
+        entries = (file.write_idx - DEFAULT_WRITE_IDX) / entry_size;
+    }
+
+    size_t size() const {
+        return entries;
+    }
+
+    const char* key_at(size_t i) const {
+        return file.mmap_addr + DEFAULT_WRITE_IDX + i * entry_size;
+    }
+
+    uint32_t row_at(size_t i) const {
+        uint32_t row;
+        memcpy(&row, key_at(i) + entry_size - sizeof(uint32_t), sizeof(uint32_t));
+        return row;
+    }
+};
+
+// one builder thread's (padded key, row) pairs. entries are added in row order; spill() sorts them by key, keeping
+// equal keys in the order they were added so rows stay ascending within a key, writes them to a SpilledRun file and
+// starts over. keys live in one flat buffer -- no allocation per entry, and the sort only moves 4-byte indices
+class PostingRun {
+    private:
+    uint32_t key_length;
+    std::vector<char> keys;
+    std::vector<uint32_t> rows;
+    std::vector<uint32_t> order;
+
+    public:
+
+    PostingRun(uint32_t key_length) : key_length(key_length) {}
+
+    void add(const char* key, uint32_t row){
+        keys.insert(keys.end(), key, key + key_length);
+        rows.push_back(row);
+    }
+
+    size_t size() const {
+        return rows.size();
+    }
+
+    // returns -1 if the run would not fit in a 32-bit file
+    int spill(const fs::path& path){
+        order.resize(rows.size());
+        for(uint32_t i = 0; i < order.size(); i++){
+            order[i] = i;
+        }
+        const char* base = keys.data();
+        uint32_t length = key_length;
+        std::sort(order.begin(), order.end(), [base, length](uint32_t a, uint32_t b){
+            int cmp = memcmp(base + (size_t) a * length, base + (size_t) b * length, length);
+            return cmp != 0 ? cmp < 0 : a < b;
+        });
+
+        uint64_t size = DEFAULT_WRITE_IDX + (uint64_t) rows.size() * (key_length + sizeof(uint32_t));
+        if(size > MAX_UINT32)
+            return -1;
+        fs::remove(path);
+        FileWrapper file(path, size);
+        for(uint32_t i : order){
+            file.write(base + (size_t) i * key_length, key_length);
+            file.write(&rows[i], sizeof(uint32_t));
+        }
+        keys.clear();
+        rows.clear();
+        order.clear();
+        return 0;
+    }
+};
+
+// k-way merge of sorted runs: fn(key, rows) once per distinct key, in key order. ties between runs go to the
+// lower run, so if the runs cover increasing row ranges the rows of every key come out ascending
+template <typename Fn>
+void merge_posting_runs(const std::vector<SpilledRun>& runs, uint32_t key_length, Fn fn){
+    std::vector<size_t> cursors(runs.size(), 0);
+    auto after = [&](uint32_t a, uint32_t b){ // priority_queue is a max heap
+        int cmp = memcmp(runs[a].key_at(cursors[a]), runs[b].key_at(cursors[b]), key_length);
+        return cmp != 0 ? cmp > 0 : a > b;
+    };
+    std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(after)> heap(after);
+    for(uint32_t r = 0; r < runs.size(); r++){
+        if(runs[r].size() > 0)
+            heap.push(r);
+    }
+
+    std::vector<char> key(key_length);
+    std::vector<uint32_t> rows;
+    while(!heap.empty()){
+        uint32_t r = heap.top();
+        memcpy(key.data(), runs[r].key_at(cursors[r]), key_length);
+        rows.clear();
+        while(!heap.empty()){
+            r = heap.top();
+            if(memcmp(runs[r].key_at(cursors[r]), key.data(), key_length) != 0)
+                break;
+            heap.pop();
+            // the rest of this run's entries for the key can be taken without going through the heap
+            do {
+                rows.push_back(runs[r].row_at(cursors[r]));
+                cursors[r]++;
+            } while(cursors[r] < runs[r].size() && memcmp(runs[r].key_at(cursors[r]), key.data(), key_length) == 0);
+            if(cursors[r] < runs[r].size())
+                heap.push(r);
+        }
+        fn(key.data(), rows);
+    }
+}
+
+// writes the merged runs to path in InvertedIndex's format: one block per (key, up to (block_size - key_length) / 4
+// rows), blocks sorted by key, unused value slots MAX_UINT32. the file is at least min_size bytes, and larger if the
+// postings need it. the runs are merged twice -- once to size the file, once to fill it -- which is cheap next to
+// tokenizing. returns -1 if the index would not fit in a 32-bit file
+int write_inverted_index(
+    const fs::path& path, uint32_t min_size, uint32_t block_size, uint32_t key_length, const std::vector<SpilledRun>& runs
+){
+    const uint32_t values_per_block = (block_size - key_length) / sizeof(uint32_t);
+    uint64_t num_blocks = 0;
+    merge_posting_runs(runs, key_length, [&](const char* key, const std::vector<uint32_t>& rows){
+        num_blocks += (rows.size() + values_per_block - 1) / values_per_block;
+    });
+    uint64_t size = std::max((uint64_t) min_size, DEFAULT_WRITE_IDX + num_blocks * block_size);
+    if(size > MAX_UINT32)
+        return -1;
+
+    fs::remove(path);
+    FileWrapper file(path, size);
+    std::vector<char> block(block_size);
+    merge_posting_runs(runs, key_length, [&](const char* key, const std::vector<uint32_t>& rows){
+        for(size_t start = 0; start < rows.size(); start += values_per_block){
+            size_t count = std::min((size_t) values_per_block, rows.size() - start);
+            memset(block.data(), 0xff, block_size); // MAX_UINT32 in every slot
+            memcpy(block.data(), key, key_length);
+            memcpy(block.data() + key_length, rows.data() + start, count * sizeof(uint32_t));
+            file.write(block.data(), block_size);
+        }
+    });
+    return 0;
+}
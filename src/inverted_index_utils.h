@@ -42,7 +42,7 @@ std::vector<std::string> get_clean_words(const std::string& value){
     return words;
 }
 
-std::vector<std::string> remove_common_words(std::vector<std::string> words){
+std::vector<std::string> read_common_words(){
     std::vector<std::string> common_words;
     std::ifstream common_words_file(COMMON_WORDS_FN);
 
@@ -50,6 +50,11 @@ std::vector<std::string> remove_common_words(std::vector<std::string> words){
     while(common_words_file >> common_word){
         common_words.push_back(common_word);
     }
+    return common_words;
+}
+
+std::vector<std::string> remove_common_words(std::vector<std::string> words){
+    std::vector<std::string> common_words = read_common_words();
 
     std::vector<std::string> keys;
     for(std::string word : words){
@@ -2,6 +2,9 @@
 #include <pybind11/stl.h>
 
 #include "embedding_store.h"
+#include "sharded_embedding_store.h"
+#include "query_client.h"
+#include "search_cursor.h"
 
 #define STRINGIFY(x) #x
 #define MACRO_STRINGIFY(x) STRINGIFY(x)
@@ -9,27 +12,360 @@
 namespace py = pybind11;
 
 PYBIND11_MODULE(embedding_search, m) {
+    py::enum_<MmapAdvice>(m, "MmapAdvice")
+        .value("normal", MmapAdvice::normal)
+        .value("sequential", MmapAdvice::sequential)
+        .value("random", MmapAdvice::random)
+        .value("willneed", MmapAdvice::willneed)
+        .export_values();
+
+    py::class_<MmapOptions>(m, "MmapOptions")
+        .def(py::init<>())
+        .def_readwrite("read_only", &MmapOptions::read_only)
+        .def_readwrite("advice", &MmapOptions::advice)
+        .def_readwrite("populate", &MmapOptions::populate)
+        .def_readwrite("huge_pages", &MmapOptions::huge_pages);
+
+    py::class_<AnalyzerOptions>(m, "AnalyzerOptions")
+        .def(py::init<>())
+        .def_readwrite("unicode", &AnalyzerOptions::unicode)
+        .def_readwrite("stem", &AnalyzerOptions::stem)
+        .def_readwrite("ngram_size", &AnalyzerOptions::ngram_size);
+
+    py::class_<DiskScanOptions>(m, "DiskScanOptions")
+        .def(py::init<>())
+        .def_readwrite("chunk_bytes", &DiskScanOptions::chunk_bytes)
+        .def_readwrite("queue_depth", &DiskScanOptions::queue_depth)
+        .def_readwrite("direct", &DiskScanOptions::direct)
+        .def_readwrite("use_io_uring", &DiskScanOptions::use_io_uring);
+
+    py::class_<StandingQueryChange>(m, "StandingQueryChange")
+        .def_readonly("query_id", &StandingQueryChange::query_id)
+        .def_readonly("row", &StandingQueryChange::row)
+        .def_readonly("distance", &StandingQueryChange::distance)
+        .def_readonly("entered", &StandingQueryChange::entered);
+
+    py::enum_<ElementType>(m, "ElementType")
+        .value("float32", ElementType::float32)
+        .value("float16", ElementType::float16)
+        .value("bfloat16", ElementType::bfloat16)
+        .export_values();
+
+    py::enum_<NumaPlacement>(m, "NumaPlacement")
+        .value("none", NumaPlacement::none)
+        .value("interleave", NumaPlacement::interleave)
+        .value("partition", NumaPlacement::partition)
+        .export_values();
+
+    py::enum_<Reduction>(m, "Reduction")
+        .value("none", Reduction::none)
+        .value("pca", Reduction::pca)
+        .value("random_projection", Reduction::random_projection)
+        .export_values();
+
+    py::enum_<Aggregation>(m, "Aggregation")
+        .value("max_sim", Aggregation::max_sim)
+        .value("sum", Aggregation::sum)
+        .export_values();
+
     py::class_<EmbeddingStore> embedding_store(m, "EmbeddingStore");
 
-    embedding_store.def(py::init(&EmbeddingStore::create))
+    // registered before the methods below so that it can be used in their default arguments
+    py::enum_<DistanceMetric>(embedding_store, "DistanceMetric")
+        .value("cosine_similarity", DistanceMetric::cosine_similarity)
+        .value("manhattan", DistanceMetric::manhattan)
+        .value("l2_squared", DistanceMetric::l2_squared)
+        .export_values();
+
+    embedding_store.def(
+            py::init(&EmbeddingStore::create),
+            py::arg("dir"), py::arg("embedding_size"),
+            py::arg("max_embedding_store_size") = DEFAULT_MAX_EMBEDDING_STORE_SIZE,
+            py::arg("max_object_store_size") = DEFAULT_MAX_OBJECT_STORE_SIZE,
+            py::arg("hybrid_search_enabled") = false,
+            py::arg("element_type") = ElementType::float32
+        )
         .def("addEmbedding", &EmbeddingStore::add_embedding)
+        .def(
+            "addObject", &EmbeddingStore::add_object,
+            "Store one value with several vectors that all point at it",
+            py::arg("embeddings"), py::arg("value")
+        )
+        .def(
+            "getKClosestDiverse", &EmbeddingStore::get_k_closest_diverse,
+            "Get k of the closest embeddings re-ranked by maximal marginal relevance",
+            py::arg("embedding"), py::arg("k"), py::arg("num_candidates") = 0, py::arg("lambda_") = 0.5,
+            py::arg("num_threads") = 1, py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "addStandingQuery", &EmbeddingStore::add_standing_query,
+            "Register a query whose top-k is kept current as rows are added; returns its id",
+            py::arg("embedding"), py::arg("k"), py::arg("metric") = DistanceMetric::cosine_similarity,
+            py::arg("num_threads") = 1
+        )
+        .def("removeStandingQuery", &EmbeddingStore::remove_standing_query, py::arg("id"))
+        .def("getStandingQueryResults", &EmbeddingStore::get_standing_query_results, py::arg("id"))
+        .def(
+            "takeStandingQueryChanges", &EmbeddingStore::take_standing_query_changes,
+            "Rows that entered or left a standing query's top-k since the last call"
+        )
+        .def("getNumStandingQueries", &EmbeddingStore::get_num_standing_queries)
+        .def(
+            "enableReducedSearch", &EmbeddingStore::enable_reduced_search,
+            "Learn a PCA (or draw a random orthonormal projection) and keep a reduced copy of every row for getKClosestReduced",
+            py::arg("reduced_dims"), py::arg("reduction") = Reduction::pca,
+            py::arg("sample_rows") = REDUCTION_DEFAULT_SAMPLE_ROWS
+        )
+        .def("getReduction", &EmbeddingStore::get_reduction)
+        .def(
+            "getKClosestReduced", &EmbeddingStore::get_k_closest_reduced,
+            "Get k of the closest embeddings: coarse search on the reduced copy, then exact re-rank",
+            py::arg("embedding"), py::arg("k"), py::arg("oversample") = 4, py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "getKClosestDisk", &EmbeddingStore::get_k_closest_disk,
+            "Get the k closest embeddings, streaming the store from disk with io_uring instead of the mmap",
+            py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity, py::arg("options") = DiskScanOptions()
+        )
+        .def(
+            "getKClosestObjects", &EmbeddingStore::get_k_closest_objects,
+            "Get the k best objects, folding each object's rows together (several query vectors give ColBERT-style MaxSim)",
+            py::arg("query_vectors"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity, py::arg("aggregation") = Aggregation::max_sim
+        )
         .def(
             "getKClosest", &EmbeddingStore::get_k_closest,
             "Get the k closest embeddings to the given embedding",
             py::arg("embedding"), py::arg("k"), py::arg("num_threads"), py::arg("metric")
         )
+        .def(
+            "getKClosestRows", &EmbeddingStore::get_k_closest_rows,
+            "Get the (distance, row) of the k closest embeddings without reading their values",
+            py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "getKClosestViews",
+            [](EmbeddingStore& store, std::vector<float> embedding, uint32_t k, uint32_t num_threads, DistanceMetric metric){
+                py::list result;
+                for(auto [distance, row] : store.get_k_closest_rows(embedding, k, num_threads, metric)){
+                    auto view = store.get_value_view(row);
+                    // a memoryview into the mmap (valid while the store is open), or a copy of a compressed value
+                    py::object value = view ? (py::object) py::memoryview::from_memory(view->data(), view->size(), true)
+                        : (py::object) py::bytes(store.get_value(row));
+                    result.append(py::make_tuple(distance, value));
+                }
+                return result;
+            },
+            "get_k_closest with the values as read-only memoryviews into the store instead of copies (bytes for compressed values)",
+            py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
         .def(
             "getKClosestHybridWeighted", &EmbeddingStore::get_k_closest_hybrid_weighted,
             "Get the k closest embeddings to the given embedding using a weighted hybrid distance metric",
             py::arg("search_str"), py::arg("embedding"), py::arg("k"), py::arg("num_threads"), py::arg("metric"), py::arg("keyword_weight")
         )
+        .def(
+            "rebuildInvertedIndex", &EmbeddingStore::rebuild_inverted_index,
+            "Rebuild the inverted and positional indexes from the object store with several threads, creating them if missing",
+            py::arg("num_threads") = 1, py::arg("run_entries") = POSTING_RUN_SPILL_ENTRIES
+        )
+        .def(
+            "setAnalyzer", &EmbeddingStore::set_analyzer,
+            "Set how values and queries are split into keywords; only possible while the store is empty",
+            py::arg("options")
+        )
+        .def("getAnalyzerOptions", &EmbeddingStore::get_analyzer_options)
+        .def(
+            "matchQuery", &EmbeddingStore::match_query,
+            "Row ids whose values match a boolean / phrase query",
+            py::arg("query")
+        )
+        .def(
+            "getKClosestMatching", &EmbeddingStore::get_k_closest_matching,
+            "Get the k closest embeddings among the rows matching a boolean / phrase query",
+            py::arg("query"), py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "getKClosestHybridQuery", &EmbeddingStore::get_k_closest_hybrid_query,
+            "Get the k closest embeddings, blending distance with whether each row matches a boolean / phrase query",
+            py::arg("query"), py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity, py::arg("keyword_weight") = 0.5
+        )
+        .def_static(
+            "openReadOnly", &EmbeddingStore::open_read_only,
+            "Open an existing store without write access so that several processes can share its mmaps",
+            py::arg("dir"), py::arg("embedding_size"), py::arg("hybrid_search_enabled") = false,
+            py::arg("mmap_options") = MmapOptions()
+        )
+        .def(
+            "enableBinaryQuantization", &EmbeddingStore::enable_binary_quantization,
+            "Keep a sign-bit copy of every embedding for a fast hamming first pass (backfills existing rows)"
+        )
+        .def(
+            "getKClosestBinary", &EmbeddingStore::get_k_closest_binary,
+            "Pick k * oversample candidates by hamming distance over the sign bits, then re-rank them exactly",
+            py::arg("embedding"), py::arg("k"), py::arg("oversample") = 4, py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "searchRadius", &EmbeddingStore::search_radius,
+            "Get every embedding within distance r of the given embedding, closest first",
+            py::arg("embedding"), py::arg("r"), py::arg("metric") = DistanceMetric::cosine_similarity,
+            py::arg("max_results") = 0, py::arg("num_threads") = 1
+        )
+        .def(
+            "stats", &EmbeddingStore::stats,
+            "Hot-path counters and latency percentiles (collected when built with EMBEDDING_SEARCH_STATS) plus mmap residency"
+        )
+        .def("resetStats", &EmbeddingStore::reset_stats)
+        .def(
+            "enableQueryCache", &EmbeddingStore::enable_query_cache,
+            "Cache up to capacity search results until the next add; 0 turns the cache off",
+            py::arg("capacity")
+        )
+        .def("queryCacheEnabled", &EmbeddingStore::query_cache_enabled)
+        .def(
+            "enableValueCompression", &EmbeddingStore::enable_value_compression,
+            "Train a dictionary on sample values and compress every value added from now on",
+            py::arg("samples")
+        )
+        .def("valueCompressionEnabled", &EmbeddingStore::value_compression_enabled)
+        .def(
+            "snapshot", &EmbeddingStore::snapshot,
+            "Copy a consistent view of the live store into a new directory that opens like any other store",
+            py::arg("dest_dir")
+        )
+        .def(
+            "exportColumnar", &EmbeddingStore::export_columnar,
+            "Stream the store out as vectors.npy, ids.npy, values.bin and value_offsets.npy (np.load(..., mmap_mode='r') reads them)",
+            py::arg("dest_dir"), py::arg("chunk_bytes") = EXPORT_CHUNK_BYTES
+        )
+        .def(
+            "importColumnar", &EmbeddingStore::import_columnar,
+            "Add every object from a directory laid out like exportColumnar's output (ids.npy is optional)",
+            py::arg("src_dir")
+        )
+        .def(
+            "setNumaPlacement", &EmbeddingStore::set_numa_placement,
+            "Pin scan threads to NUMA nodes and move the embedding pages to match (simulated_nodes > 0 fakes a topology)",
+            py::arg("placement"), py::arg("simulated_nodes") = 0
+        )
+        .def("getNumaPlacement", &EmbeddingStore::get_numa_placement)
+        .def("getEmbedding", &EmbeddingStore::get_embedding, py::arg("idx"))
+        .def("getValue", &EmbeddingStore::get_value, "Raises IndexError for a row that doesn't exist", py::arg("idx"))
+        .def(
+            "getValueView",
+            [](EmbeddingStore& store, uint32_t idx) -> py::object {
+                auto view = store.get_value_view(idx);
+                if(!view)
+                    return py::none();
+                // points into the mmap -- only valid while the store is open
+                return py::memoryview::from_memory(view->data(), view->size(), true);
+            },
+            "Read-only memoryview of an uncompressed value without copying it, or None if it is compressed. Raises IndexError for a row that doesn't exist",
+            py::arg("idx")
+        )
+        .def("getElementType", &EmbeddingStore::get_element_type)
+        .def("warmUp", &EmbeddingStore::warm_up, "Fault in all store pages ahead of the first query")
+        .def("advise", &EmbeddingStore::advise, "Set the madvise access pattern of the embedding store", py::arg("advice"))
         .def("close", &EmbeddingStore::close_store);
 
-    py::enum_<DistanceMetric>(embedding_store, "DistanceMetric")
-        .value("cosine_similarity", DistanceMetric::cosine_similarity)
-        .value("manhattan", DistanceMetric::manhattan)
-        .value("l2_squared", DistanceMetric::l2_squared)
-        .export_values();
+    py::class_<ShardedEmbeddingStore>(m, "ShardedEmbeddingStore")
+        .def(
+            py::init(&ShardedEmbeddingStore::create),
+            py::arg("dir"), py::arg("num_shards"), py::arg("embedding_size"),
+            py::arg("max_embedding_store_size") = DEFAULT_MAX_EMBEDDING_STORE_SIZE,
+            py::arg("max_object_store_size") = DEFAULT_MAX_OBJECT_STORE_SIZE,
+            py::arg("hybrid_search_enabled") = false,
+            py::arg("element_type") = ElementType::float32
+        )
+        .def("addEmbedding", &ShardedEmbeddingStore::add_embedding, py::arg("id"), py::arg("embedding"), py::arg("value"))
+        .def(
+            "addEmbeddings", &ShardedEmbeddingStore::add_embeddings,
+            "Add a batch of rows, writing every shard in parallel",
+            py::arg("ids"), py::arg("embeddings"), py::arg("values")
+        )
+        .def(
+            "getKClosest", &ShardedEmbeddingStore::get_k_closest,
+            "Get the k closest embeddings across all shards, searched concurrently",
+            py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "getKClosestHybridWeighted", &ShardedEmbeddingStore::get_k_closest_hybrid_weighted,
+            py::arg("search_str"), py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity, py::arg("keyword_weight") = 0.5
+        )
+        .def("getNumShards", &ShardedEmbeddingStore::get_num_shards)
+        .def("getShardForId", &ShardedEmbeddingStore::get_shard_for_id, py::arg("id"))
+        .def("resetShard", &ShardedEmbeddingStore::reset_shard, "Empty one shard so it can be rebuilt", py::arg("shard"))
+        .def("snapshot", &ShardedEmbeddingStore::snapshot, py::arg("dest_dir"))
+        .def("close", &ShardedEmbeddingStore::close_store);
+
+    // for page in store.searchPages(query, 20): ...
+    py::class_<SearchCursor>(m, "SearchCursor")
+        .def(
+            py::init<EmbeddingStore&, std::vector<float>, uint32_t, uint32_t, DistanceMetric, uint32_t>(),
+            py::keep_alive<1, 2>(),
+            py::arg("store"), py::arg("embedding"), py::arg("page_size"), py::arg("num_threads") = 1,
+            py::arg("metric") = DistanceMetric::cosine_similarity, py::arg("window_pages") = DEFAULT_CURSOR_WINDOW_PAGES
+        )
+        .def("nextPage", &SearchCursor::next_page)
+        .def("hasNext", &SearchCursor::has_next)
+        .def("__iter__", [](SearchCursor& cursor) -> SearchCursor& { return cursor; }, py::return_value_policy::reference_internal)
+        .def("__next__", [](SearchCursor& cursor){
+            auto page = cursor.next_page();
+            if(page.empty())
+                throw py::stop_iteration();
+            return page;
+        });
+
+    embedding_store.def(
+        "searchPages",
+        [](EmbeddingStore& store, std::vector<float> embedding, uint32_t page_size, uint32_t num_threads, DistanceMetric metric){
+            return SearchCursor(store, embedding, page_size, num_threads, metric);
+        },
+        "Iterate over the results of a search one page at a time",
+        py::keep_alive<0, 1>(),
+        py::arg("embedding"), py::arg("page_size"), py::arg("num_threads") = 1,
+        py::arg("metric") = DistanceMetric::cosine_similarity
+    );
+
+    // thin client for embedding_search_server; every method is one round trip over the unix socket
+    py::class_<QueryClient>(m, "QueryClient")
+        .def(py::init<const std::string&>(), py::arg("socket_path") = std::string(DEFAULT_SOCKET_PATH))
+        .def("ping", &QueryClient::ping)
+        .def("getNumEmbeddings", &QueryClient::get_num_embeddings)
+        .def("addEmbedding", &QueryClient::add_embedding, py::arg("embedding"), py::arg("value"))
+        .def("addEmbeddings", &QueryClient::add_embeddings, py::arg("embeddings"), py::arg("values"))
+        .def(
+            "getKClosest", &QueryClient::get_k_closest,
+            py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 0,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "getKClosestBatch", &QueryClient::get_k_closest_batch,
+            "Run a batch of queries in a single request",
+            py::arg("embeddings"), py::arg("k"), py::arg("num_threads") = 0,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "getKClosestPipelined", &QueryClient::get_k_closest_pipelined,
+            "Send the queries as several batches without waiting for each answer",
+            py::arg("embeddings"), py::arg("k"), py::arg("batch_size"), py::arg("num_threads") = 0,
+            py::arg("metric") = DistanceMetric::cosine_similarity
+        )
+        .def(
+            "getKClosestHybridWeighted", &QueryClient::get_k_closest_hybrid_weighted,
+            py::arg("search_str"), py::arg("embedding"), py::arg("k"), py::arg("num_threads") = 0,
+            py::arg("metric") = DistanceMetric::cosine_similarity, py::arg("keyword_weight") = 0.5
+        )
+        .def("close", &QueryClient::close_connection);
 
 #ifdef VERSION_INFO
     m.attr("__version__") = MACRO_STRINGIFY(VERSION_INFO);
@@ -0,0 +1,166 @@
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <utility>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// numpy's .npy format, the subset we read and write: little-endian, C order, any number of dimensions.
+//
+//   ["\x93NUMPY"][u8 major][u8 minor][u16 (v1) or u32 (v2, v3) header length][python dict literal header][data]
+//
+// the header is padded with spaces and a newline so the data starts 64-byte aligned, which makes the data
+// directly usable through a mapping -- np.load(path, mmap_mode="r") on our output, and the same for us on numpy's
+const char NPY_MAGIC[] = "\x93NUMPY";
+const uint32_t NPY_MAGIC_SIZE = 6;
+const uint32_t NPY_ALIGNMENT = 64;
+
+struct NpyArray {
+    std::string descr;          // e.g. "<f4"
+    std::vector<uint64_t> shape;
+    size_t data_offset = 0;     // from the start of the file
+
+    uint64_t num_elements() const {
+        uint64_t n = 1;
+        for(uint64_t d : shape){
+            n *= d;
+        }
+        return n;
+    }
+};
+
+std::string npy_header(const std::string& descr, const std::vector<uint64_t>& shape){
+    std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (";
+    for(size_t i = 0; i < shape.size(); i++){
+        dict += std::to_string(shape[i]) + (shape.size() == 1 || i + 1 < shape.size() ? "," : "");
+        if(i + 1 < shape.size())
+            dict += " ";
+    }
+    dict += "), }";
+
+    // version 1.0 while the header fits a u16, as numpy does
+    bool v1 = dict.size() + NPY_ALIGNMENT < 0xffff;
+    size_t prefix = NPY_MAGIC_SIZE + 2 + (v1 ? 2 : 4);
+    size_t total = (prefix + dict.size() + 1 + NPY_ALIGNMENT - 1) / NPY_ALIGNMENT * NPY_ALIGNMENT;
+    dict.append(total - prefix - dict.size() - 1, ' ');
+    dict.push_back('\n');
+
+    std::string header(NPY_MAGIC, NPY_MAGIC_SIZE);
+    header.push_back(v1 ? 1 : 2);
+    header.push_back(0);
+    uint32_t length = dict.size();
+    header.append((const char*) &length, v1 ? 2 : 4);
+    return header + dict;
+}
+
+// false for anything we can't map directly: a bad magic, fortran order, or a truncated file
+bool parse_npy_header(const char* data, size_t size, NpyArray& out){
+    if(size < NPY_MAGIC_SIZE + 4 || memcmp(data, NPY_MAGIC, NPY_MAGIC_SIZE) != 0)
+        return false;
+    uint8_t major = data[NPY_MAGIC_SIZE];
+    size_t length_size = major == 1 ? 2 : 4;
+    if(major < 1 || major > 3 || size < NPY_MAGIC_SIZE + 2 + length_size)
+        return false;
+    uint32_t length = 0;
+    memcpy(&length, data + NPY_MAGIC_SIZE + 2, length_size);
+    size_t start = NPY_MAGIC_SIZE + 2 + length_size;
+    if(start + length > size)
+        return false;
+    std::string dict(data + start, length);
+
+    size_t descr = dict.find("'descr'");
+    size_t fortran = dict.find("'fortran_order'");
+    size_t shape = dict.find("'shape'");
+    if(descr == std::string::npos || fortran == std::string::npos || shape == std::string::npos)
+        return false;
+
+    size_t quote = dict.find('\'', dict.find(':', descr) + 1);
+    size_t quote_end = dict.find('\'', quote + 1);
+    if(quote == std::string::npos || quote_end == std::string::npos)
+        return false;
+    out.descr = dict.substr(quote + 1, quote_end - quote - 1);
+
+    size_t fortran_value = dict.find_first_not_of(" ", dict.find(':', fortran) + 1);
+    if(fortran_value == std::string::npos || dict.compare(fortran_value, 5, "False") != 0)
+        return false;
+
+    size_t open = dict.find('(', shape);
+    size_t close = dict.find(')', open);
+    if(open == std::string::npos || close == std::string::npos)
+        return false;
+    out.shape.clear();
+    const char* p = dict.c_str() + open + 1;
+    const char* end = dict.c_str() + close;
+    while(p < end){
+        char* next;
+        uint64_t d = strtoull(p, &next, 10);
+        if(next == p){
+            p++; // ", " between dimensions
+            continue;
+        }
+        out.shape.push_back(d);
+        p = next;
+    }
+    out.data_offset = start + length;
+
+    size_t element_size = out.descr.size() >= 3 ? atoi(out.descr.c_str() + 2) : 0;
+    return element_size > 0 && out.data_offset + out.num_elements() * element_size <= size;
+}
+
+// a whole file mapped read-only for one sequential pass
+class MappedFile {
+    private:
+    int fd = -1;
+    char* addr = nullptr;
+    size_t length = 0;
+
+    public:
+
+    MappedFile(const fs::path& path){
+        fd = open(path.c_str(), O_RDONLY);
+        if(fd == -1)
+            return;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0)
+            return;
+        length = st.st_size;
+        void* mapped = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+        if(mapped == MAP_FAILED){
+            length = 0;
+            return;
+        }
+        addr = (char*) mapped;
+        madvise(addr, length, MADV_SEQUENTIAL);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile(){
+        if(addr)
+            munmap(addr, length);
+        if(fd != -1)
+            close(fd);
+    }
+
+    // an empty file opens fine but has no data
+    bool is_open() const {
+        return fd != -1;
+    }
+
+    const char* data() const {
+        return addr;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
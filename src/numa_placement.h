@@ -0,0 +1,201 @@
+#pragma once
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+// NUMA placement for the embedding mmap, with raw syscalls so there is no libnuma dependency.
+//
+// mbind() can't do this job: its policy is ignored for MAP_SHARED file mappings, whose page cache pages are
+// allocated by the policy of whichever thread faults them. so placement here is page migration (move_pages) of
+// the resident pages, plus pinning every scan worker to the node that holds its rows -- new pages faulted by a
+// pinned worker land on its node anyway
+enum class NumaPlacement {
+    none,       // threads float, pages stay where they were first touched
+    interleave, // pages round-robin across nodes, workers spread round-robin -- even bandwidth, no locality
+    partition   // the rows split into one contiguous part per node, each worker pinned to the node of its rows
+};
+
+const uint32_t NUMA_MOVE_PAGES_BATCH = 4096;
+const int NUMA_MPOL_MF_MOVE = 1 << 1; // MPOL_MF_MOVE in numaif.h
+
+// "0-3,8,10-11" (the kernel's cpulist format) -> {0, 1, 2, 3, 8, 10, 11}
+std::vector<int> parse_cpu_list(const std::string& list){
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while(pos < list.size()){
+        size_t comma = list.find(',', pos);
+        std::string range = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; cpu++){
+                cpus.push_back(cpu);
+            }
+        } catch(const std::exception&) {} // blank or trailing newline
+        if(comma == std::string::npos)
+            break;
+        pos = comma + 1;
+    }
+    return cpus;
+}
+
+struct NumaTopology {
+    std::vector<int> node_ids;                 // as the kernel numbers them
+    std::vector<std::vector<int>> node_cpus;   // cpus of each node, same order
+    bool simulated = false;                    // cpu groups only -- no real nodes to move pages to
+
+    uint32_t num_nodes() const {
+        return node_ids.size();
+    }
+
+    // the nodes in /sys/devices/system/node that have cpus we may run on. one node with every cpu when there is no
+    // NUMA support at all
+    static NumaTopology detect(){
+        NumaTopology topology;
+        std::vector<int> allowed = allowed_cpus();
+        std::error_code ec;
+        for(const auto& entry : fs::directory_iterator("/sys/devices/system/node", ec)){
+            std::string name = entry.path().filename();
+            if(name.rfind("node", 0) != 0 || name.size() == 4 || !isdigit(name[4]))
+                continue;
+            std::ifstream file(entry.path() / "cpulist");
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus;
+            for(int cpu : parse_cpu_list(list)){
+                if(std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                    cpus.push_back(cpu);
+            }
+            if(!cpus.empty()){
+                topology.node_ids.push_back(std::stoi(name.substr(4)));
+                topology.node_cpus.push_back(cpus);
+            }
+        }
+        // directory order is arbitrary
+        std::vector<size_t> order(topology.node_ids.size());
+        for(size_t i = 0; i < order.size(); i++){
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b){ return topology.node_ids[a] < topology.node_ids[b]; });
+        NumaTopology sorted;
+        for(size_t i : order){
+            sorted.node_ids.push_back(topology.node_ids[i]);
+            sorted.node_cpus.push_back(topology.node_cpus[i]);
+        }
+        if(sorted.node_ids.empty()){
+            sorted.node_ids = {0};
+            sorted.node_cpus = {allowed};
+        }
+        return sorted;
+    }
+
+    // the allowed cpus split into num_nodes equal groups, to exercise the pinning on a single-socket machine
+    static NumaTopology simulate(uint32_t num_nodes){
+        NumaTopology topology;
+        topology.simulated = true;
+        std::vector<int> cpus = allowed_cpus();
+        num_nodes = std::max(1u, num_nodes);
+        for(uint32_t n = 0; n < num_nodes; n++){
+            size_t first = cpus.size() * n / num_nodes;
+            size_t last = cpus.size() * (n + 1) / num_nodes;
+            if(first == last){ // more nodes than cpus -- groups share
+                first = n % cpus.size();
+                last = first + 1;
+            }
+            topology.node_ids.push_back(n);
+            topology.node_cpus.push_back(std::vector<int>(cpus.begin() + first, cpus.begin() + last));
+        }
+        return topology;
+    }
+
+    static std::vector<int> allowed_cpus(){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        std::vector<int> cpus;
+        if(sched_getaffinity(0, sizeof(set), &set) == 0){
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+                if(CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+            }
+        }
+        if(cpus.empty())
+            cpus.push_back(0);
+        return cpus;
+    }
+};
+
+// restricts the calling thread to cpus, restoring its previous mask when destroyed -- the thread that calls
+// into the store scans a range too, and must not stay pinned afterwards
+class ThreadPin {
+    private:
+    cpu_set_t previous;
+    bool pinned = false;
+
+    public:
+
+    ThreadPin(const std::vector<int>& cpus){
+        if(cpus.empty() || sched_getaffinity(0, sizeof(previous), &previous) != 0)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : cpus){
+            CPU_SET(cpu, &set);
+        }
+        pinned = sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+
+    ThreadPin(const ThreadPin&) = delete;
+    ThreadPin& operator=(const ThreadPin&) = delete;
+
+    ~ThreadPin(){
+        if(pinned)
+            sched_setaffinity(0, sizeof(previous), &previous);
+    }
+
+    bool is_pinned() const {
+        return pinned;
+    }
+};
+
+// moves the resident pages of [addr, addr + length) to node_of(page index) in batches. pages that are not
+// resident are skipped -- fault them in first. returns the number of pages moved, or -1 if the kernel refused
+// (no NUMA support, or not allowed to migrate)
+template <typename NodeFn>
+int64_t move_pages_to_nodes(char* addr, size_t length, NodeFn node_of){
+    long page_size = sysconf(_SC_PAGESIZE);
+    char* first = (char*) ((uintptr_t) addr / page_size * page_size);
+    size_t num_pages = (addr + length - first + page_size - 1) / page_size;
+
+    std::vector<void*> pages;
+    std::vector<int> nodes;
+    std::vector<int> status;
+    int64_t moved = 0;
+    for(size_t start = 0; start < num_pages; start += NUMA_MOVE_PAGES_BATCH){
+        size_t count = std::min((size_t) NUMA_MOVE_PAGES_BATCH, num_pages - start);
+        pages.resize(count);
+        nodes.resize(count);
+        status.assign(count, 0);
+        for(size_t i = 0; i < count; i++){
+            pages[i] = first + (start + i) * page_size;
+            nodes[i] = node_of(start + i);
+        }
+        long rc = syscall(SYS_move_pages, 0, count, pages.data(), nodes.data(), status.data(), NUMA_MPOL_MF_MOVE);
+        if(rc < 0)
+            return -1;
+        for(size_t i = 0; i < count; i++){
+            if(status[i] == nodes[i])
+                moved++;
+        }
+    }
+    return moved;
+}
@@ -0,0 +1,600 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+
+#include "file_wrapper.h"
+#include "constants.h"
+#include "analyzer.h"
+
+namespace fs = std::filesystem;
+
+// every POSTING_SKIP_INTERVAL-th doc of a posting list is copied into its skip list
+const uint32_t POSTING_SKIP_INTERVAL = 64;
+// the log is sized off the object store: a term and its positions take about as many bytes as the text they index
+const uint32_t POSITIONAL_INDEX_SIZE_FACTOR = 4;
+
+// the first i >= from with values[i] >= target, or values.size(). probes from, from + 1, from + 3, from + 7, ...
+// and binary searches the last gap, so a target close to from costs a few compares no matter how long the list is
+size_t gallop_to(const std::vector<uint32_t>& values, size_t from, uint32_t target){
+    if(from >= values.size())
+        return from;
+    size_t lo = from;
+    size_t probe = from;
+    size_t step = 1;
+    while(probe < values.size() && values[probe] < target){
+        lo = probe + 1;
+        probe = from + step;
+        step *= 2;
+    }
+    size_t hi = std::min(values.size(), probe + 1);
+    return std::lower_bound(values.begin() + lo, values.begin() + std::max(lo, hi), target) - values.begin();
+}
+
+// docs containing one term, ascending, each with the word positions of the term in that doc
+struct PostingList {
+    std::vector<uint32_t> docs;
+    std::vector<uint32_t> position_starts = {0}; // positions of docs[i] are [position_starts[i], position_starts[i + 1])
+    std::vector<uint32_t> positions;
+    std::vector<uint32_t> skips; // docs[0], docs[POSTING_SKIP_INTERVAL], docs[2 * POSTING_SKIP_INTERVAL], ...
+
+    void append(uint32_t doc, const std::vector<uint32_t>& doc_positions){
+        if(docs.size() % POSTING_SKIP_INTERVAL == 0)
+            skips.push_back(doc);
+        docs.push_back(doc);
+        positions.insert(positions.end(), doc_positions.begin(), doc_positions.end());
+        position_starts.push_back(positions.size());
+    }
+
+    // the first i >= from with docs[i] >= target. gallops over the skip list to find the block, then binary
+    // searches inside it -- a long list is never walked doc by doc
+    size_t seek(size_t from, uint32_t target) const {
+        if(from >= docs.size() || docs[from] >= target)
+            return from;
+        size_t block = gallop_to(skips, from / POSTING_SKIP_INTERVAL + 1, target);
+        size_t lo = std::max(from, (block - 1) * POSTING_SKIP_INTERVAL);
+        size_t hi = std::min(docs.size(), block * POSTING_SKIP_INTERVAL + 1);
+        return std::lower_bound(docs.begin() + lo, docs.begin() + hi, target) - docs.begin();
+    }
+
+    const uint32_t* positions_begin(size_t i) const {
+        return positions.data() + position_starts[i];
+    }
+
+    const uint32_t* positions_end(size_t i) const {
+        return positions.data() + position_starts[i + 1];
+    }
+};
+
+// a sorted doc list the evaluator can seek in -- either a term's postings, which brings its skip list along, or
+// an intermediate result
+struct DocList {
+    const PostingList* postings = nullptr;
+    std::vector<uint32_t> owned;
+
+    const std::vector<uint32_t>& docs() const {
+        return postings ? postings->docs : owned;
+    }
+
+    size_t seek(size_t from, uint32_t target) const {
+        return postings ? postings->seek(from, target) : gallop_to(owned, from, target);
+    }
+};
+
+// docs in every list. the shortest list leads; every other list is sought to the lead's doc, and a miss lets the
+// lead leap to the doc it was overshot to, so the work is bounded by the shortest list, not the longest
+std::vector<uint32_t> intersect_doc_lists(std::vector<DocList>& lists){
+    std::vector<uint32_t> result;
+    if(lists.empty())
+        return result;
+    std::sort(lists.begin(), lists.end(), [](const DocList& a, const DocList& b){
+        return a.docs().size() < b.docs().size();
+    });
+
+    std::vector<size_t> cursors(lists.size(), 0);
+    const std::vector<uint32_t>& lead = lists[0].docs();
+    size_t i = 0;
+    while(i < lead.size()){
+        uint32_t doc = lead[i];
+        bool match = true;
+        for(size_t j = 1; j < lists.size(); j++){
+            cursors[j] = lists[j].seek(cursors[j], doc);
+            if(cursors[j] == lists[j].docs().size())
+                return result;
+            uint32_t found = lists[j].docs()[cursors[j]];
+            if(found != doc){
+                i = lists[0].seek(i + 1, found);
+                match = false;
+                break;
+            }
+        }
+        if(match){
+            result.push_back(doc);
+            i++;
+        }
+    }
+    return result;
+}
+
+enum class QueryNodeType {
+    nothing, // only common words -- matches nothing and is dropped from AND / OR
+    term,
+    phrase,  // terms at consecutive word positions; offsets keep the gaps left by common words
+    and_op,
+    or_op,
+    not_op
+};
+
+struct QueryNode {
+    QueryNodeType type = QueryNodeType::nothing;
+    std::vector<std::string> terms;
+    std::vector<uint32_t> offsets;
+    std::vector<QueryNode> children;
+};
+
+// query syntax, lucene-like:
+//
+//   cat dog            both (AND is implicit)
+//   cat AND dog        both
+//   cat OR dog         either
+//   NOT cat, -cat      not cat; "+cat" is accepted and means cat
+//   "harry potter"     the phrase
+//   (cat OR dog) -fish grouping
+//
+// operators must be upper case. words go through the store's analyzer, like indexed values, so common words are
+// ignored and stemming / folding apply to queries too; n-grams are not used. the parser never fails: an unbalanced parenthesis or a dangling operator is dropped
+class BooleanQueryParser {
+    private:
+    enum class TokenType { word, phrase, open, close, and_op, or_op, not_op };
+
+    struct Token {
+        TokenType type;
+        std::string text;
+    };
+
+    const Analyzer& analyzer;
+    std::vector<Token> tokens;
+    size_t pos = 0;
+
+    void tokenize(const std::string& query){
+        size_t i = 0;
+        while(i < query.size()){
+            char c = query[i];
+            if(std::isspace((unsigned char) c)){
+                i++;
+            }else if(c == '(' || c == ')'){
+                tokens.push_back(Token{c == '(' ? TokenType::open : TokenType::close, ""});
+                i++;
+            }else if(c == '"'){
+                size_t end = query.find('"', i + 1);
+                if(end == std::string::npos)
+                    end = query.size();
+                tokens.push_back(Token{TokenType::phrase, query.substr(i + 1, end - i - 1)});
+                i = end + 1;
+            }else if((c == '-' || c == '+') && i + 1 < query.size() && !std::isspace((unsigned char) query[i + 1])){
+                if(c == '-')
+                    tokens.push_back(Token{TokenType::not_op, ""});
+                i++;
+            }else{
+                size_t end = i;
+                while(end < query.size() && !std::isspace((unsigned char) query[end]) &&
+                    query[end] != '(' && query[end] != ')' && query[end] != '"'){
+                    end++;
+                }
+                std::string word = query.substr(i, end - i);
+                if(word == "AND"){
+                    tokens.push_back(Token{TokenType::and_op, ""});
+                }else if(word == "OR"){
+                    tokens.push_back(Token{TokenType::or_op, ""});
+                }else if(word == "NOT"){
+                    tokens.push_back(Token{TokenType::not_op, ""});
+                }else{
+                    tokens.push_back(Token{TokenType::word, word});
+                }
+                i = end;
+            }
+        }
+    }
+
+    bool peek(TokenType type){
+        return pos < tokens.size() && tokens[pos].type == type;
+    }
+
+    // drops nothing children and collapses a single child into its parent
+    static QueryNode make_group(QueryNodeType type, std::vector<QueryNode> children){
+        QueryNode node;
+        for(QueryNode& child : children){
+            if(child.type != QueryNodeType::nothing)
+                node.children.push_back(std::move(child));
+        }
+        if(node.children.empty())
+            return QueryNode();
+        if(node.children.size() == 1)
+            return std::move(node.children[0]);
+        node.type = type;
+        return node;
+    }
+
+    QueryNode make_phrase(const std::string& text){
+        QueryNode node;
+        analyzer.analyze(text, [&node](std::string_view token, uint32_t position, bool is_ngram){
+            if(is_ngram)
+                return;
+            node.terms.emplace_back(token);
+            node.offsets.push_back(position);
+        });
+        if(node.terms.size() == 1){
+            node.type = QueryNodeType::term;
+        }else if(node.terms.size() > 1){
+            node.type = QueryNodeType::phrase;
+        }
+        return node;
+    }
+
+    QueryNode parse_unary(){
+        if(pos >= tokens.size())
+            return QueryNode();
+        Token token = tokens[pos++];
+        switch(token.type){
+            case TokenType::not_op: {
+                QueryNode child = parse_unary();
+                if(child.type == QueryNodeType::nothing)
+                    return child;
+                QueryNode node;
+                node.type = QueryNodeType::not_op;
+                node.children.push_back(std::move(child));
+                return node;
+            }
+            case TokenType::open: {
+                QueryNode node = parse_or();
+                if(peek(TokenType::close))
+                    pos++;
+                return node;
+            }
+            case TokenType::word:
+            case TokenType::phrase:
+                return make_phrase(token.text);
+            default:
+                return QueryNode(); // a dangling AND / OR
+        }
+    }
+
+    QueryNode parse_and(){
+        std::vector<QueryNode> children;
+        while(pos < tokens.size() && !peek(TokenType::close) && !peek(TokenType::or_op)){
+            if(peek(TokenType::and_op)){
+                pos++;
+                continue;
+            }
+            children.push_back(parse_unary());
+        }
+        return make_group(QueryNodeType::and_op, std::move(children));
+    }
+
+    QueryNode parse_or(){
+        std::vector<QueryNode> children = {parse_and()};
+        while(peek(TokenType::or_op)){
+            pos++;
+            children.push_back(parse_and());
+        }
+        return make_group(QueryNodeType::or_op, std::move(children));
+    }
+
+    public:
+
+    BooleanQueryParser(const Analyzer& analyzer) : analyzer(analyzer) {}
+
+    QueryNode parse(const std::string& query){
+        tokens.clear();
+        pos = 0;
+        tokenize(query);
+
+        // a stray ')' ends parse_or early -- skip it and AND whatever follows
+        std::vector<QueryNode> parts;
+        while(pos < tokens.size()){
+            parts.push_back(parse_or());
+            if(peek(TokenType::close))
+                pos++;
+        }
+        return make_group(QueryNodeType::and_op, std::move(parts));
+    }
+};
+
+// word-level positional postings for every value in the store, for boolean and phrase queries. a doc is one
+// object (one value); since rows are only appended, docs are numbered in insertion order and every posting list
+// stays sorted without any work. the postings live in memory and are rebuilt on open from positional_index.bin,
+// an append-only log of
+//
+//   [u32 first row][u32 num rows][u32 num terms]([u32 term length][term][u32 num positions][u32 positions...])*
+//
+// one record per doc. if the log fills up the index keeps going in memory only; the rows past the end of the
+// log are indexed again from the object store on the next open (see EmbeddingStore)
+class PositionalIndex {
+    private:
+    FileWrapper log;
+    bool logging = false; // false once the log is full or read-only -- a record is never written after a missing one
+
+    std::unordered_map<std::string, PostingList> postings;
+    std::vector<uint32_t> doc_first_rows;
+    uint32_t num_rows = 0; // rows covered so far; the next doc must start here
+
+    using Terms = std::map<std::string, std::vector<uint32_t>, std::less<>>; // looked up by string_view
+
+    void apply(uint32_t first_row, uint32_t doc_num_rows, const Terms& terms){
+        uint32_t doc = doc_first_rows.size();
+        for(const auto& [term, term_positions] : terms){
+            postings[term].append(doc, term_positions);
+        }
+        doc_first_rows.push_back(first_row);
+        num_rows = first_row + doc_num_rows;
+    }
+
+    static void put_u32(std::string& out, uint32_t v){
+        out.append((const char*) &v, sizeof(uint32_t));
+    }
+
+    static Terms analyze_doc(std::string_view value, const Analyzer& analyzer){
+        Terms terms;
+        analyzer.analyze(value, [&terms](std::string_view token, uint32_t position, bool is_ngram){
+            if(is_ngram)
+                return;
+            auto it = terms.find(token); // only a term new to the doc is copied
+            if(it == terms.end())
+                it = terms.emplace(token, std::vector<uint32_t>()).first;
+            it->second.push_back(position);
+        });
+        return terms;
+    }
+
+    static std::string encode_record(uint32_t first_row, uint32_t doc_num_rows, const Terms& terms){
+        std::string record;
+        put_u32(record, first_row);
+        put_u32(record, doc_num_rows);
+        put_u32(record, terms.size());
+        for(const auto& [term, term_positions] : terms){
+            put_u32(record, term.size());
+            record.append(term);
+            put_u32(record, term_positions.size());
+            record.append((const char*) term_positions.data(), term_positions.size() * sizeof(uint32_t));
+        }
+        return record;
+    }
+
+    // stops at the first record that is cut short or doesn't continue where the last one ended
+    void replay(){
+        const char* data = log.get_start_addr();
+        size_t size = log.write_idx - DEFAULT_WRITE_IDX;
+        size_t pos = 0;
+        auto get_u32 = [&](uint32_t& v){
+            if(pos + sizeof(uint32_t) > size)
+                return false;
+            memcpy(&v, data + pos, sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+            return true;
+        };
+
+        while(pos < size){
+            uint32_t first_row, doc_num_rows, num_terms;
+            if(!get_u32(first_row) || !get_u32(doc_num_rows) || !get_u32(num_terms) || first_row != num_rows)
+                break;
+            Terms terms;
+            bool ok = true;
+            for(uint32_t t = 0; t < num_terms && ok; t++){
+                uint32_t length, num_positions;
+                ok = get_u32(length) && pos + length <= size;
+                if(!ok)
+                    break;
+                std::string term(data + pos, length);
+                pos += length;
+                ok = get_u32(num_positions) && pos + (size_t) num_positions * sizeof(uint32_t) <= size;
+                if(!ok)
+                    break;
+                std::vector<uint32_t>& term_positions = terms[term];
+                term_positions.resize(num_positions);
+                memcpy(term_positions.data(), data + pos, num_positions * sizeof(uint32_t));
+                pos += num_positions * sizeof(uint32_t);
+            }
+            if(!ok)
+                break;
+            apply(first_row, doc_num_rows, terms);
+        }
+        logging = logging && pos == size;
+    }
+
+    std::vector<uint32_t> all_docs(){
+        std::vector<uint32_t> docs(doc_first_rows.size());
+        for(uint32_t i = 0; i < docs.size(); i++){
+            docs[i] = i;
+        }
+        return docs;
+    }
+
+    DocList doc_list(const QueryNode& node){
+        DocList list;
+        if(node.type == QueryNodeType::term){
+            auto it = postings.find(node.terms[0]);
+            if(it != postings.end()){
+                list.postings = &it->second;
+            }
+        }else{
+            list.owned = evaluate(node);
+        }
+        return list;
+    }
+
+    std::vector<uint32_t> match_phrase(const QueryNode& node){
+        std::vector<const PostingList*> lists;
+        std::vector<DocList> doc_lists;
+        for(const std::string& term : node.terms){
+            auto it = postings.find(term);
+            if(it == postings.end())
+                return {};
+            lists.push_back(&it->second);
+            doc_lists.push_back(DocList{&it->second, {}});
+        }
+
+        std::vector<uint32_t> result;
+        std::vector<size_t> cursors(lists.size(), 0);
+        for(uint32_t doc : intersect_doc_lists(doc_lists)){
+            for(size_t j = 0; j < lists.size(); j++){
+                cursors[j] = lists[j]->seek(cursors[j], doc);
+            }
+            // every position of the first term is a candidate start
+            const uint32_t* first = lists[0]->positions_begin(cursors[0]);
+            const uint32_t* first_end = lists[0]->positions_end(cursors[0]);
+            for(; first != first_end; first++){
+                bool match = true;
+                for(size_t j = 1; j < lists.size() && match; j++){
+                    uint32_t expected = *first + node.offsets[j] - node.offsets[0];
+                    match = std::binary_search(lists[j]->positions_begin(cursors[j]), lists[j]->positions_end(cursors[j]), expected);
+                }
+                if(match){
+                    result.push_back(doc);
+                    break;
+                }
+            }
+        }
+        return result;
+    }
+
+    // matching doc ids, ascending
+    std::vector<uint32_t> evaluate(const QueryNode& node){
+        switch(node.type){
+            case QueryNodeType::nothing:
+                return {};
+            case QueryNodeType::term: {
+                auto it = postings.find(node.terms[0]);
+                return it == postings.end() ? std::vector<uint32_t>() : it->second.docs;
+            }
+            case QueryNodeType::phrase:
+                return match_phrase(node);
+            case QueryNodeType::or_op: {
+                std::vector<uint32_t> result;
+                for(const QueryNode& child : node.children){
+                    std::vector<uint32_t> docs = evaluate(child);
+                    std::vector<uint32_t> merged;
+                    std::set_union(result.begin(), result.end(), docs.begin(), docs.end(), std::back_inserter(merged));
+                    result.swap(merged);
+                }
+                return result;
+            }
+            case QueryNodeType::not_op: {
+                std::vector<uint32_t> all = all_docs();
+                std::vector<uint32_t> excluded = evaluate(node.children[0]);
+                std::vector<uint32_t> result;
+                std::set_difference(all.begin(), all.end(), excluded.begin(), excluded.end(), std::back_inserter(result));
+                return result;
+            }
+            case QueryNodeType::and_op: {
+                // intersect the positive children, then seek each survivor in the excluded ones
+                std::vector<DocList> required;
+                std::vector<DocList> excluded;
+                for(const QueryNode& child : node.children){
+                    if(child.type == QueryNodeType::not_op){
+                        excluded.push_back(doc_list(child.children[0]));
+                    }else{
+                        required.push_back(doc_list(child));
+                    }
+                }
+                std::vector<uint32_t> candidates = required.empty() ? all_docs() : intersect_doc_lists(required);
+
+                std::vector<size_t> cursors(excluded.size(), 0);
+                std::vector<uint32_t> result;
+                for(uint32_t doc : candidates){
+                    bool keep = true;
+                    for(size_t j = 0; j < excluded.size() && keep; j++){
+                        cursors[j] = excluded[j].seek(cursors[j], doc);
+                        keep = cursors[j] == excluded[j].docs().size() || excluded[j].docs()[cursors[j]] != doc;
+                    }
+                    if(keep)
+                        result.push_back(doc);
+                }
+                return result;
+            }
+        }
+        return {};
+    }
+
+    public:
+
+    PositionalIndex(const char* dir, uint32_t max_size, const MmapOptions& mmap_options = MmapOptions()){
+        fs::path path = fs::path(dir) / POSITIONAL_INDEX_FN;
+        // a read-only store from before this index existed has no log -- it is indexed in memory on open
+        if(mmap_options.read_only && !fs::exists(path))
+            return;
+        log = FileWrapper(path, max_size, mmap_options);
+        logging = !mmap_options.read_only;
+        replay();
+    }
+
+    FileWrapper& get_file(){
+        return log;
+    }
+
+    // rows [0, get_num_rows()) are indexed
+    uint32_t get_num_rows(){
+        return num_rows;
+    }
+
+    uint32_t get_num_docs(){
+        return doc_first_rows.size();
+    }
+
+    uint32_t get_num_terms(){
+        return postings.size();
+    }
+
+    // indexes value as the doc covering rows [first_row, first_row + doc_num_rows). returns -1 if first_row doesn't
+    // continue the index, -2 if the doc was indexed in memory but didn't fit in the log
+    int insert(uint32_t first_row, uint32_t doc_num_rows, const std::string& value, const Analyzer& analyzer){
+        if(first_row != num_rows)
+            return -1;
+
+        Terms terms = analyze_doc(value, analyzer);
+
+        int code = 0;
+        if(logging){
+            std::string record = encode_record(first_row, doc_num_rows, terms);
+            if(log.write(record.data(), record.size()) != 0){
+                logging = false;
+                code = -2;
+            }
+        }else if(log.mmap_addr && !log.read_only){
+            code = -2;
+        }
+
+        apply(first_row, doc_num_rows, terms);
+        return code;
+    }
+
+    // the log record insert would write for a doc, so a log can be built without going through insert
+    static std::string make_record(uint32_t first_row, uint32_t doc_num_rows, std::string_view value, const Analyzer& analyzer){
+        return encode_record(first_row, doc_num_rows, analyze_doc(value, analyzer));
+    }
+
+    // doc ids matching a query in BooleanQueryParser syntax, ascending
+    std::vector<uint32_t> match(const std::string& query, const Analyzer& analyzer){
+        return evaluate(BooleanQueryParser(analyzer).parse(query));
+    }
+
+    // every row of every matching doc, ascending
+    std::vector<uint32_t> match_rows(const std::string& query, const Analyzer& analyzer){
+        std::vector<uint32_t> rows;
+        for(uint32_t doc : match(query, analyzer)){
+            uint32_t end = doc + 1 < doc_first_rows.size() ? doc_first_rows[doc + 1] : num_rows;
+            for(uint32_t row = doc_first_rows[doc]; row < end; row++){
+                rows.push_back(row);
+            }
+        }
+        return rows;
+    }
+};
@@ -0,0 +1,168 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <unordered_map>
+
+// the low mantissa bits of every query component are dropped before hashing, so a query that was round-tripped
+// through json or recomputed with slightly different float rounding still hits. 8 of the 23 bits is a relative
+// difference of ~3e-5 -- far below anything that changes a ranking except for exact ties
+const uint32_t QUERY_CACHE_IGNORED_MANTISSA_BITS = 8;
+
+// everything that determines the result of a search, with the vector already quantized
+struct QueryKey {
+    std::vector<uint32_t> embedding;
+    uint32_t k = 0;
+    uint32_t metric = 0;
+    std::string search_str;   // hybrid queries only
+    float keyword_weight = 0;
+
+    bool operator==(const QueryKey& other) const {
+        return k == other.k && metric == other.metric && keyword_weight == other.keyword_weight &&
+            search_str == other.search_str && embedding == other.embedding;
+    }
+
+    // fnv-1a over every field
+    uint64_t hash() const {
+        uint64_t h = 0xcbf29ce484222325ull;
+        auto mix = [&h](const void* data, size_t size){
+            const unsigned char* bytes = (const unsigned char*) data;
+            for(size_t i = 0; i < size; i++){
+                h = (h ^ bytes[i]) * 0x100000001b3ull;
+            }
+        };
+        mix(embedding.data(), embedding.size() * sizeof(uint32_t));
+        mix(&k, sizeof(k));
+        mix(&metric, sizeof(metric));
+        mix(search_str.data(), search_str.size());
+        mix(&keyword_weight, sizeof(keyword_weight));
+        return h;
+    }
+};
+
+QueryKey make_query_key(
+    const std::vector<float>& embedding, uint32_t k, uint32_t metric,
+    const std::string& search_str = "", float keyword_weight = 0
+){
+    QueryKey key;
+    key.embedding.resize(embedding.size());
+    uint32_t mask = ~((1u << QUERY_CACHE_IGNORED_MANTISSA_BITS) - 1);
+    for(size_t i = 0; i < embedding.size(); i++){
+        uint32_t bits;
+        memcpy(&bits, &embedding[i], sizeof(uint32_t));
+        key.embedding[i] = bits & mask;
+    }
+    key.k = k;
+    key.metric = metric;
+    key.search_str = search_str;
+    key.keyword_weight = keyword_weight;
+    return key;
+}
+
+struct QueryKeyHash {
+    size_t operator()(const QueryKey& key) const {
+        return key.hash();
+    }
+};
+
+// bounded LRU of finished search results. every entry remembers the store generation (row count) it was computed
+// at; the store only ever appends, so an entry from an older generation is stale and gets dropped on lookup
+class QueryCache {
+    public:
+    using Results = std::vector<std::pair<float, std::string>>;
+
+    private:
+    struct Entry {
+        QueryKey key;
+        uint64_t generation;
+        Results results;
+    };
+
+    uint32_t capacity;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<QueryKey, std::list<Entry>::iterator, QueryKeyHash> entries;
+    std::mutex mutex;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> invalidations{0};
+    std::atomic<uint64_t> evictions{0};
+
+    public:
+
+    QueryCache(uint32_t capacity) : capacity(capacity) {}
+
+    bool lookup(const QueryKey& key, uint64_t generation, Results& out){
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if(it == entries.end()){
+            misses++;
+            return false;
+        }
+        if(it->second->generation != generation){
+            lru.erase(it->second);
+            entries.erase(it);
+            invalidations++;
+            misses++;
+            return false;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        out = it->second->results;
+        hits++;
+        return true;
+    }
+
+    void insert(const QueryKey& key, uint64_t generation, const Results& results){
+        if(capacity == 0)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if(it != entries.end()){
+            it->second->generation = generation;
+            it->second->results = results;
+            lru.splice(lru.begin(), lru, it->second);
+            return;
+        }
+        lru.push_front(Entry{key, generation, results});
+        entries[key] = lru.begin();
+        if(entries.size() > capacity){
+            entries.erase(lru.back().key);
+            lru.pop_back();
+            evictions++;
+        }
+    }
+
+    void clear(){
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.clear();
+        entries.clear();
+    }
+
+    void export_to(std::map<std::string, double>& out){
+        uint64_t h = hits.load();
+        uint64_t m = misses.load();
+        out["query_cache_capacity"] = capacity;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            out["query_cache_entries"] = entries.size();
+        }
+        out["query_cache_hits"] = h;
+        out["query_cache_misses"] = m;
+        out["query_cache_hit_rate"] = h + m == 0 ? 0 : (double) h / (h + m);
+        out["query_cache_invalidations"] = invalidations.load();
+        out["query_cache_evictions"] = evictions.load();
+    }
+
+    void reset_counters(){
+        hits = 0;
+        misses = 0;
+        invalidations = 0;
+        evictions = 0;
+    }
+};
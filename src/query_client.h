@@ -0,0 +1,239 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+#include "distance_metric.h"
+#include "query_protocol.h"
+
+// blocking client for QueryServer. one connection, not thread safe -- give each worker its own client.
+// transport or protocol failures throw; bad queries (wrong dimension, ...) come back as empty results, the same
+// as calling the store directly
+class QueryClient {
+    private:
+    int fd = -1;
+    uint32_t next_request_id = 0;
+
+    using Results = std::vector<std::pair<float, std::string>>;
+
+    public:
+
+    QueryClient(const std::string& socket_path = DEFAULT_SOCKET_PATH){
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if(socket_path.size() >= sizeof(addr.sun_path)){
+            throw std::invalid_argument("Socket path is too long: " + socket_path);
+        }
+        strcpy(addr.sun_path, socket_path.c_str());
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd == -1 || connect(fd, (sockaddr*) &addr, sizeof(addr)) == -1){
+            std::string err = strerror(errno);
+            close_connection();
+            throw std::runtime_error("Cannot connect to " + socket_path + ": " + err);
+        }
+    }
+
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+
+    QueryClient(QueryClient&& other) noexcept :
+        fd(std::exchange(other.fd, -1)), next_request_id(other.next_request_id) {}
+
+    ~QueryClient(){
+        close_connection();
+    }
+
+    bool ping(){
+        FrameWriter request = start_request(QueryOp::ping);
+        receive(send_request(request));
+        return true;
+    }
+
+    uint32_t get_num_embeddings(){
+        FrameWriter request = start_request(QueryOp::num_embeddings);
+        std::string body = receive(send_request(request));
+        FrameReader reader(body.data(), body.size());
+        return reader.get_u32();
+    }
+
+    Results get_k_closest(
+        std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 0, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        return get_k_closest_batch({embedding}, k, num_threads, metric).at(0);
+    }
+
+    // all queries travel in one frame and are answered in one frame
+    std::vector<Results> get_k_closest_batch(
+        const std::vector<std::vector<float>>& embeddings, uint32_t k,
+        uint32_t num_threads = 0, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        return get_k_closest_pipelined(embeddings, k, embeddings.size(), num_threads, metric);
+    }
+
+    // splits the queries into frames of batch_size, writes every frame before reading any response, then
+    // collects the responses in order -- the server keeps working while the client is still sending
+    std::vector<Results> get_k_closest_pipelined(
+        const std::vector<std::vector<float>>& embeddings, uint32_t k, uint32_t batch_size,
+        uint32_t num_threads = 0, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        batch_size = std::max(1u, batch_size);
+        std::vector<uint32_t> request_ids;
+        for(size_t start = 0; start < embeddings.size() || request_ids.empty(); start += batch_size){
+            size_t end = std::min(embeddings.size(), start + batch_size);
+            FrameWriter request = start_request(QueryOp::get_k_closest);
+            request.put_u32(k);
+            request.put_u32(num_threads);
+            request.put_u8((uint8_t) metric);
+            request.put_u32(end - start);
+            for(size_t i = start; i < end; i++){
+                request.put_floats(embeddings[i]);
+            }
+            request_ids.push_back(send_request(request));
+        }
+
+        std::vector<Results> results;
+        for(uint32_t request_id : request_ids){
+            read_search_results(receive(request_id), results);
+        }
+        return results;
+    }
+
+    Results get_k_closest_hybrid_weighted(
+        std::string search_str, std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 0, DistanceMetric metric = DistanceMetric::cosine_similarity,
+        float keyword_weight = 0.5
+    ){
+        FrameWriter request = start_request(QueryOp::get_k_closest_hybrid);
+        request.put_u32(k);
+        request.put_u32(num_threads);
+        request.put_u8((uint8_t) metric);
+        request.put_f32(keyword_weight);
+        request.put_u32(1);
+        request.put_str(search_str);
+        request.put_floats(embedding);
+
+        std::vector<Results> results;
+        read_search_results(receive(send_request(request)), results);
+        return results.at(0);
+    }
+
+    // returns 0, or the add_embedding error code of the first row that failed; rows before it are stored
+    int add_embeddings(const std::vector<std::vector<float>>& embeddings, const std::vector<std::string>& values){
+        if(embeddings.size() != values.size()){
+            return -1;
+        }
+        FrameWriter request = start_request(QueryOp::add_embeddings);
+        request.put_u32(embeddings.size());
+        for(size_t i = 0; i < embeddings.size(); i++){
+            request.put_floats(embeddings[i]);
+            request.put_str(values[i]);
+        }
+
+        std::string body = receive(send_request(request));
+        FrameReader reader(body.data(), body.size());
+        reader.get_u32(); // rows added
+        return reader.get_i32();
+    }
+
+    int add_embedding(std::vector<float> embedding, std::string value){
+        return add_embeddings({embedding}, {value});
+    }
+
+    void close_connection(){
+        if(fd != -1){
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    private:
+
+    FrameWriter start_request(QueryOp op){
+        FrameWriter request;
+        request.put_u32(next_request_id++);
+        request.put_u8((uint8_t) op);
+        return request;
+    }
+
+    uint32_t send_request(const FrameWriter& request){
+        if(fd == -1){
+            throw std::runtime_error("Query client is closed.");
+        }
+        std::string frame = finish_frame(request.buf);
+        if(frame.size() - FRAME_SIZE_BYTES > MAX_FRAME_SIZE){
+            throw std::invalid_argument("Request is larger than the maximum frame size.");
+        }
+        write_all(frame.data(), frame.size());
+        uint32_t request_id;
+        memcpy(&request_id, request.buf.data(), sizeof(uint32_t));
+        return request_id;
+    }
+
+    // reads the next response, which must be the one for request_id, and returns its body
+    std::string receive(uint32_t request_id){
+        uint32_t body_size;
+        read_all(&body_size, sizeof(body_size));
+        if(body_size < RESPONSE_HEADER_SIZE || body_size > MAX_FRAME_SIZE){
+            throw std::runtime_error("Malformed response from query server.");
+        }
+        std::string frame(body_size, '\0');
+        read_all(&frame[0], body_size);
+
+        FrameReader reader(frame.data(), frame.size());
+        uint32_t response_id = reader.get_u32();
+        int32_t status = reader.get_i32();
+        if(response_id != request_id){
+            throw std::runtime_error("Query server answered out of order.");
+        }
+        if(status != QUERY_OK){
+            throw std::runtime_error("Query server returned status " + std::to_string(status) + ".");
+        }
+        return frame.substr(RESPONSE_HEADER_SIZE);
+    }
+
+    void read_search_results(const std::string& body, std::vector<Results>& results){
+        FrameReader reader(body.data(), body.size());
+        uint32_t num_queries = reader.get_u32();
+        for(uint32_t i = 0; i < num_queries && reader.ok; i++){
+            results.push_back(reader.get_results());
+        }
+        if(!reader.at_end()){
+            throw std::runtime_error("Malformed response from query server.");
+        }
+    }
+
+    void write_all(const char* data, size_t size){
+        while(size > 0){
+            ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+            if(n == -1 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                throw std::runtime_error("Lost connection to query server.");
+            data += n;
+            size -= n;
+        }
+    }
+
+    void read_all(void* out, size_t size){
+        char* dst = (char*) out;
+        while(size > 0){
+            ssize_t n = read(fd, dst, size);
+            if(n == -1 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                throw std::runtime_error("Lost connection to query server.");
+            dst += n;
+            size -= n;
+        }
+    }
+};
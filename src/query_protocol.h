@@ -0,0 +1,168 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+// wire format shared by the query server and client. every message is a frame:
+//
+//   request:  [u32 body_size][u32 request_id][u8 op][body]
+//   response: [u32 body_size][u32 request_id][i32 status][body]
+//
+// body_size counts everything after the first 4 bytes. integers and floats are little endian, strings are
+// [u32 size][bytes], float vectors are [u32 count][f32 * count]. request ids are chosen by the client and echoed
+// back, so a client can pipeline many requests on one connection; responses come back in request order.
+// search ops carry a batch of queries, and num_threads = 0 means the server's default
+
+const uint32_t FRAME_SIZE_BYTES = sizeof(uint32_t);
+const uint32_t REQUEST_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint8_t);
+const uint32_t RESPONSE_HEADER_SIZE = sizeof(uint32_t) + sizeof(int32_t);
+const uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+const char* DEFAULT_SOCKET_PATH = "/tmp/embedding_search.sock";
+
+enum class QueryOp : uint8_t {
+    ping = 0,
+    get_k_closest = 1,         // [u32 k][u32 num_threads][u8 metric][u32 num_queries]([f32 vec])*   -> [u32 num_queries](results)*
+    get_k_closest_hybrid = 2,  // [u32 k][u32 num_threads][u8 metric][f32 keyword_weight][u32 num_queries]([str][f32 vec])*
+    add_embeddings = 3,        // [u32 num_rows]([f32 vec][str value])*                     -> [u32 rows_added][i32 add_embedding code]
+    num_embeddings = 4         //                                                                     -> [u32 count]
+};
+
+enum QueryStatus : int32_t {
+    QUERY_OK = 0,
+    QUERY_BAD_REQUEST = -1,
+    QUERY_UNKNOWN_OP = -2,
+    QUERY_FAILED = -3
+};
+
+// search results are encoded as [u32 num_results]([f32 score][str value])*
+
+class FrameWriter {
+    public:
+    std::string buf;
+
+    void put_u8(uint8_t v){
+        buf.push_back((char) v);
+    }
+
+    void put_u32(uint32_t v){
+        buf.append((const char*) &v, sizeof(uint32_t));
+    }
+
+    void put_i32(int32_t v){
+        buf.append((const char*) &v, sizeof(int32_t));
+    }
+
+    void put_f32(float v){
+        buf.append((const char*) &v, sizeof(float));
+    }
+
+    void put_str(const std::string& s){
+        put_u32(s.size());
+        buf.append(s);
+    }
+
+    void put_floats(const std::vector<float>& v){
+        put_u32(v.size());
+        buf.append((const char*) v.data(), v.size() * sizeof(float));
+    }
+
+    void put_results(const std::vector<std::pair<float, std::string>>& results){
+        put_u32(results.size());
+        for(auto& [score, value] : results){
+            put_f32(score);
+            put_str(value);
+        }
+    }
+};
+
+// bounds-checked reads over one frame body; any overrun flips ok to false and returns zero values
+class FrameReader {
+    const char* data;
+    uint32_t size;
+    uint32_t pos = 0;
+
+    bool take(void* out, uint32_t n){
+        if(!ok || size - pos < n){
+            ok = false;
+            return false;
+        }
+        memcpy(out, data + pos, n);
+        pos += n;
+        return true;
+    }
+
+    public:
+    bool ok = true;
+
+    FrameReader(const char* data, uint32_t size) : data(data), size(size) {}
+
+    // bytes not read yet -- bounds a count off the wire before anything is allocated for it
+    uint32_t remaining() const {
+        return size - pos;
+    }
+
+    uint8_t get_u8(){
+        uint8_t v = 0; take(&v, sizeof(v)); return v;
+    }
+
+    uint32_t get_u32(){
+        uint32_t v = 0; take(&v, sizeof(v)); return v;
+    }
+
+    int32_t get_i32(){
+        int32_t v = 0; take(&v, sizeof(v)); return v;
+    }
+
+    float get_f32(){
+        float v = 0; take(&v, sizeof(v)); return v;
+    }
+
+    std::string get_str(){
+        uint32_t n = get_u32();
+        if(!ok || size - pos < n){
+            ok = false;
+            return {};
+        }
+        std::string s(data + pos, n);
+        pos += n;
+        return s;
+    }
+
+    std::vector<float> get_floats(){
+        uint32_t n = get_u32();
+        if(!ok || (size - pos) / sizeof(float) < n){
+            ok = false;
+            return {};
+        }
+        std::vector<float> v(n);
+        memcpy(v.data(), data + pos, n * sizeof(float));
+        pos += n * sizeof(float);
+        return v;
+    }
+
+    std::vector<std::pair<float, std::string>> get_results(){
+        std::vector<std::pair<float, std::string>> results;
+        uint32_t n = get_u32();
+        for(uint32_t i = 0; i < n && ok; i++){
+            float score = get_f32();
+            results.push_back(std::make_pair(score, get_str()));
+        }
+        return results;
+    }
+
+    bool at_end(){
+        return ok && pos == size;
+    }
+};
+
+// prepends the frame size once the body is complete
+std::string finish_frame(const std::string& body){
+    std::string frame;
+    uint32_t body_size = body.size();
+    frame.append((const char*) &body_size, sizeof(uint32_t));
+    frame.append(body);
+    return frame;
+}
@@ -0,0 +1,392 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "embedding_store.h"
+#include "query_protocol.h"
+
+// serves one EmbeddingStore over a unix domain socket so many worker processes share a single set of mmaps,
+// one inverted index and one warm page cache. a single epoll loop owns every connection: it reads whatever is
+// available, answers every complete frame in the buffer (pipelining), and writes the responses back in order.
+// requests are executed on the loop thread one at a time, which also serializes ingest against search -- the
+// parallelism comes from each scan's own num_threads
+class QueryServer {
+    private:
+    static const uint32_t MAX_EVENTS = 64;
+    static const uint32_t READ_CHUNK_SIZE = 64 * 1024;
+
+    struct Connection {
+        int fd;
+        std::string in;
+        std::string out;
+        size_t out_pos = 0;
+        bool peer_closed = false;  // the peer shut down its write side -- answer what was read, then close
+        uint32_t watched = EPOLLIN | EPOLLRDHUP;
+
+        Connection(int fd = -1) : fd(fd) {}
+    };
+
+    EmbeddingStore& store;
+    std::string socket_path;
+    uint32_t default_num_threads;
+
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    bool bound = false; // the socket file is ours to remove
+
+    std::unordered_map<int, Connection> connections;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> requests_served{0};
+
+    public:
+
+    QueryServer(EmbeddingStore& store, const std::string& socket_path = DEFAULT_SOCKET_PATH, uint32_t default_num_threads = 1) :
+        store(store), socket_path(socket_path), default_num_threads(std::max(1u, default_num_threads))
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if(socket_path.size() >= sizeof(addr.sun_path)){
+            throw std::invalid_argument("Socket path is too long: " + socket_path);
+        }
+        strcpy(addr.sun_path, socket_path.c_str());
+
+        remove_stale_socket(addr);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(listen_fd == -1 || bind(listen_fd, (sockaddr*) &addr, sizeof(addr)) == -1){
+            std::string err = strerror(errno);
+            release();
+            throw std::runtime_error("Cannot listen on " + socket_path + ": " + err);
+        }
+        bound = true;
+        if(listen(listen_fd, SOMAXCONN) == -1){
+            std::string err = strerror(errno);
+            release();
+            throw std::runtime_error("Cannot listen on " + socket_path + ": " + err);
+        }
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        assert(epoll_fd != -1);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(wake_fd != -1);
+
+        watch(listen_fd, EPOLLIN);
+        watch(wake_fd, EPOLLIN);
+    }
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    ~QueryServer(){
+        release();
+    }
+
+    // blocks until stop() is called
+    void run(){
+        running = true;
+        epoll_event events[MAX_EVENTS];
+        while(running){
+            int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if(n == -1){
+                if(errno == EINTR)
+                    continue;
+                break;
+            }
+            for(int i = 0; i < n; i++){
+                int fd = events[i].data.fd;
+                if(fd == wake_fd){
+                    running = false;
+                }else if(fd == listen_fd){
+                    accept_connections();
+                }else{
+                    handle_event(fd, events[i].events);
+                }
+            }
+        }
+        running = false;
+    }
+
+    // safe to call from another thread or a signal handler
+    void stop(){
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void) written;
+    }
+
+    uint64_t get_requests_served(){
+        return requests_served.load();
+    }
+
+    uint32_t get_num_connections(){
+        return connections.size();
+    }
+
+    private:
+
+    // a socket file left by a server that is gone would make bind fail, so it is removed -- but only if nothing
+    // answers on it. a live server keeps its socket, and a path that isn't a socket is never touched
+    void remove_stale_socket(const sockaddr_un& addr){
+        struct stat st;
+        if(lstat(socket_path.c_str(), &st) == -1)
+            return;
+        if(!S_ISSOCK(st.st_mode)){
+            throw std::runtime_error("Cannot listen on " + socket_path + ": the path exists and is not a socket");
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(probe == -1){
+            throw std::runtime_error("Cannot listen on " + socket_path + ": " + strerror(errno));
+        }
+        bool live = connect(probe, (const sockaddr*) &addr, sizeof(addr)) == 0 || errno != ECONNREFUSED;
+        close(probe);
+        if(live){
+            throw std::runtime_error("Cannot listen on " + socket_path + ": another server is already listening on it");
+        }
+        unlink(socket_path.c_str());
+    }
+
+    void watch(int fd, uint32_t events){
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        int res = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        assert(res != -1);
+    }
+
+    void accept_connections(){
+        while(true){
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd == -1)
+                return; // EAGAIN once the backlog is drained
+            connections[fd] = Connection(fd);
+            watch(fd, EPOLLIN | EPOLLRDHUP);
+        }
+    }
+
+    void handle_event(int fd, uint32_t events){
+        auto it = connections.find(fd);
+        if(it == connections.end())
+            return;
+        Connection& conn = it->second;
+
+        // a client that sends its requests and then shuts down its write side still gets its answers: the
+        // connection stays open, watched for EPOLLOUT only, until everything queued for it has been sent
+        bool open = true;
+        if(!conn.peer_closed && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))){
+            conn.peer_closed = !read_from(conn);
+            open = process_frames(conn);
+        }
+        open = open && flush(conn) && !(conn.peer_closed && conn.out.empty());
+        if(!open){
+            close_connection(fd);
+        }
+    }
+
+    // false once the peer hung up or errored
+    bool read_from(Connection& conn){
+        char buf[READ_CHUNK_SIZE];
+        while(true){
+            ssize_t n = read(conn.fd, buf, sizeof(buf));
+            if(n > 0){
+                conn.in.append(buf, n);
+            }else if(n == 0){
+                return false;
+            }else{
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+        }
+    }
+
+    // answers every complete frame in the input buffer; false if the stream is malformed
+    bool process_frames(Connection& conn){
+        size_t pos = 0;
+        while(conn.in.size() - pos >= FRAME_SIZE_BYTES){
+            uint32_t body_size = char_to_uint32_t(conn.in.data() + pos);
+            if(body_size < REQUEST_HEADER_SIZE || body_size > MAX_FRAME_SIZE)
+                return false;
+            if(conn.in.size() - pos - FRAME_SIZE_BYTES < body_size)
+                break;
+
+            const char* body = conn.in.data() + pos + FRAME_SIZE_BYTES;
+            FrameReader reader(body, body_size);
+            uint32_t request_id = reader.get_u32();
+            QueryOp op = (QueryOp) reader.get_u8();
+            conn.out += handle_request(request_id, op, reader);
+            requests_served++;
+
+            pos += FRAME_SIZE_BYTES + body_size;
+        }
+        conn.in.erase(0, pos);
+        return true;
+    }
+
+    std::string handle_request(uint32_t request_id, QueryOp op, FrameReader& reader){
+        FrameWriter response;
+        response.put_u32(request_id);
+        response.put_i32(QUERY_OK);
+
+        // whatever the store throws fails this request only, never the server and its other clients
+        FrameWriter body;
+        int32_t status;
+        try{
+            status = execute(op, reader, body);
+        }catch(const std::exception& e){
+            status = QUERY_FAILED;
+        }
+        if(status == QUERY_OK && !reader.at_end()){
+            status = QUERY_BAD_REQUEST;
+        }
+
+        if(status == QUERY_OK){
+            response.buf += body.buf;
+        }else{
+            memcpy(&response.buf[sizeof(uint32_t)], &status, sizeof(int32_t));
+        }
+        return finish_frame(response.buf);
+    }
+
+    int32_t execute(QueryOp op, FrameReader& reader, FrameWriter& out){
+        switch(op){
+            case QueryOp::ping:
+                return QUERY_OK;
+
+            case QueryOp::num_embeddings:
+                out.put_u32(store.get_num_embeddings());
+                return QUERY_OK;
+
+            case QueryOp::get_k_closest:
+            case QueryOp::get_k_closest_hybrid: {
+                bool hybrid = op == QueryOp::get_k_closest_hybrid;
+                uint32_t k = reader.get_u32();
+                uint32_t num_threads = reader.get_u32();
+                uint8_t metric = reader.get_u8();
+                float keyword_weight = hybrid ? reader.get_f32() : 0;
+                uint32_t num_queries = reader.get_u32();
+                // every query takes at least its length prefixes, so a count the frame can't hold is rejected
+                // before anything is allocated for it
+                uint32_t min_query_size = (hybrid ? 2 : 1) * sizeof(uint32_t);
+                if(!reader.ok || metric > (uint8_t) DistanceMetric::l2_squared || num_queries > reader.remaining() / min_query_size)
+                    return QUERY_BAD_REQUEST;
+                if(num_threads == 0)
+                    num_threads = default_num_threads;
+
+                // parse the whole batch before running anything so a truncated frame has no side effects
+                std::vector<std::string> search_strs(num_queries);
+                std::vector<std::vector<float>> embeddings;
+                for(uint32_t i = 0; i < num_queries && reader.ok; i++){
+                    if(hybrid)
+                        search_strs[i] = reader.get_str();
+                    embeddings.push_back(reader.get_floats());
+                }
+                if(!reader.ok)
+                    return QUERY_BAD_REQUEST;
+
+                out.put_u32(num_queries);
+                for(uint32_t i = 0; i < num_queries; i++){
+                    if(hybrid){
+                        out.put_results(store.get_k_closest_hybrid_weighted(
+                            search_strs[i], embeddings[i], k, num_threads, (DistanceMetric) metric, keyword_weight));
+                    }else{
+                        out.put_results(store.get_k_closest(embeddings[i], k, num_threads, (DistanceMetric) metric));
+                    }
+                }
+                return QUERY_OK;
+            }
+
+            case QueryOp::add_embeddings: {
+                uint32_t num_rows = reader.get_u32();
+                if(!reader.ok || num_rows > reader.remaining() / (2 * sizeof(uint32_t)))
+                    return QUERY_BAD_REQUEST;
+                std::vector<std::vector<float>> embeddings;
+                std::vector<std::string> values;
+                for(uint32_t i = 0; i < num_rows && reader.ok; i++){
+                    embeddings.push_back(reader.get_floats());
+                    values.push_back(reader.get_str());
+                }
+                if(!reader.ok)
+                    return QUERY_BAD_REQUEST;
+
+                // stops at the first failing row, like a loop of add_embedding calls would
+                uint32_t rows_added = 0;
+                int32_t code = 0;
+                for(; rows_added < num_rows; rows_added++){
+                    code = store.add_embedding(embeddings[rows_added], values[rows_added]);
+                    if(code != 0)
+                        break;
+                }
+                out.put_u32(rows_added);
+                out.put_i32(code);
+                return QUERY_OK;
+            }
+
+            default:
+                return QUERY_UNKNOWN_OP;
+        }
+    }
+
+    // false if the peer went away; otherwise waits for EPOLLOUT when the socket buffer is full
+    bool flush(Connection& conn){
+        while(conn.out_pos < conn.out.size()){
+            ssize_t n = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+            if(n > 0){
+                conn.out_pos += n;
+            }else if(n == -1 && errno == EINTR){
+                continue;
+            }else if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                break;
+            }else{
+                return false;
+            }
+        }
+        if(conn.out_pos == conn.out.size()){
+            conn.out.clear();
+            conn.out_pos = 0;
+        }
+
+        // a half-closed peer stays readable at eof forever, so it is no longer watched for input
+        uint32_t watched = (conn.peer_closed ? 0u : (uint32_t) (EPOLLIN | EPOLLRDHUP)) | (conn.out.empty() ? 0u : (uint32_t) EPOLLOUT);
+        if(watched != conn.watched){
+            epoll_event ev = {};
+            ev.events = watched;
+            ev.data.fd = conn.fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+            conn.watched = watched;
+        }
+        return true;
+    }
+
+    void close_connection(int fd){
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+    }
+
+    void release(){
+        for(auto& [fd, conn] : connections){
+            close(fd);
+        }
+        connections.clear();
+        for(int* fd : {&listen_fd, &epoll_fd, &wake_fd}){
+            if(*fd != -1){
+                close(*fd);
+                *fd = -1;
+            }
+        }
+        if(bound){
+            unlink(socket_path.c_str());
+            bound = false;
+        }
+    }
+};
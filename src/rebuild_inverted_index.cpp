@@ -0,0 +1,69 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "embedding_store.h"
+
+// usage: rebuild_inverted_index --dir <store dir> [--dims <embedding size>] [--threads <n>]
+//
+// rebuilds inverted_index.bin and positional_index.bin of a store from its object store, offline. also turns a store
+// that was created without hybrid search into one that has it. the embedding size is read from the store header if
+// not given. the store is opened without hybrid search, so the indexes are only built once, in the parallel pass
+
+void print_usage(const char* name){
+    std::cerr << "usage: " << name << " --dir <store dir> [--dims <embedding size>] [--threads <n>]" << std::endl;
+}
+
+int main(int argc, char** argv){
+    std::string dir;
+    uint32_t dims = 0;
+    uint32_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(arg == "--dir" && has_value){
+            dir = argv[++i];
+        }else if(arg == "--dims" && has_value){
+            dims = atoi(argv[++i]);
+        }else if(arg == "--threads" && has_value){
+            num_threads = atoi(argv[++i]);
+        }else{
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(dir.empty()){
+        print_usage(argv[0]);
+        return 1;
+    }
+    if(dims == 0){
+        StoreHeader header;
+        if(!read_store_header(fs::path(dir) / STORE_HEADER_FN, header)){
+            std::cerr << dir << " has no store header, pass --dims" << std::endl;
+            return 1;
+        }
+        dims = header.embedding_size;
+    }
+
+    try {
+        EmbeddingStore store(dir.c_str(), dims, DEFAULT_MAX_EMBEDDING_STORE_SIZE, DEFAULT_MAX_OBJECT_STORE_SIZE, false);
+        auto start = std::chrono::steady_clock::now();
+        int code = store.rebuild_inverted_index(num_threads);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(code != 0){
+            std::cerr << "rebuild failed: " << code << std::endl;
+            return 1;
+        }
+        std::cout << "rebuilt the text indexes of " << dir << " (" << store.get_num_embeddings() << " embeddings) in "
+                  << seconds << "s with " << num_threads << " threads" << std::endl;
+        store.close_store();
+    } catch(const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "distance_metric.h"
+#include "element_type.h"
+
+// rows are scored a block at a time: the distance loop fills a small score buffer with nothing but loads and
+// arithmetic in it, then a second loop feeds the buffer to the heap. a block is sized to stay in L1/L2
+const uint32_t SCAN_BLOCK_BYTES = 32 * 1024;
+const uint32_t SCAN_MAX_BLOCK_ROWS = 256;
+// how many rows ahead of the one being scored we ask the cache to fetch
+const uint32_t SCAN_PREFETCH_ROWS = 4;
+const uint32_t CACHE_LINE_SIZE = 64;
+
+using ScoredRow = std::pair<float, uint32_t>; // score, row idx -- compared as a pair, so ties go to the lower idx
+
+// a score function may declare preserves_distance when it returns either the distance itself or a value that can
+// never enter the heap (infinity). only then can the kernel hand the heap top to compute_distance as an early-exit
+// bound -- any other score function is not known to be monotone in the distance
+template <typename ScoreFn, typename = void>
+struct preserves_distance : std::false_type {};
+
+template <typename ScoreFn>
+struct preserves_distance<ScoreFn, std::void_t<decltype(ScoreFn::preserves_distance)>> :
+    std::integral_constant<bool, ScoreFn::preserves_distance> {};
+
+// the score of a plain nearest neighbour search
+struct DistanceScore {
+    static constexpr bool preserves_distance = true;
+
+    float operator()(uint32_t idx, float distance) const {
+        return distance;
+    }
+};
+
+// rows outside a filter score infinity and never make it out of the heap. allowed is indexed by row; rows
+// appended after it was built are outside
+struct RowFilterScore {
+    static constexpr bool preserves_distance = true;
+
+    const std::vector<uint8_t>* allowed;
+
+    float operator()(uint32_t idx, float distance) const {
+        return idx < allowed->size() && (*allowed)[idx] ? distance : std::numeric_limits<float>::infinity();
+    }
+};
+
+// a filter that keeps fewer than 1 / MATCHED_ROWS_SCAN_DIVISOR of the rows has them scored one by one instead of
+// scanning every row through a RowFilterScore -- past that, reading the store sequentially wins
+const uint32_t MATCHED_ROWS_SCAN_DIVISOR = 16;
+
+struct ScanCounters {
+    uint64_t distance_evaluations = 0;
+    uint64_t rows_pruned = 0;
+    uint64_t heap_operations = 0;
+};
+
+uint32_t get_scan_block_rows(uint32_t row_size){
+    return std::max(1u, std::min(SCAN_MAX_BLOCK_ROWS, SCAN_BLOCK_BYTES / std::max(1u, row_size)));
+}
+
+// num_parts contiguous, non-overlapping [start, end) ranges covering [0, num_rows). inner boundaries are rounded
+// to whole scan blocks, so no two threads ever touch the same block and each thread streams one contiguous
+// region of the mapping -- which is also what keeps its pages on the thread's node under first-touch placement
+std::vector<std::pair<uint32_t, uint32_t>> split_rows(uint32_t num_rows, uint32_t num_parts, uint32_t block_rows){
+    num_parts = std::max(1u, num_parts);
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    uint32_t start = 0;
+    for(uint32_t p = 0; p < num_parts; p++){
+        uint32_t end = num_rows;
+        if(p != num_parts - 1){
+            end = (uint64_t) num_rows * (p + 1) / num_parts;
+            end = std::min(num_rows, std::max(start, end / block_rows * block_rows));
+        }
+        ranges.push_back(std::make_pair(start, end));
+        start = end;
+    }
+    return ranges;
+}
+
+void prefetch_row(const char* row, uint32_t row_size){
+    for(uint32_t offset = 0; offset < row_size; offset += CACHE_LINE_SIZE){
+        __builtin_prefetch(row + offset, 0, 0);
+    }
+}
+
+// the block loop every scan shares: scores rows [start, end) a block at a time and hands each (idx, distance) to
+// collect, stopping as soon as collect returns false. bound() is read once per block and given to compute_distance
+// as its early-exit threshold. rows is row rows_base of the store -- the first row for the mmap, the first row of
+// the buffer for disk scans; query must already be in float32. DIM is embedding_size for a specialized dimension,
+// else 0
+template <DistanceMetric METRIC, uint32_t DIM, typename BoundFn, typename CollectFn>
+void scan_blocks(
+    float* query, char* rows, uint32_t row_size, uint32_t embedding_size, ElementType element_type,
+    uint32_t start, uint32_t end, BoundFn bound, CollectFn collect, ScanCounters& counters, uint32_t rows_base = 0
+){
+    const uint32_t block_rows = get_scan_block_rows(row_size);
+    float scores[SCAN_MAX_BLOCK_ROWS];
+
+    for(uint32_t block_start = start; block_start < end; block_start += block_rows){
+        uint32_t block_end = std::min(end, block_start + block_rows);
+
+        // a bound from the previous block is a little looser than a per-row one, but keeps the collector out of
+        // this loop
+        float thres = bound();
+        for(uint32_t i = block_start; i < block_end; i++){
+            if(i + SCAN_PREFETCH_ROWS < end){
+                prefetch_row(rows + (size_t) (i + SCAN_PREFETCH_ROWS - rows_base) * row_size, row_size);
+            }
+            scores[i - block_start] = compute_distance<METRIC, DIM>(
+                query, rows + (size_t) (i - rows_base) * row_size, embedding_size, thres, element_type
+            );
+        }
+        counters.distance_evaluations += block_end - block_start;
+
+        for(uint32_t i = block_start; i < block_end; i++){
+            if(!collect(i, scores[i - block_start]))
+                return;
+        }
+    }
+}
+
+// keeps the k best (score, idx) of rows [start, end) in heap, a max heap on the pair
+template <DistanceMetric METRIC, uint32_t DIM, typename ScoreFn>
+void scan_rows(
+    float* query, char* rows, uint32_t row_size, uint32_t embedding_size, ElementType element_type,
+    uint32_t start, uint32_t end, uint32_t k, ScoreFn score_fn,
+    std::vector<ScoredRow>& heap, ScanCounters& counters, uint32_t rows_base = 0
+){
+    constexpr bool PRUNE = preserves_distance<ScoreFn>::value && METRIC != DistanceMetric::cosine_similarity;
+
+    heap.reserve(k + 1);
+    if(k == 0)
+        return;
+
+    auto bound = [&](){
+        return PRUNE && heap.size() == k ? heap.front().first : std::numeric_limits<float>::max();
+    };
+    auto collect = [&](uint32_t i, float distance){
+        if(PRUNE && distance == std::numeric_limits<float>::max()){
+            counters.rows_pruned++;
+            return true;
+        }
+        ScoredRow candidate = std::make_pair(score_fn(i, distance), i);
+        if(heap.size() < k){
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end());
+            counters.heap_operations++;
+        }else if(candidate < heap.front()){
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end());
+            counters.heap_operations += 2;
+        }
+        return true;
+    };
+    scan_blocks<METRIC, DIM>(query, rows, row_size, embedding_size, element_type, start, end, bound, collect, counters, rows_base);
+}
+
+// appends every (distance, idx) of rows [start, end) within r to matches. num_matches is shared by all threads of
+// one search: once max_matches rows have been claimed (0 = unlimited) every thread stops
+template <DistanceMetric METRIC, uint32_t DIM>
+void scan_rows_within(
+    float* query, char* rows, uint32_t row_size, uint32_t embedding_size, ElementType element_type,
+    uint32_t start, uint32_t end, float r, uint32_t max_matches, std::atomic<uint32_t>& num_matches,
+    std::vector<ScoredRow>& matches, ScanCounters& counters, uint32_t rows_base = 0
+){
+    // L1/L2 bail out of a row as soon as the partial sum passes r
+    auto bound = [&](){
+        return METRIC != DistanceMetric::cosine_similarity ? r : std::numeric_limits<float>::max();
+    };
+    auto collect = [&](uint32_t i, float distance){
+        if(distance > r){
+            counters.rows_pruned += distance == std::numeric_limits<float>::max();
+            return true;
+        }
+        if(max_matches != 0 && num_matches.fetch_add(1, std::memory_order_relaxed) >= max_matches)
+            return false;
+        matches.push_back(std::make_pair(distance, i));
+        return true;
+    };
+    scan_blocks<METRIC, DIM>(query, rows, row_size, embedding_size, element_type, start, end, bound, collect, counters, rows_base);
+}
+
+// the k best of all per-thread heaps, best first
+std::vector<ScoredRow> merge_heaps(std::vector<std::vector<ScoredRow>>& heaps, uint32_t k){
+    std::vector<ScoredRow> merged;
+    for(auto& heap : heaps){
+        merged.insert(merged.end(), heap.begin(), heap.end());
+    }
+    uint32_t num_results = std::min((size_t) k, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + num_results, merged.end());
+    merged.resize(num_results);
+    return merged;
+}
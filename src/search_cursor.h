@@ -0,0 +1,113 @@
+#pragma once
+#include <stdint.h>
+#include <limits>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "embedding_store.h"
+#include "scan_kernel.h"
+
+// each refill scan keeps this many pages worth of candidates, so only one page in this many costs a scan
+const uint32_t DEFAULT_CURSOR_WINDOW_PAGES = 4;
+
+// rows at or before the cursor's bound score infinity and never make it out of the heap
+struct AfterBoundScore {
+    static constexpr bool preserves_distance = true;
+
+    ScoredRow bound;
+
+    float operator()(uint32_t idx, float distance) const {
+        return std::make_pair(distance, idx) <= bound ? std::numeric_limits<float>::infinity() : distance;
+    }
+};
+
+// pages through the results of a nearest neighbour search, closest first. the cursor remembers the (score, idx)
+// of the last row it handed out; when its buffered window runs dry it rescans for the next window of rows strictly
+// after that bound. the store is brute force, so a refill still scores every row -- the bound only keeps earlier
+// rows out of the heap, so it stays one window deep however far in the page is, and values are read from the object
+// store only for the page being returned. window_pages is what amortizes the scans: one per window_pages pages.
+// rows appended while paging show up if they sort after the bound
+class SearchCursor {
+    private:
+    EmbeddingStore* store;
+    std::vector<float> embedding;
+    uint32_t page_size;
+    uint32_t num_threads;
+    DistanceMetric metric;
+    uint32_t window_size;
+
+    std::vector<ScoredRow> window; // best first
+    size_t window_pos = 0;
+    bool has_bound = false;
+    ScoredRow bound;
+    bool exhausted = false;
+    uint32_t num_scans = 0;
+
+    void refill(){
+        uint32_t k = window_size;
+        if(has_bound){
+            window = store->scan_top_k(embedding, k, num_threads, metric, AfterBoundScore{bound});
+        }else{
+            window = store->scan_top_k(embedding, k, num_threads, metric, DistanceScore());
+        }
+        num_scans++;
+        // fewer than k rows are left once the infinities show up or the heap came back short
+        while(!window.empty() && window.back().first == std::numeric_limits<float>::infinity()){
+            window.pop_back();
+        }
+        if(window.size() < k){
+            exhausted = true;
+        }
+        window_pos = 0;
+    }
+
+    public:
+
+    SearchCursor(
+        EmbeddingStore& store, std::vector<float> embedding, uint32_t page_size,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity,
+        uint32_t window_pages = DEFAULT_CURSOR_WINDOW_PAGES
+    ) :
+        store(&store),
+        embedding(std::move(embedding)),
+        page_size(std::max(1u, page_size)),
+        num_threads(num_threads),
+        metric(metric),
+        window_size(std::max(1u, page_size) * std::max(1u, window_pages))
+    {
+        if(this->embedding.size() != store.get_embedding_size()){
+            exhausted = true;
+        }
+    }
+
+    bool has_next(){
+        if(window_pos < window.size())
+            return true;
+        if(exhausted)
+            return false;
+        refill();
+        return window_pos < window.size();
+    }
+
+    // the next page_size results, or fewer on the last page; empty once everything has been returned
+    std::vector<std::pair<float, std::string>> next_page(){
+        std::vector<std::pair<float, std::string>> page;
+        while(page.size() < page_size && has_next()){
+            auto [score, idx] = window[window_pos++];
+            page.push_back(std::make_pair(score, store->get_value(idx)));
+            bound = std::make_pair(score, idx);
+            has_bound = true;
+        }
+        return page;
+    }
+
+    uint32_t get_page_size(){
+        return page_size;
+    }
+
+    // full scans done so far -- one per window, not one per page
+    uint32_t get_num_scans(){
+        return num_scans;
+    }
+};
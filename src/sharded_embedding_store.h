@@ -0,0 +1,252 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+#include "embedding_store.h"
+
+namespace fs = std::filesystem;
+
+const char* SHARD_DIR_PREFIX = "shard_";
+
+// splitmix64 finalizer -- stable across platforms and runs, unlike std::hash, so an id always lands on the same shard
+uint64_t hash_id(uint64_t id){
+    id += 0x9e3779b97f4a7c15ull;
+    id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ull;
+    id = (id ^ (id >> 27)) * 0x94d049bb133111ebull;
+    return id ^ (id >> 31);
+}
+
+// N independent EmbeddingStores under dir/shard_<i>. ids are hashed to a shard on ingest, queries fan out to every
+// shard concurrently and the per-shard top-k lists are merged. each shard can live on its own disk (symlink the
+// shard dir) and can be rebuilt on its own.
+//
+// every operation takes its own reference to the shards it uses (under shards_mutex, only long enough to copy the
+// pointers), so reset_shard can swap a shard out while queries on it are still running: they finish on the old
+// copy, which is closed once the last of them lets go
+class ShardedEmbeddingStore {
+    private:
+    fs::path dir_path;
+    uint32_t embedding_size;
+    uint32_t max_embedding_store_size;
+    uint32_t max_object_store_size;
+    bool hybrid_search_enabled;
+    ElementType element_type;
+
+    std::vector<std::shared_ptr<EmbeddingStore>> shards;
+    std::unique_ptr<std::shared_mutex> shards_mutex = std::make_unique<std::shared_mutex>(); // behind a pointer so the store stays movable
+
+    std::shared_ptr<EmbeddingStore> open_shard(uint32_t shard){
+        return std::make_shared<EmbeddingStore>(
+            get_shard_dir(shard).c_str(), embedding_size, max_embedding_store_size, max_object_store_size,
+            hybrid_search_enabled, element_type
+        );
+    }
+
+    using Results = std::vector<std::pair<float, std::string>>;
+
+    // runs query(shard) on every shard in its own thread and keeps the k best results overall
+    template <typename ShardQuery>
+    Results fan_out(uint32_t k, ShardQuery query){
+        std::vector<std::shared_ptr<EmbeddingStore>> current = get_shards();
+        std::vector<Results> shard_results(current.size());
+        std::vector<std::thread> threads;
+        for(uint32_t i = 0; i < current.size(); i++){
+            threads.emplace_back([&, i](){
+                shard_results[i] = query(*current[i]);
+            });
+        }
+        for(auto& t : threads){
+            t.join();
+        }
+
+        Results merged;
+        for(auto& r : shard_results){
+            std::move(r.begin(), r.end(), std::back_inserter(merged));
+        }
+        auto by_score = [](const std::pair<float, std::string>& a, const std::pair<float, std::string>& b){
+            return a.first < b.first;
+        };
+        uint32_t num_results = std::min((size_t) k, merged.size());
+        std::partial_sort(merged.begin(), merged.begin() + num_results, merged.end(), by_score);
+        merged.resize(num_results);
+        return merged;
+    }
+
+    public:
+
+    // max sizes are per shard
+    ShardedEmbeddingStore(
+        const char* dir, uint32_t num_shards, uint32_t embedding_size,
+        uint32_t max_embedding_store_size = DEFAULT_MAX_EMBEDDING_STORE_SIZE,
+        uint32_t max_object_store_size = DEFAULT_MAX_OBJECT_STORE_SIZE,
+        bool hybrid_search_enabled = false,
+        ElementType element_type = ElementType::float32
+    ) :
+        dir_path(dir),
+        embedding_size(embedding_size),
+        max_embedding_store_size(max_embedding_store_size),
+        max_object_store_size(max_object_store_size),
+        hybrid_search_enabled(hybrid_search_enabled),
+        element_type(element_type)
+    {
+        if(num_shards == 0){
+            throw std::invalid_argument("A sharded store needs at least one shard.");
+        }
+
+        // changing the shard count would silently re-route ids, so it is fixed once the store exists
+        uint32_t existing_shards = 0;
+        while(fs::exists(get_shard_dir(existing_shards))){
+            existing_shards++;
+        }
+        if(existing_shards != 0 && existing_shards != num_shards){
+            throw std::runtime_error(
+                "Store has " + std::to_string(existing_shards) + " shards, not " + std::to_string(num_shards) + ".");
+        }
+
+        for(uint32_t i = 0; i < num_shards; i++){
+            shards.push_back(open_shard(i));
+        }
+    }
+
+    static ShardedEmbeddingStore create(
+        const char* dir, uint32_t num_shards, uint32_t embedding_size,
+        uint32_t max_embedding_store_size = DEFAULT_MAX_EMBEDDING_STORE_SIZE,
+        uint32_t max_object_store_size = DEFAULT_MAX_OBJECT_STORE_SIZE,
+        bool hybrid_search_enabled = false,
+        ElementType element_type = ElementType::float32
+    ){
+        return ShardedEmbeddingStore(
+            dir, num_shards, embedding_size, max_embedding_store_size, max_object_store_size, hybrid_search_enabled, element_type
+        );
+    }
+
+    uint32_t get_num_shards(){
+        return shards.size();
+    }
+
+    fs::path get_shard_dir(uint32_t shard){
+        return dir_path / (SHARD_DIR_PREFIX + std::to_string(shard));
+    }
+
+    uint32_t get_shard_for_id(uint64_t id){
+        return hash_id(id) % shards.size();
+    }
+
+    // stays valid after a reset_shard, but then refers to the shard's old, dropped copy
+    std::shared_ptr<EmbeddingStore> get_shard(uint32_t shard){
+        std::shared_lock<std::shared_mutex> lock(*shards_mutex);
+        return shards.at(shard);
+    }
+
+    std::vector<std::shared_ptr<EmbeddingStore>> get_shards(){
+        std::shared_lock<std::shared_mutex> lock(*shards_mutex);
+        return shards;
+    }
+
+    int add_embedding(uint64_t id, std::vector<float> embedding, std::string value){
+        return get_shard(get_shard_for_id(id))->add_embedding(embedding, value);
+    }
+
+    // rows are grouped by shard and each shard is written by its own thread. returns 0, or the first
+    // add_embedding error code in shard order (-1 if the inputs don't line up)
+    int add_embeddings(
+        const std::vector<uint64_t>& ids, const std::vector<std::vector<float>>& embeddings, const std::vector<std::string>& values
+    ){
+        if(ids.size() != embeddings.size() || ids.size() != values.size()){
+            return -1;
+        }
+
+        std::vector<std::shared_ptr<EmbeddingStore>> current = get_shards();
+        std::vector<std::vector<size_t>> rows_per_shard(current.size());
+        for(size_t i = 0; i < ids.size(); i++){
+            rows_per_shard[get_shard_for_id(ids[i])].push_back(i);
+        }
+
+        std::vector<int> codes(current.size(), 0);
+        std::vector<std::thread> threads;
+        for(uint32_t s = 0; s < current.size(); s++){
+            if(rows_per_shard[s].empty())
+                continue;
+            threads.emplace_back([&, s](){
+                for(size_t row : rows_per_shard[s]){
+                    int code = current[s]->add_embedding(embeddings[row], values[row]);
+                    if(code != 0){
+                        codes[s] = code;
+                        return;
+                    }
+                }
+            });
+        }
+        for(auto& t : threads){
+            t.join();
+        }
+
+        for(int code : codes){
+            if(code != 0)
+                return code;
+        }
+        return 0;
+    }
+
+    // num_threads is per shard -- every shard is already scanned by its own thread
+    Results get_k_closest(
+        std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 1, DistanceMetric metric = DistanceMetric::cosine_similarity
+    ){
+        return fan_out(k, [&](EmbeddingStore& shard){
+            return shard.get_k_closest(embedding, k, num_threads, metric);
+        });
+    }
+
+    // keyword scores are normalized within each shard, so they are comparable across shards only
+    // when the ids are spread evenly -- which hashing gives us
+    Results get_k_closest_hybrid_weighted(
+        std::string search_str, std::vector<float> embedding, uint32_t k,
+        uint32_t num_threads = 1, DistanceMetric distance_metric = DistanceMetric::cosine_similarity,
+        float keyword_weight = 0.5
+    ){
+        return fan_out(k, [&](EmbeddingStore& shard){
+            return shard.get_k_closest_hybrid_weighted(search_str, embedding, k, num_threads, distance_metric, keyword_weight);
+        });
+    }
+
+    // drops every row of one shard and reopens it empty; the caller re-ingests the ids that hash to it while
+    // the other shards keep serving. searches already running on the shard finish on its old rows, and rows
+    // added to it until this returns may land in the old copy and be dropped with it
+    void reset_shard(uint32_t shard){
+        std::unique_lock<std::shared_mutex> lock(*shards_mutex);
+        shards.at(shard).reset(); // the old files stay mapped by whoever still holds the old copy
+        fs::remove_all(get_shard_dir(shard));
+        shards[shard] = open_shard(shard);
+    }
+
+    // snapshots every shard into dest_dir/shard_<i>. each shard is consistent on its own; rows added to other
+    // shards while one is being copied may or may not be in the snapshot
+    int snapshot(const char* dest_dir){
+        fs::path dest(dest_dir);
+        if(fs::exists(dest) && !fs::is_empty(dest))
+            return -1;
+        std::vector<std::shared_ptr<EmbeddingStore>> current = get_shards();
+        for(uint32_t i = 0; i < current.size(); i++){
+            int code = current[i]->snapshot((dest / (SHARD_DIR_PREFIX + std::to_string(i))).c_str());
+            if(code != 0)
+                return code;
+        }
+        return 0;
+    }
+
+    void close_store(){
+        std::unique_lock<std::shared_mutex> lock(*shards_mutex);
+        for(auto& shard : shards){
+            shard->close_store();
+        }
+    }
+};
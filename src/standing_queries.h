@@ -0,0 +1,237 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include "constants.h"
+#include "file_wrapper.h"
+#include "element_type.h"
+#include "distance_metric.h"
+#include "scan_kernel.h"
+
+namespace fs = std::filesystem;
+
+// registered queries whose top-k is kept current as rows are added: only the new rows are scored, against every
+// query, so the cost follows the ingest rate rather than the corpus size. every query's top-k lives in its own
+// slot in standing_queries.bin and is updated in place.
+//
+//   [write_idx][u32 rows scored]([u32 active][u32 k][u32 metric][u32 count][dims x f32 query][k x (f32, u32 row)])*
+//
+// rows scored is shared by all queries -- every query covers rows [0, rows scored). a store that was written
+// without its standing queries open (or crashed mid-add) is caught up on the next open. the file starts at
+// STANDING_QUERIES_FILE_SIZE and doubles whenever a slot doesn't fit, up to the 32-bit limit
+const uint32_t STANDING_QUERIES_FILE_SIZE = 16 * 1024 * 1024;
+const uint32_t STANDING_QUERY_SLOT_HEADER_SIZE = 4 * sizeof(uint32_t);
+
+// a row entering or leaving a standing query's top-k
+struct StandingQueryChange {
+    uint32_t query_id;
+    uint32_t row;
+    float distance;
+    bool entered; // false: pushed out by a closer row
+
+    bool operator==(const StandingQueryChange& other) const {
+        return query_id == other.query_id && row == other.row && distance == other.distance && entered == other.entered;
+    }
+};
+
+class StandingQueries {
+    private:
+    struct Query {
+        uint32_t slot;  // offset of the slot in the file, past DEFAULT_WRITE_IDX
+        bool active;
+        uint32_t k;
+        DistanceMetric metric;
+        std::vector<float> embedding;
+        std::vector<ScoredRow> heap; // max heap, like the scan's
+    };
+
+    FileWrapper file;
+    fs::path path;
+    MmapOptions options;
+    uint32_t embedding_size;
+    std::vector<Query> queries;      // index = query id; removed queries keep their place
+    std::vector<StandingQueryChange> changes;
+
+    public:
+
+    // a new file starts at num_rows: there is nothing to catch up on before the first query is added
+    StandingQueries(const fs::path& dir, uint32_t embedding_size, uint32_t num_rows, const MmapOptions& options) :
+        path(dir / STANDING_QUERIES_FN),
+        options(options),
+        embedding_size(embedding_size)
+    {
+        file = FileWrapper(path, STANDING_QUERIES_FILE_SIZE, options);
+        if(file.write_idx == DEFAULT_WRITE_IDX){
+            file.write(&num_rows, sizeof(uint32_t));
+        }
+        uint32_t offset = sizeof(uint32_t);
+        while(DEFAULT_WRITE_IDX + offset < file.write_idx){
+            char* slot = file.get_start_addr() + offset;
+            Query query;
+            query.slot = offset;
+            query.active = char_to_uint32_t(slot);
+            query.k = char_to_uint32_t(slot + 4);
+            query.metric = (DistanceMetric) char_to_uint32_t(slot + 8);
+            uint32_t count = char_to_uint32_t(slot + 12);
+            query.embedding.resize(embedding_size);
+            memcpy(query.embedding.data(), slot + STANDING_QUERY_SLOT_HEADER_SIZE, embedding_size * sizeof(float));
+            char* entries = slot + STANDING_QUERY_SLOT_HEADER_SIZE + embedding_size * sizeof(float);
+            for(uint32_t i = 0; i < count; i++){
+                float score;
+                memcpy(&score, entries + i * 8, sizeof(float));
+                query.heap.push_back(std::make_pair(score, char_to_uint32_t(entries + i * 8 + 4)));
+            }
+            std::make_heap(query.heap.begin(), query.heap.end());
+            offset += slot_size(query.k);
+            queries.push_back(std::move(query));
+        }
+    }
+
+    uint32_t get_rows_scored(){
+        return char_to_uint32_t(file.get_start_addr());
+    }
+
+    // registers a query with its top-k over the rows scored so far (the caller scans for it). returns the query id,
+    // -1 if the file can't grow to hold it or is read-only
+    int64_t add(const std::vector<float>& embedding, uint32_t k, DistanceMetric metric, const std::vector<ScoredRow>& top_k){
+        uint64_t needed = (uint64_t) file.write_idx + slot_size(k);
+        if(needed > file.mmap_size && (file.read_only || !grow(needed)))
+            return -1;
+        uint32_t offset = file.write_idx - DEFAULT_WRITE_IDX;
+        std::vector<char> slot(slot_size(k), 0);
+        uint32_t header[4] = {1, k, (uint32_t) metric, 0};
+        memcpy(slot.data(), header, sizeof(header));
+        memcpy(slot.data() + STANDING_QUERY_SLOT_HEADER_SIZE, embedding.data(), embedding_size * sizeof(float));
+        if(file.write(slot.data(), slot.size()) != 0)
+            return -1;
+        file.set_write_idx(); // a slot past a stale write_idx would be lost on a crash
+
+        Query query;
+        query.slot = offset;
+        query.active = true;
+        query.k = k;
+        query.metric = metric;
+        query.embedding = embedding;
+        query.heap = top_k;
+        std::make_heap(query.heap.begin(), query.heap.end());
+        queries.push_back(std::move(query));
+        persist(queries.back());
+        return queries.size() - 1;
+    }
+
+    // -1 if there is no such query
+    int remove(uint32_t id){
+        if(id >= queries.size() || !queries[id].active || file.read_only)
+            return -1;
+        queries[id].active = false;
+        queries[id].heap.clear();
+        uint32_t inactive = 0;
+        file.write(&inactive, sizeof(uint32_t), queries[id].slot);
+        return 0;
+    }
+
+    // the query's current top-k, best first. empty for an unknown id
+    std::vector<ScoredRow> get(uint32_t id){
+        if(id >= queries.size() || !queries[id].active)
+            return {};
+        std::vector<ScoredRow> sorted = queries[id].heap;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted;
+    }
+
+    uint32_t size(){
+        uint32_t active = 0;
+        for(const Query& query : queries){
+            active += query.active;
+        }
+        return active;
+    }
+
+    // scores rows [rows scored, end) against every active query -- query by query, so the new rows stay in cache
+    // while each query is read once -- and records what entered and left each top-k. rows points at row 0
+    void score_rows(char* rows, uint32_t row_size, ElementType element_type, uint32_t kernel_dimension, uint32_t end){
+        uint32_t start = get_rows_scored();
+        if(start >= end || file.read_only)
+            return;
+        ScanCounters counters;
+        for(uint32_t id = 0; id < queries.size(); id++){
+            Query& query = queries[id];
+            if(!query.active)
+                continue;
+            with_metric(query.metric, [&](auto metric_tag){
+                with_dimension(kernel_dimension, [&](auto dim){
+                    scan_rows<decltype(metric_tag)::value, dim.value>(
+                        query.embedding.data(), rows, row_size, embedding_size, element_type,
+                        start, end, query.k, DistanceScore(), query.heap, counters
+                    );
+                });
+            });
+
+            // only new rows can enter, and something left only if something entered -- the slot still has the
+            // old top-k to diff against
+            bool changed = false;
+            for(const ScoredRow& entry : query.heap){
+                if(entry.second >= start){
+                    changes.push_back({id, entry.second, entry.first, true});
+                    changed = true;
+                }
+            }
+            if(!changed)
+                continue;
+            char* slot = file.get_start_addr() + query.slot;
+            uint32_t count = char_to_uint32_t(slot + 12);
+            char* entries = slot + STANDING_QUERY_SLOT_HEADER_SIZE + embedding_size * sizeof(float);
+            for(uint32_t i = 0; i < count; i++){
+                float score;
+                memcpy(&score, entries + i * 8, sizeof(float));
+                ScoredRow old = std::make_pair(score, char_to_uint32_t(entries + i * 8 + 4));
+                if(std::find(query.heap.begin(), query.heap.end(), old) == query.heap.end())
+                    changes.push_back({id, old.second, old.first, false});
+            }
+            persist(query);
+        }
+        file.write(&end, sizeof(uint32_t), 0);
+    }
+
+    // the changes since the last call, oldest first. they pile up until taken
+    std::vector<StandingQueryChange> take_changes(){
+        std::vector<StandingQueryChange> taken;
+        taken.swap(changes);
+        return taken;
+    }
+
+    FileWrapper& get_file(){
+        return file;
+    }
+
+    private:
+
+    uint64_t slot_size(uint32_t k){
+        return STANDING_QUERY_SLOT_HEADER_SIZE + (uint64_t) embedding_size * sizeof(float) + (uint64_t) k * 2 * sizeof(uint32_t);
+    }
+
+    // remaps the file at twice its size, or at least needed bytes. only slot offsets are kept across it, never pointers
+    bool grow(uint64_t needed){
+        uint64_t size = std::min(std::max(needed, 2 * (uint64_t) file.mmap_size), (uint64_t) MAX_UINT32);
+        if(size < needed)
+            return false;
+        file = FileWrapper(); // writes write_idx and unmaps
+        fs::resize_file(path, size);
+        file = FileWrapper(path, size, options);
+        return true;
+    }
+
+    void persist(const Query& query){
+        char* slot = file.get_start_addr() + query.slot;
+        uint32_t count = query.heap.size();
+        memcpy(slot + 12, &count, sizeof(uint32_t));
+        char* entries = slot + STANDING_QUERY_SLOT_HEADER_SIZE + embedding_size * sizeof(float);
+        for(uint32_t i = 0; i < count; i++){
+            memcpy(entries + i * 8, &query.heap[i].first, sizeof(float));
+            memcpy(entries + i * 8 + 4, &query.heap[i].second, sizeof(uint32_t));
+        }
+    }
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+
+#include "constants.h"
+#include "element_type.h"
+#include "dimensionality_reduction.h"
+#include "value_compression.h"
+#include "file_wrapper.h"
+
+namespace fs = std::filesystem;
+
+const uint32_t STORE_HEADER_MAGIC = 0x31485345; // "ESH1"
+const uint32_t STORE_HEADER_VERSION = 1;
+const uint32_t STORE_HEADER_FILE_SIZE = 4096;
+
+// per-store settings fixed at creation. fields are only ever appended: a header written before a field existed
+// is shorter, and the missing fields read as 0 (= off)
+struct StoreHeader {
+    uint32_t magic = STORE_HEADER_MAGIC;
+    uint32_t version = STORE_HEADER_VERSION;
+    uint32_t embedding_size = 0;
+    ElementType element_type = ElementType::float32;
+    uint32_t binary_quantization_enabled = 0;
+    ValueCodec value_codec = ValueCodec::none;
+    // the analyzer keys are made with, for both ingestion and queries -- see AnalyzerOptions
+    uint32_t analyzer_unicode = 0;
+    uint32_t analyzer_stem = 0;
+    uint32_t analyzer_ngram_size = 0;
+    // the reduced copy for get_k_closest_reduced, 0 dims when there is none
+    uint32_t reduced_dims = 0;
+    Reduction reduction = Reduction::none;
+};
+
+// magic, version, embedding_size and element_type -- every header written has at least these
+const uint32_t STORE_HEADER_MIN_SIZE = 4 * sizeof(uint32_t);
+
+// stores created before the header existed have no header file -- they are float32
+bool read_store_header(const fs::path& path, StoreHeader& header){
+    if(!fs::exists(path))
+        return false;
+
+    MmapOptions options;
+    options.read_only = true;
+    FileWrapper file(path, STORE_HEADER_FILE_SIZE, options);
+    uint32_t written = file.write_idx - DEFAULT_WRITE_IDX;
+    if(written < STORE_HEADER_MIN_SIZE)
+        return false;
+
+    header = StoreHeader();
+    memcpy(&header, file.get_start_addr(), std::min(written, (uint32_t) sizeof(StoreHeader)));
+    return header.magic == STORE_HEADER_MAGIC;
+}
+
+int write_store_header(const fs::path& path, const StoreHeader& header){
+    FileWrapper file(path, STORE_HEADER_FILE_SIZE);
+    file.write(&header, sizeof(StoreHeader), 0);
+    file.write_idx = std::max(file.write_idx, (uint32_t) (DEFAULT_WRITE_IDX + sizeof(StoreHeader)));
+    return 0;
+}
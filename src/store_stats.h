@@ -0,0 +1,192 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// counters are compiled in only with -DEMBEDDING_SEARCH_STATS (cmake -DEMBEDDING_SEARCH_STATS=ON), otherwise
+// every call below is an empty inline function and the hot paths are unchanged
+#ifdef EMBEDDING_SEARCH_STATS
+constexpr bool STATS_ENABLED = true;
+#else
+constexpr bool STATS_ENABLED = false;
+#endif
+
+// power of two buckets in microseconds: bucket i counts latencies in [2^(i-1), 2^i) us, bucket 0 is < 1us
+class LatencyHistogram {
+    public:
+    static const uint32_t NUM_BUCKETS = 32;
+
+    private:
+    std::atomic<uint64_t> buckets[NUM_BUCKETS] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_ns{0};
+
+    public:
+
+    void record(uint64_t ns){
+        uint64_t us = ns / 1000;
+        uint32_t bucket = us == 0 ? 0 : std::min(NUM_BUCKETS - 1, (uint32_t) (64 - __builtin_clzll(us)));
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // upper bound of the bucket holding the p-th percentile, in microseconds
+    double percentile_us(double p) const {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        if(n == 0)
+            return 0;
+        uint64_t target = std::max((uint64_t) 1, (uint64_t) (p * n + 0.5));
+        uint64_t seen = 0;
+        for(uint32_t i = 0; i < NUM_BUCKETS; i++){
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if(seen >= target)
+                return (double) (1ull << i);
+        }
+        return (double) (1ull << (NUM_BUCKETS - 1));
+    }
+
+    double mean_us() const {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        return n == 0 ? 0 : total_ns.load(std::memory_order_relaxed) / 1000.0 / n;
+    }
+
+    uint64_t get_count() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    void reset(){
+        for(auto& b : buckets)
+            b.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        total_ns.store(0, std::memory_order_relaxed);
+    }
+
+    void export_to(std::map<std::string, double>& out, const std::string& name) const {
+        out[name + "_count"] = get_count();
+        out[name + "_mean_us"] = mean_us();
+        out[name + "_p50_us"] = percentile_us(0.50);
+        out[name + "_p90_us"] = percentile_us(0.90);
+        out[name + "_p99_us"] = percentile_us(0.99);
+    }
+};
+
+struct StoreStats {
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> distance_evaluations{0};
+    std::atomic<uint64_t> rows_pruned{0};          // rows abandoned early because they could not beat the threshold
+    std::atomic<uint64_t> heap_operations{0};
+    std::atomic<uint64_t> inverted_index_lookups{0};
+    std::atomic<uint64_t> values_materialized{0};
+    std::atomic<uint64_t> value_bytes_materialized{0};
+    std::atomic<uint64_t> rows_ingested{0};
+    std::atomic<uint64_t> bytes_ingested{0};
+    std::atomic<uint64_t> minor_page_faults{0};    // during queries, process wide (getrusage)
+    std::atomic<uint64_t> major_page_faults{0};
+
+    LatencyHistogram query_latency;
+    LatencyHistogram scan_latency;
+    LatencyHistogram ingest_latency;
+
+    void add(std::atomic<uint64_t>& counter, uint64_t n){
+        if constexpr(STATS_ENABLED){
+            counter.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    void record(LatencyHistogram& histogram, std::chrono::steady_clock::time_point start){
+        if constexpr(STATS_ENABLED){
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+    std::chrono::steady_clock::time_point now(){
+        if constexpr(STATS_ENABLED){
+            return std::chrono::steady_clock::now();
+        }
+        return {};
+    }
+
+    void reset(){
+        for(auto* counter : {
+            &queries, &distance_evaluations, &rows_pruned, &heap_operations, &inverted_index_lookups,
+            &values_materialized, &value_bytes_materialized, &rows_ingested, &bytes_ingested,
+            &minor_page_faults, &major_page_faults
+        }){
+            counter->store(0, std::memory_order_relaxed);
+        }
+        query_latency.reset();
+        scan_latency.reset();
+        ingest_latency.reset();
+    }
+
+    std::map<std::string, double> to_map() const {
+        std::map<std::string, double> out;
+        out["enabled"] = STATS_ENABLED;
+        out["queries"] = queries.load();
+        out["distance_evaluations"] = distance_evaluations.load();
+        out["rows_pruned"] = rows_pruned.load();
+        out["heap_operations"] = heap_operations.load();
+        out["inverted_index_lookups"] = inverted_index_lookups.load();
+        out["values_materialized"] = values_materialized.load();
+        out["value_bytes_materialized"] = value_bytes_materialized.load();
+        out["rows_ingested"] = rows_ingested.load();
+        out["bytes_ingested"] = bytes_ingested.load();
+        out["minor_page_faults"] = minor_page_faults.load();
+        out["major_page_faults"] = major_page_faults.load();
+        query_latency.export_to(out, "query_latency");
+        scan_latency.export_to(out, "scan_latency");
+        ingest_latency.export_to(out, "ingest_latency");
+        return out;
+    }
+};
+
+// counts the page faults taken by the whole process while it is alive -- scan threads included
+class PageFaultScope {
+    StoreStats& stats;
+    long minor_start = 0;
+    long major_start = 0;
+
+    public:
+
+    PageFaultScope(StoreStats& stats) : stats(stats) {
+        if constexpr(STATS_ENABLED){
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            minor_start = usage.ru_minflt;
+            major_start = usage.ru_majflt;
+        }
+    }
+
+    ~PageFaultScope(){
+        if constexpr(STATS_ENABLED){
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            stats.add(stats.minor_page_faults, usage.ru_minflt - minor_start);
+            stats.add(stats.major_page_faults, usage.ru_majflt - major_start);
+        }
+    }
+};
+
+// fraction of a mapping currently in the page cache, via mincore -- available with or without the counters
+double resident_fraction(char* addr, uint32_t size){
+    if(!addr || size == 0)
+        return 0;
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t num_pages = (size + page_size - 1) / page_size;
+    std::vector<unsigned char> residency(num_pages);
+    if(mincore(addr, size, residency.data()) != 0)
+        return 0;
+
+    size_t resident = 0;
+    for(unsigned char r : residency)
+        resident += r & 1;
+    return (double) resident / num_pages;
+}
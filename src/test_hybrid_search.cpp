@@ -1,5 +1,7 @@
 #include <vector>
 #include <iostream>
+#include <thread>
+#include <atomic>
 
 #include "embedding_store.h"
 #include "test_utils.h"
@@ -127,4 +129,355 @@ int main(int argc, char** argv){
         std::cout << "PASSED" << std::endl;
     }   
 
+    {
+        TestWrapper tw("test_files/reload_hybrid_search_test");
+
+        std::cout << "TEST -- RELOAD" << std::endl;
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024, true);
+            int code = add_embeddings(store, {
+                {{1.0, 1.0}, "quidditch match"},
+                {{0.0, 1.0}, "potions class"},
+            });
+            ASSERT(code == 0);
+        }
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024, true);
+            ASSERT(store.add_embedding({1.0, 0.0}, "quidditch practice") == 0);
+
+            auto closest = store.get_k_closest_hybrid_weighted(
+                "quidditch", {0.0, 1.0}, 2, 1, DistanceMetric::cosine_similarity, 1
+            );
+            ASSERT(closest.size() == 2);
+            ASSERT(closest[0].second == "quidditch match" || closest[0].second == "quidditch practice");
+            ASSERT(closest[1].second == "quidditch match" || closest[1].second == "quidditch practice");
+
+            // no key matches -- falls back to plain vector order instead of crashing
+            auto no_match = store.get_k_closest_hybrid_weighted(
+                "basilisk", {0.0, 1.0}, 1, 2, DistanceMetric::cosine_similarity, 0.5
+            );
+            ASSERT(no_match.size() == 1);
+            ASSERT(no_match[0].second == "potions class");
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/hybrid_snapshot_test");
+        std::cout << "TEST -- SNAPSHOT" << std::endl;
+
+        fs::path store_dir = tw.get_dir_path() / "live";
+        fs::path snapshot_dir = tw.get_dir_path() / "snapshot";
+        EmbeddingStore store(store_dir.c_str(), 2, 64 * 1024, 64 * 1024, true);
+        ASSERT(add_embeddings(store, {
+            {{1.0, 1.0}, "quidditch match"},
+            {{0.0, 1.0}, "potions class"},
+        }) == 0);
+
+        // a writer keeps going while the snapshot is taken
+        std::atomic<bool> done(false);
+        std::thread writer([&](){
+            for(uint32_t i = 0; i < 500 && !done; i++){
+                store.add_embedding({1.0, (float) i}, "row" + std::to_string(i));
+            }
+        });
+        ASSERT(store.snapshot(snapshot_dir.c_str()) == 0);
+        done = true;
+        writer.join();
+        ASSERT(store.snapshot(snapshot_dir.c_str()) == -1); // not empty any more
+
+        // racing snapshots into one new dir: exactly one of them gets it
+        fs::path raced_dir = tw.get_dir_path() / "raced";
+        std::vector<int> codes(4);
+        std::vector<std::thread> snapshotters;
+        for(uint32_t t = 0; t < codes.size(); t++){
+            snapshotters.emplace_back([&, t](){ codes[t] = store.snapshot(raced_dir.c_str()); });
+        }
+        for(auto& t : snapshotters){
+            t.join();
+        }
+        ASSERT(std::count(codes.begin(), codes.end(), 0) == 1 && std::count(codes.begin(), codes.end(), -1) == 3);
+
+        {
+            EmbeddingStore copy(snapshot_dir.c_str(), 2, 64 * 1024, 64 * 1024, true);
+            uint32_t rows = copy.get_num_embeddings();
+            ASSERT(rows >= 2 && rows <= store.get_num_embeddings());
+            // every row that made it in is complete
+            for(uint32_t i = 0; i < rows; i++){
+                ASSERT(copy.get_value(i) == store.get_value(i));
+            }
+            auto closest = copy.get_k_closest_hybrid_weighted("quidditch", {0.0, 1.0}, 1, 1, DistanceMetric::cosine_similarity, 1);
+            ASSERT(closest.size() == 1 && closest[0].second == "quidditch match");
+
+            // the copy is an independent, writable store
+            ASSERT(copy.add_embedding({-1.0, -1.0}, "seeded replica") == 0);
+            ASSERT(copy.get_num_embeddings() == rows + 1);
+        }
+        auto reopened = EmbeddingStore::open_read_only(snapshot_dir.c_str(), 2, true);
+        ASSERT(reopened.get_k_closest({-1.0, -1.0}, 1, 1, DistanceMetric::cosine_similarity)[0].second == "seeded replica");
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/boolean_query_hybrid_search_test");
+
+        std::cout << "TEST -- BOOLEAN QUERY FILTER..." << std::endl;
+        std::string line_1 = "harry potter and the chamber of secrets";
+        std::string line_2 = "potter harry";
+        std::string line_3 = "the chamber of commerce";
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024, true);
+            ASSERT(add_embeddings(store, {
+                {{1.0, 0.0}, line_1},
+                {{0.0, 1.0}, line_2},
+            }) == 0);
+            ASSERT(store.add_object({{1.0, 1.0}, {0.9, 1.0}}, line_3) == 0); // rows 2 and 3
+
+            auto rows = store.match_query("chamber");
+            ASSERT(rows.size() == 3 && rows[0] == 0 && rows[1] == 2 && rows[2] == 3);
+            ASSERT(store.match_query("\"harry potter\"").size() == 1);
+
+            // hard filter: the closest row overall doesn't match
+            auto closest = store.get_k_closest_matching("\"harry potter\"", {0.0, 1.0}, 3, 1, DistanceMetric::cosine_similarity);
+            ASSERT(closest.size() == 1 && closest[0].second == line_1);
+            closest = store.get_k_closest_matching("chamber -harry", {1.0, 0.0}, 1, 1, DistanceMetric::l2_squared);
+            ASSERT(closest.size() == 1 && closest[0].second == line_3);
+
+            // a selective filter scores only its rows, a broad one scans with a mask -- both give the brute force answer
+            EmbeddingStore big((tw.get_dir_path() / "big").c_str(), 8, 1024 * 1024, 1024 * 1024, true);
+            std::mt19937 gen(3);
+            std::normal_distribution<float> dist(0, 1);
+            for(uint32_t i = 0; i < 3000; i++){
+                std::vector<float> row(8);
+                for(float& f : row){
+                    f = dist(gen);
+                }
+                std::string value = std::to_string(i) + (i % 100 == 7 ? " rare" : "") + (i % 2 ? " odd" : " even");
+                ASSERT(big.add_embedding(row, value) == 0);
+            }
+            std::vector<float> query(8, 0.5);
+            for(DistanceMetric metric : {DistanceMetric::cosine_similarity, DistanceMetric::l2_squared, DistanceMetric::manhattan}){
+                for(std::string word : {"rare", "odd"}){
+                    std::vector<std::pair<float, std::string>> expected;
+                    for(auto& r : big.get_k_closest(query, 3000, 1, metric)){
+                        if(r.second.find(" " + word) != std::string::npos && expected.size() < 10)
+                            expected.push_back(r);
+                    }
+                    big.reset_stats();
+                    ASSERT(big.get_k_closest_matching(word, query, 10, 2, metric) == expected);
+                    if(STATS_ENABLED){
+                        double evaluated = big.stats()["distance_evaluations"];
+                        ASSERT(word == "rare" ? evaluated == 30 : evaluated > 30);
+                    }
+                }
+                ASSERT(big.get_k_closest_matching("rare", query, 0, 1, metric).empty());
+                ASSERT(big.get_k_closest_matching("rare", query, 100, 1, metric).size() == 30);
+            }
+
+            // hybrid: with all the weight on keywords, matches beat closer rows
+            closest = store.get_k_closest_hybrid_query("harry -chamber", {1.0, 0.0}, 2, 1, DistanceMetric::cosine_similarity, 0.9);
+            ASSERT(closest.size() == 2 && closest[0].second == line_2);
+        }
+
+        // rows written while the positional index didn't exist are indexed from the object store on open
+        fs::remove(tw.get_dir_path() / POSITIONAL_INDEX_FN);
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024, true);
+            ASSERT(store.match_query("chamber").size() == 3);
+            ASSERT(store.add_embedding({0.5, 0.5}, "secret chamber") == 0);
+            ASSERT(store.match_query("chamber").size() == 4);
+        }
+        auto store = EmbeddingStore::open_read_only(tw.get_dir_path().c_str(), 2, true);
+        ASSERT(store.match_query("\"secret chamber\" OR commerce").size() == 3);
+
+        // boolean queries while adds grow the postings and a rebuild replaces the index
+        {
+            EmbeddingStore live((tw.get_dir_path() / "live").c_str(), 2, 1024 * 1024, 1024 * 1024, true);
+            std::atomic<bool> done{false};
+            std::atomic<uint32_t> queries{0};
+            std::vector<std::thread> readers;
+            for(int r = 0; r < 2; r++){
+                readers.emplace_back([&](){
+                    size_t last = 0;
+                    while(!done){
+                        size_t matched = live.match_query("zebra OR \"quokka 3\"").size();
+                        ASSERT(matched >= last); // rows are only ever added
+                        last = matched;
+                        queries++;
+                    }
+                });
+            }
+            for(uint32_t i = 0; i < 2000; i++){
+                ASSERT(live.add_embedding({1.0, (float) i}, "zebra quokka " + std::to_string(i % 10) + " term" + std::to_string(i)) == 0);
+                if(i % 500 == 499)
+                    ASSERT(live.rebuild_inverted_index(2) == 0);
+            }
+            while(queries < 10)
+                std::this_thread::yield();
+            done = true;
+            for(auto& t : readers){
+                t.join();
+            }
+            ASSERT(live.match_query("zebra").size() == 2000);
+
+            // hybrid queries while rebuilds swap the inverted index underneath them
+            done = false;
+            std::thread hybrid_reader([&](){
+                while(!done){
+                    auto result = live.get_k_closest_hybrid_weighted("quokka", {1.0, 1.0}, 5);
+                    ASSERT(result.size() == 5);
+                    for(auto& [score, value] : result)
+                        ASSERT(value.find("zebra quokka") == 0);
+                }
+            });
+            for(int i = 0; i < 5; i++)
+                ASSERT(live.rebuild_inverted_index(2) == 0);
+            done = true;
+            hybrid_reader.join();
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/analyzer_hybrid_search_test");
+
+        std::cout << "TEST -- ANALYZER OPTIONS..." << std::endl;
+        AnalyzerOptions options;
+        options.unicode = true;
+        options.stem = true;
+        options.ngram_size = 3;
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024, true);
+            ASSERT(store.set_analyzer(options) == 0);
+            ASSERT(add_embeddings(store, {
+                {{1.0, 0.0}, "The runner was running uphill"},
+                {{0.0, 1.0}, "Caf\xc3\xa9 society"},
+                {{1.0, 1.0}, "harry potter"}
+            }) == 0);
+            AnalyzerOptions other;
+            ASSERT(store.set_analyzer(other) == -2);
+
+            ASSERT(store.match_query("runs").size() == 1);
+            ASSERT(store.match_query("\"runs uphill\"").size() == 1);
+            ASSERT(store.match_query("cafe")[0] == 1);
+
+            // the typo shares most of its trigrams with the right value
+            auto closest = store.get_k_closest_hybrid_weighted("pottter", {1.0, 0.0}, 1, 1, DistanceMetric::cosine_similarity, 1);
+            ASSERT(closest.size() == 1 && closest[0].second == "harry potter");
+        }
+
+        // the options come back from the header, so queries are analyzed like the stored values were
+        auto store = EmbeddingStore::open_read_only(tw.get_dir_path().c_str(), 2, true);
+        ASSERT(store.get_analyzer_options().stem && store.get_analyzer_options().ngram_size == 3);
+        ASSERT(store.match_query("RUNNING -societies").size() == 1);
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/rebuild_index_hybrid_search_test");
+
+        std::cout << "TEST -- REBUILD INVERTED INDEX..." << std::endl;
+        fs::path built_dir = tw.get_dir_path() / "built";
+        fs::path rebuilt_dir = tw.get_dir_path() / "rebuilt";
+        std::vector<std::string> words = {"potter", "weasley", "granger", "quidditch", "hogwarts", "butterbeer", "internationalization"};
+        std::vector<std::string> values;
+        {
+            EmbeddingStore built(built_dir.c_str(), 2, 64 * 1024, 64 * 1024, true);
+            EmbeddingStore rebuilt(rebuilt_dir.c_str(), 2, 64 * 1024, 64 * 1024, false); // no hybrid search yet
+            for(uint32_t i = 0; i < 200; i++){
+                std::string value = words[i % words.size()] + " " + words[(i * 3) % words.size()] + " " + words[i % 2];
+                std::vector<std::vector<float>> rows(1 + i % 3, std::vector<float>{1.0f, (float) i}); // objects of 1-3 rows
+                ASSERT(built.add_object(rows, value) == 0);
+                ASSERT(rebuilt.add_object(rows, value) == 0);
+            }
+        }
+        {
+            // opened without hybrid search, like the CLI does: the indexes are created by the rebuild itself, and
+            // runs of 100 pairs make every thread spill several
+            EmbeddingStore rebuilt(rebuilt_dir.c_str(), 2, 64 * 1024, 64 * 1024, false);
+            ASSERT(!fs::exists(rebuilt_dir / POSITIONAL_INDEX_FN));
+            ASSERT(rebuilt.rebuild_inverted_index(3, 100) == 0);
+            auto closest = rebuilt.get_k_closest_hybrid_weighted("butterbeer", {0.0, 1.0}, 5, 1, DistanceMetric::cosine_similarity, 1);
+            ASSERT(closest.size() == 5 && closest[0].second.find("butterbeer") != std::string::npos);
+            ASSERT(rebuilt.rebuild_inverted_index(7) == 0); // idempotent
+            ASSERT(rebuilt.rebuild_inverted_index(2, 1) == 0);
+            for(const auto& entry : fs::directory_iterator(rebuilt_dir)){
+                ASSERT(entry.path().filename().string().find(".run") == std::string::npos);
+                ASSERT(entry.path().filename().string().find(".rebuild") == std::string::npos);
+            }
+        }
+        {
+            // the rebuilt positional log covers every row, so opening with hybrid search has nothing left to index
+            EmbeddingStore built(built_dir.c_str(), 2, 64 * 1024, 64 * 1024, true);
+            EmbeddingStore rebuilt(rebuilt_dir.c_str(), 2, 64 * 1024, 64 * 1024, true);
+            MmapOptions read_only;
+            read_only.read_only = true;
+            PositionalIndex built_log(built_dir.c_str(), 0, read_only);
+            PositionalIndex rebuilt_log(rebuilt_dir.c_str(), 0, read_only);
+            ASSERT(rebuilt_log.get_num_rows() == rebuilt.get_num_embeddings());
+            FileWrapper& a = built_log.get_file();
+            FileWrapper& b = rebuilt_log.get_file();
+            ASSERT(a.write_idx == b.write_idx && memcmp(a.get_start_addr(), b.get_start_addr(), a.write_idx - DEFAULT_WRITE_IDX) == 0);
+            for(std::string query : {"potter", "\"granger potter\"", "hogwarts -potter", "butterbeer OR quidditch"}){
+                ASSERT(!built.match_query(query).empty());
+                ASSERT(rebuilt.match_query(query) == built.match_query(query));
+            }
+        }
+
+        // the merged index holds exactly what inserting one object at a time produced
+        InvertedIndex built_index(built_dir.c_str(), 64 * 1024);
+        InvertedIndex rebuilt_index(rebuilt_dir.c_str(), 64 * 1024);
+        ASSERT(rebuilt_index.get_num_keys() <= built_index.get_num_keys());
+        for(const std::string& word : words){
+            std::vector<uint32_t> expected = built_index.search(word);
+            std::vector<uint32_t> found = rebuilt_index.search(word);
+            std::sort(expected.begin(), expected.end());
+            std::sort(found.begin(), found.end());
+            ASSERT(!found.empty() && found == expected);
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+
+    {
+        TestWrapper tw("test_files/full_index_hybrid_search_test");
+
+        std::cout << "TEST -- FULL INVERTED INDEX..." << std::endl;
+        // a 64 KB embedding store caps the inverted index at 32 KB: 511 blocks, 40 per object of 40 new keys
+        EmbeddingStore store(tw.get_dir_path().c_str(), 128, 64 * 1024, 1024 * 1024, true);
+        std::vector<std::string> values;
+        int code = 0;
+        for(uint32_t row = 0; row < 120 && code == 0; row++){
+            std::string value;
+            for(uint32_t w = 0; w < 40; w++){
+                value += "word" + std::to_string(row * 40 + w) + " ";
+            }
+            std::vector<float> embedding(128, 0);
+            embedding[row] = 1;
+            code = store.add_embedding(embedding, value);
+            if(code == 0)
+                values.push_back(value);
+        }
+        // refused whole instead of stored with keys missing
+        ASSERT(code == -8);
+        ASSERT(values.size() == 12 && store.get_num_embeddings() == 12);
+
+        // every stored row is found by its last key, though the vector points elsewhere
+        for(uint32_t row = 0; row < values.size(); row++){
+            std::vector<float> query(128, 0);
+            query[127 - row] = 1;
+            auto closest = store.get_k_closest_hybrid_weighted(
+                "word" + std::to_string(row * 40 + 39), query, 1, 1, DistanceMetric::cosine_similarity, 1
+            );
+            ASSERT(closest.size() == 1 && closest[0].second == values[row]);
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
 }
\ No newline at end of file
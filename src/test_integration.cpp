@@ -4,8 +4,13 @@
 #include <filesystem>
 #include <stdint.h>
 #include <unordered_set>
+#include <random>
+#include <map>
+#include <thread>
+#include <atomic>
 
 #include "embedding_store.h"
+#include "search_cursor.h"
 #include "test_utils.h"
 
 int main(int argc, char** argv){
@@ -139,6 +144,43 @@ int main(int argc, char** argv){
         std::cout << "PASSED" << std::endl;
     }
 
+    {
+        TestWrapper tw("test_files/concurrent_add_test");
+        std::cout << "TEST -- SEARCH WHILE ADDING..." << std::endl;
+
+        // searches only ever see rows whose object is completely written
+        EmbeddingStore store(tw.get_dir_path().c_str(), 4, 1024 * 1024, 1024 * 1024);
+        const uint32_t num_objects = 10000;
+        std::atomic<bool> done{false};
+        std::atomic<uint32_t> searches{0};
+        std::vector<std::thread> readers;
+        for(uint32_t threads : {1u, 4u}){
+            readers.emplace_back([&, threads](){
+                while(!done){
+                    uint32_t seen = store.get_num_embeddings();
+                    auto closest = store.get_k_closest({1, 0, 0, 1}, 5, threads, DistanceMetric::l2_squared);
+                    ASSERT(closest.size() >= std::min(5u, seen)); // rows are only ever added
+                    for(auto& [distance, value] : closest){
+                        ASSERT(std::stoul(value) < num_objects);
+                    }
+                    searches++;
+                }
+            });
+        }
+        for(uint32_t i = 0; i < num_objects; i++){
+            ASSERT(store.add_embedding({(float) i, 0, 0, 1}, std::to_string(i)) == 0);
+        }
+        while(searches < 10)
+            std::this_thread::yield();
+        done = true;
+        for(auto& t : readers){
+            t.join();
+        }
+        ASSERT(store.get_k_closest({1, 0, 0, 1}, 1, 4, DistanceMetric::l2_squared)[0].second == "1");
+
+        std::cout << "PASSED" << std::endl;
+    }
+
     {
         TestWrapper tw("test_files/multi_dim_test");
         std::cout << "TEST -- MULTI DIM..." << std::endl;
@@ -165,5 +207,1100 @@ int main(int argc, char** argv){
         std::cout << "PASSED" << std::endl;
     }
 
+    {
+        TestWrapper tw("test_files/read_only_test");
+        std::cout << "TEST -- READ ONLY..." << std::endl;
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024);
+            add_embeddings(store, {
+                {{0.2, 0.3}, "horse"}, {{0.2, 0.4}, "basketball"}, {{1.2, 2.5}, "football"}
+            });
+        }
+        {
+            MmapOptions options;
+            options.advice = MmapAdvice::sequential;
+            options.populate = true;
+            options.huge_pages = true;
+            EmbeddingStore store = EmbeddingStore::open_read_only(tw.get_dir_path().c_str(), 2, false, options);
+            store.warm_up();
+
+            auto closest = store.get_k_closest({0.2, 0.3}, 3, 2, DistanceMetric::cosine_similarity);
+            ASSERT(closest.size() == 3);
+            ASSERT(closest[0].second == "horse");
+            ASSERT(closest[1].second == "basketball");
+            ASSERT(closest[2].second == "football");
+
+            ASSERT(store.add_embedding({0.7, 0.7}, "nascar") < 0);
+
+            // a second reader can map the same files at the same time
+            EmbeddingStore other = EmbeddingStore::open_read_only(tw.get_dir_path().c_str(), 2);
+            ASSERT(other.get_k_closest({1.2, 2.5}, 1, 1, DistanceMetric::cosine_similarity)[0].second == "football");
+        }
+
+        bool threw = false;
+        try{
+            EmbeddingStore::open_read_only((tw.get_dir_path() / "missing").c_str(), 2);
+        }catch(const std::runtime_error& e){
+            threw = true;
+        }
+        ASSERT(threw);
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/half_precision_test");
+        std::cout << "TEST -- HALF PRECISION..." << std::endl;
+
+        for(float f : {0.f, 1.f, -2.5f, 0.333251953125f, 65504.f, 6.103515625e-05f}){
+            ASSERT(half_to_float(float_to_half(f)) == f);
+        }
+        ASSERT(bfloat16_to_float(float_to_bfloat16(-3.5f)) == -3.5f);
+
+        std::vector<float> src(37);
+        for(size_t i = 0; i < src.size(); i++)
+            src[i] = (float) i / 7 - 2;
+        for(ElementType element_type : {ElementType::float16, ElementType::bfloat16}){
+            std::vector<char> encoded;
+            encode_elements(element_type, src.data(), src.size(), encoded);
+            std::vector<float> decoded(src.size());
+            decode_elements(element_type, encoded.data(), decoded.data(), src.size());
+            for(size_t i = 0; i < src.size(); i++)
+                ASSERT(std::abs(decoded[i] - src[i]) < 2e-2);
+        }
+
+        for(ElementType element_type : {ElementType::float16, ElementType::bfloat16}){
+            fs::path dir = tw.get_dir_path() / std::to_string((uint32_t) element_type);
+            {
+                EmbeddingStore store(dir.c_str(), 3, 1024, 1024, false, element_type);
+                add_embeddings(store, {
+                    {{0.2, 0.3, 0.1}, "horse"}, {{0.2, 0.4, 0.1}, "basketball"}, {{1.2, 2.5, -3}, "football"}
+                });
+                auto closest = store.get_k_closest({0.2, 0.3, 0.1}, 3, 1, DistanceMetric::l2_squared);
+                ASSERT(closest.size() == 3);
+                ASSERT(closest[0].second == "horse");
+                ASSERT(closest[0].first < 1e-4);
+            }
+            {
+                // the element type is read back from the header, not from the arguments
+                EmbeddingStore store(dir.c_str(), 3);
+                ASSERT(store.get_element_type() == element_type);
+                ASSERT(fs::file_size(dir / EMBEDDING_STORE_FN) == 1024);
+                store.add_embedding({0.7, 0.7, 0.7}, "nascar");
+
+                auto closest = store.get_k_closest({0.7, 0.7, 0.7}, 4, 2, DistanceMetric::cosine_similarity);
+                ASSERT(closest.size() == 4);
+                ASSERT(closest[0].second == "nascar");
+                ASSERT(closest[3].second == "football");
+            }
+            {
+                // a header written before the fields after element_type existed -- only the first four were written
+                FileWrapper header_file(dir / STORE_HEADER_FN, STORE_HEADER_FILE_SIZE);
+                memset(header_file.get_start_addr() + STORE_HEADER_MIN_SIZE, 0xff, sizeof(StoreHeader) - STORE_HEADER_MIN_SIZE);
+                header_file.write_idx = DEFAULT_WRITE_IDX + STORE_HEADER_MIN_SIZE;
+            }
+            {
+                EmbeddingStore store(dir.c_str(), 3);
+                ASSERT(store.get_element_type() == element_type);
+                ASSERT(store.get_num_embeddings() == 4);
+                ASSERT(!store.binary_quantization_enabled());
+                ASSERT(store.get_reduction() == Reduction::none);
+
+                auto closest = store.get_k_closest({0.2, 0.3, 0.1}, 1, 1, DistanceMetric::l2_squared);
+                ASSERT(closest[0].second == "horse");
+                ASSERT(closest[0].first < 1e-4);
+            }
+        }
+
+        bool threw = false;
+        try{
+            EmbeddingStore store((tw.get_dir_path() / "1").c_str(), 4);
+        }catch(const std::runtime_error& e){
+            threw = true;
+        }
+        ASSERT(threw);
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/binary_quantization_test");
+        std::cout << "TEST -- BINARY QUANTIZATION..." << std::endl;
+
+        std::mt19937 gen(42);
+        std::normal_distribution<float> dist(0, 1);
+        auto random_embedding = [&](){
+            std::vector<float> embedding(32);
+            for(float& f : embedding)
+                f = dist(gen);
+            return embedding;
+        };
+
+        std::vector<std::vector<float>> embeddings;
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 32, 1 << 16, 1 << 16);
+            for(int i = 0; i < 100; i++){
+                embeddings.push_back(random_embedding());
+                store.add_embedding(embeddings.back(), std::to_string(i));
+            }
+            ASSERT(!store.binary_quantization_enabled());
+            ASSERT(store.enable_binary_quantization() == 0); // backfills the rows above
+            for(int i = 100; i < 200; i++){
+                embeddings.push_back(random_embedding());
+                store.add_embedding(embeddings.back(), std::to_string(i));
+            }
+        }
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 32);
+            ASSERT(store.binary_quantization_enabled());
+
+            for(int i : {3, 150}){
+                auto closest = store.get_k_closest_binary(embeddings[i], 5, 8, 3, DistanceMetric::l2_squared);
+                ASSERT(closest.size() == 5);
+                ASSERT(closest[0].second == std::to_string(i));
+                ASSERT(closest[0].first == 0);
+
+                // with every row as a candidate the re-rank is exact
+                auto exact = store.get_k_closest(embeddings[i], 5, 1, DistanceMetric::cosine_similarity);
+                auto full = store.get_k_closest_binary(embeddings[i], 5, 200, 2, DistanceMetric::cosine_similarity);
+                for(int j = 0; j < 5; j++)
+                    ASSERT(exact[j].second == full[j].second);
+            }
+        }
+        {
+            // enabled on a reopened store that has grown past the default sizes
+            fs::path dir = tw.get_dir_path() / "large";
+            {
+                EmbeddingStore store(dir.c_str(), 32, 4 << 20, 1 << 20);
+                for(int i = 0; i < 10000; i++)
+                    ASSERT(store.add_embedding(embeddings[i % embeddings.size()], "") == 0);
+            }
+            EmbeddingStore store(dir.c_str(), 32);
+            ASSERT(store.enable_binary_quantization() == 0);
+            ASSERT(store.add_embedding(embeddings[7], "last") == 0);
+            auto closest = store.get_k_closest_binary(embeddings[7], 1, 8);
+            ASSERT(closest.size() == 1);
+            ASSERT(closest[0].first < 1e-6);
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/radius_search_test");
+        std::cout << "TEST -- RADIUS SEARCH..." << std::endl;
+
+        EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024);
+        std::vector<float> keys = {1, 2, 3, 4, 5};
+        for(float k1 : keys){
+            for(float k2 : keys){
+                store.add_embedding({k1, k2}, std::to_string((int) k1) + std::to_string((int) k2));
+            }
+        }
+
+        auto within = store.search_radius({3, 3}, 1, DistanceMetric::l2_squared, 0, 4);
+        ASSERT(within.size() == 5);
+        ASSERT(within[0].first == 0 && within[0].second == "33");
+        for(auto [dist, value] : within){
+            ASSERT(dist <= 1);
+        }
+        std::unordered_set<std::string> values;
+        for(auto [dist, value] : within)
+            values.insert(value);
+        ASSERT(values == std::unordered_set<std::string>({"33", "23", "43", "32", "34"}));
+
+        ASSERT(store.search_radius({3, 3}, 2, DistanceMetric::manhattan).size() == 13);
+        ASSERT(store.search_radius({3, 3}, 2, DistanceMetric::manhattan, 3, 2).size() == 3);
+        ASSERT(store.search_radius({1, 1}, 1e-6, DistanceMetric::cosine_similarity).size() == 5);
+        ASSERT(store.search_radius({100, 100}, 1, DistanceMetric::l2_squared).empty());
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/stats_test");
+        std::cout << "TEST -- STATS..." << std::endl;
+
+        EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024);
+        std::vector<float> keys = {1, 2, 3, 4, 5};
+        for(float k1 : keys){
+            for(float k2 : keys){
+                store.add_embedding({k1, k2}, std::to_string((int) k1) + std::to_string((int) k2));
+            }
+        }
+        store.get_k_closest({1, 1}, 3, 2, DistanceMetric::cosine_similarity);
+        store.search_radius({3, 3}, 1, DistanceMetric::l2_squared);
+
+        auto stats = store.stats();
+        ASSERT(stats["num_embeddings"] == 25);
+        ASSERT(stats["embedding_store_resident_fraction"] > 0);
+        ASSERT(stats["enabled"] == STATS_ENABLED);
+        if(STATS_ENABLED){
+            ASSERT(stats["queries"] == 2);
+            ASSERT(stats["rows_ingested"] == 25);
+            ASSERT(stats["ingest_latency_count"] == 25);
+            ASSERT(stats["distance_evaluations"] >= 50);
+            ASSERT(stats["rows_pruned"] > 0);
+            ASSERT(stats["values_materialized"] == 3 + 5);
+            ASSERT(stats["query_latency_count"] == 2);
+            ASSERT(stats["query_latency_p99_us"] >= stats["query_latency_p50_us"]);
+
+            store.reset_stats();
+            ASSERT(store.stats()["queries"] == 0);
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/query_cache_test");
+        std::cout << "TEST -- QUERY CACHE..." << std::endl;
+
+        EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024);
+        std::vector<float> keys = {1, 2, 3, 4, 5};
+        for(float k1 : keys){
+            for(float k2 : keys){
+                store.add_embedding({k1, k2}, std::to_string((int) k1) + std::to_string((int) k2));
+            }
+        }
+        store.enable_query_cache(2);
+
+        auto first = store.get_k_closest({2.1, 3.9}, 3, 1, DistanceMetric::l2_squared);
+        auto second = store.get_k_closest({2.1, 3.9}, 3, 1, DistanceMetric::l2_squared);
+        ASSERT(first == second);
+        ASSERT(store.stats()["query_cache_hits"] == 1);
+
+        // float noise in the last bits still hits, a different k or metric does not
+        float noisy = std::nextafter(2.1f, 3.0f);
+        ASSERT(store.get_k_closest({noisy, 3.9}, 3, 1, DistanceMetric::l2_squared) == first);
+        ASSERT(store.stats()["query_cache_hits"] == 2);
+        store.get_k_closest({2.1, 3.9}, 2, 1, DistanceMetric::l2_squared);
+        store.get_k_closest({2.1, 3.9}, 3, 1, DistanceMetric::manhattan);
+        auto stats = store.stats();
+        ASSERT(stats["query_cache_misses"] == 3);
+        ASSERT(stats["query_cache_entries"] == 2);
+        ASSERT(stats["query_cache_evictions"] == 1);
+        ASSERT(close(stats["query_cache_hit_rate"], 2.0 / 5));
+
+        // an append invalidates what was cached before it
+        store.get_k_closest({2.1, 3.9}, 3, 1, DistanceMetric::manhattan);
+        store.add_embedding({2.1, 3.9}, "new");
+        auto fresh = store.get_k_closest({2.1, 3.9}, 3, 1, DistanceMetric::manhattan);
+        ASSERT(fresh[0].second == "new");
+        ASSERT(store.stats()["query_cache_invalidations"] == 1);
+
+        store.enable_query_cache(0);
+        ASSERT(!store.query_cache_enabled());
+        ASSERT(store.stats().count("query_cache_hits") == 0);
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/parallel_scan_test");
+        std::cout << "TEST -- PARALLEL SCAN..." << std::endl;
+
+        // ranges tile the rows exactly, on block boundaries
+        for(uint32_t num_rows : {0u, 1u, 7u, 1000u, 1025u}){
+            for(uint32_t parts : {1u, 2u, 3u, 8u}){
+                auto ranges = split_rows(num_rows, parts, 64);
+                ASSERT(ranges.size() == parts);
+                ASSERT(ranges.front().first == 0 && ranges.back().second == num_rows);
+                for(uint32_t p = 0; p + 1 < parts; p++){
+                    ASSERT(ranges[p].second == ranges[p + 1].first);
+                    ASSERT(ranges[p].second % 64 == 0 || ranges[p].second == num_rows);
+                }
+            }
+        }
+
+        uint32_t dims = 16;
+        uint32_t num_rows = 2000;
+        EmbeddingStore store(tw.get_dir_path().c_str(), dims, num_rows * dims * sizeof(float) + 1024, 64 * 1024);
+        std::mt19937 gen(7);
+        std::normal_distribution<float> dist(0, 1);
+        std::vector<float> query(dims);
+        for(uint32_t i = 0; i < num_rows; i++){
+            std::vector<float> embedding(dims);
+            for(float& x : embedding)
+                x = dist(gen);
+            ASSERT(store.add_embedding(embedding, std::to_string(i)) == 0);
+        }
+        for(float& x : query)
+            x = dist(gen);
+
+        // every row is scored exactly once, however the rows are split
+        for(auto metric : {DistanceMetric::cosine_similarity, DistanceMetric::manhattan, DistanceMetric::l2_squared}){
+            auto expected = store.get_k_closest(query, 10, 1, metric);
+            ASSERT(expected.size() == 10);
+            for(uint32_t i = 1; i < expected.size(); i++){
+                ASSERT(expected[i - 1].first <= expected[i].first);
+            }
+            for(uint32_t num_threads : {2u, 3u, 4u}){
+                ASSERT(store.get_k_closest(query, 10, num_threads, metric) == expected);
+            }
+        }
+        ASSERT(store.get_k_closest(query, num_rows + 5, 3, DistanceMetric::l2_squared).size() == num_rows);
+        ASSERT(store.get_k_closest(query, 0, 3, DistanceMetric::l2_squared).empty());
+
+        if(STATS_ENABLED){
+            store.reset_stats();
+            store.get_k_closest(query, 10, 3, DistanceMetric::l2_squared);
+            auto stats = store.stats();
+            ASSERT(stats["distance_evaluations"] == num_rows);
+            ASSERT(stats["rows_pruned"] > 0);
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/dimension_kernels_test");
+        std::cout << "TEST -- DIMENSION KERNELS..." << std::endl;
+
+        ASSERT(get_kernel_dimension(768) == 768);
+        ASSERT(get_kernel_dimension(100) == 0);
+
+        // the unrolled kernels agree with the generic ones up to summation order
+        std::mt19937 gen(11);
+        std::normal_distribution<float> dist(0, 1);
+        auto near = [](float a, float b){ return std::abs(a - b) <= 1e-4 * std::max(1.0f, std::abs(b)); };
+        std::vector<float> a(768), b(768);
+        for(uint32_t i = 0; i < 768; i++){
+            a[i] = dist(gen);
+            b[i] = dist(gen);
+        }
+        char* row = (char*) b.data();
+        float max = std::numeric_limits<float>::max();
+        ASSERT(near(
+            (compute_distance<DistanceMetric::cosine_similarity, 768>(a.data(), row, 768, max, ElementType::float32)),
+            (compute_distance<DistanceMetric::cosine_similarity, 0>(a.data(), row, 768, max, ElementType::float32))));
+        float l1 = compute_distance<DistanceMetric::manhattan, 0>(a.data(), row, 768, max, ElementType::float32);
+        ASSERT(near((compute_distance<DistanceMetric::manhattan, 768>(a.data(), row, 768, max, ElementType::float32)), l1));
+        ASSERT(near(
+            (compute_distance<DistanceMetric::l2_squared, 768>(a.data(), row, 768, max, ElementType::float32)),
+            (compute_distance<DistanceMetric::l2_squared, 0>(a.data(), row, 768, max, ElementType::float32))));
+        ASSERT((compute_distance<DistanceMetric::manhattan, 768>(a.data(), row, 768, l1 / 2, ElementType::float32)) == max);
+        ASSERT(close(compute_distance(a.data(), (char*) a.data(), 768, DistanceMetric::cosine_similarity), 0));
+
+        std::vector<char> half;
+        encode_elements(ElementType::float16, b.data(), 768, half);
+        ASSERT(near(
+            (compute_distance<DistanceMetric::l2_squared, 768>(a.data(), half.data(), 768, max, ElementType::float16)),
+            (compute_distance<DistanceMetric::l2_squared, 0>(a.data(), half.data(), 768, max, ElementType::float16))));
+
+        // every search path scores a row the same way
+        uint32_t dims = 128;
+        EmbeddingStore store(tw.get_dir_path().c_str(), dims, 200 * dims * sizeof(float) + 1024, 64 * 1024);
+        std::vector<float> query(dims);
+        for(uint32_t i = 0; i < 200; i++){
+            std::vector<float> embedding(dims);
+            for(float& x : embedding)
+                x = dist(gen);
+            store.add_embedding(embedding, std::to_string(i));
+        }
+        for(float& x : query)
+            x = dist(gen);
+        ASSERT(store.enable_binary_quantization() == 0);
+        for(auto metric : {DistanceMetric::cosine_similarity, DistanceMetric::l2_squared, DistanceMetric::manhattan}){
+            auto exact = store.get_k_closest(query, 5, 2, metric);
+            if(metric != DistanceMetric::manhattan)
+                ASSERT(store.get_k_closest_binary(query, 5, 200, 1, metric) == exact);
+            auto radius = store.search_radius(query, exact[4].first, metric);
+            radius.resize(5);
+            ASSERT(radius == exact);
+            // split across threads the radius scan still finds every row within r, and stops at max_results
+            auto threaded = store.search_radius(query, exact[4].first, metric, 0, 4);
+            threaded.resize(5);
+            ASSERT(threaded == exact);
+            auto capped = store.search_radius(query, exact[4].first, metric, 3, 4);
+            ASSERT(capped.size() == 3);
+            for(auto& [distance, value] : capped)
+                ASSERT(distance <= exact[4].first);
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/search_cursor_test");
+        std::cout << "TEST -- SEARCH CURSOR..." << std::endl;
+
+        uint32_t dims = 8;
+        uint32_t num_rows = 503;
+        EmbeddingStore store(tw.get_dir_path().c_str(), dims, num_rows * dims * sizeof(float) + 1024, 64 * 1024);
+        std::mt19937 gen(5);
+        std::uniform_int_distribution<int> dist(0, 3); // coarse values, so plenty of tied distances
+        std::vector<float> query(dims, 1);
+        for(uint32_t i = 0; i < num_rows; i++){
+            std::vector<float> embedding(dims);
+            for(float& x : embedding)
+                x = dist(gen);
+            store.add_embedding(embedding, std::to_string(i));
+        }
+
+        for(auto metric : {DistanceMetric::l2_squared, DistanceMetric::cosine_similarity}){
+            auto expected = store.get_k_closest(query, num_rows, 2, metric);
+            SearchCursor cursor(store, query, 10, 2, metric);
+            std::vector<std::pair<float, std::string>> paged;
+            uint32_t num_pages = 0;
+            while(true){
+                auto page = cursor.next_page();
+                if(page.empty())
+                    break;
+                ASSERT(page.size() == 10 || !cursor.has_next());
+                paged.insert(paged.end(), page.begin(), page.end());
+                num_pages++;
+            }
+            ASSERT(paged == expected);
+            ASSERT(num_pages == 51);
+            ASSERT(cursor.get_num_scans() == 13); // one per 4 pages
+            ASSERT(cursor.next_page().empty());
+        }
+
+        SearchCursor first_page(store, query, 5, 1, DistanceMetric::l2_squared);
+        ASSERT(first_page.next_page() == store.get_k_closest(query, 5, 1, DistanceMetric::l2_squared));
+
+        SearchCursor bad(store, {1, 2}, 5);
+        ASSERT(!bad.has_next());
+        ASSERT(bad.next_page().empty());
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/value_compression_test");
+        std::cout << "TEST -- VALUE COMPRESSION..." << std::endl;
+
+        std::mt19937 gen(3);
+        std::vector<std::string> words = {"embedding", "search", "store", "the", "of", "vector", "query", "index", "page"};
+        auto make_document = [&](uint32_t n){
+            std::string doc = "<html><head><title>Document</title></head><body class=\"article\">";
+            for(uint32_t i = 0; i < n; i++){
+                doc += words[gen() % words.size()] + " ";
+            }
+            return doc + "</body></html>";
+        };
+
+        // codec round trips, with and without the dictionary
+        std::string dictionary = train_value_dictionary({make_document(200), make_document(200), make_document(200)});
+        ASSERT(!dictionary.empty());
+        ZstdValueCodec codec(dictionary);
+        for(std::string input : {std::string(""), std::string("a"), std::string(1000, 'x'), make_document(500)}){
+            std::string output;
+            ASSERT(codec.decompress(codec.compress(input), input.size(), output));
+            ASSERT(output == input);
+        }
+        std::string doc = make_document(300);
+        std::string with_dictionary = codec.compress(doc);
+        ASSERT(with_dictionary.size() < ZstdValueCodec("").compress(doc).size());
+        ASSERT(with_dictionary.size() < doc.size() / 2);
+        std::string output;
+        ASSERT(!codec.decompress(with_dictionary.substr(0, with_dictionary.size() / 2), doc.size(), output));
+        ASSERT(!codec.decompress(with_dictionary, doc.size() + 1, output));
+
+        // fuzz: random inputs round trip, and corrupted frames -- flipped bits, truncated, garbage, wrong raw
+        // size -- decode to an error or to exactly raw_size bytes, never past the buffer
+        std::uniform_int_distribution<int> byte(0, 255);
+        for(uint32_t iteration = 0; iteration < 2000; iteration++){
+            std::string input;
+            uint32_t size = gen() % 3000;
+            uint32_t alphabet = 1 + gen() % 256; // small alphabets give long matches, large ones literals
+            for(uint32_t i = 0; i < size; i++){
+                input.push_back(gen() % 4 == 0 && i > 8 ? input[i - 1 - gen() % 8] : (char) (gen() % alphabet));
+            }
+            if(gen() % 2)
+                input += doc.substr(gen() % doc.size(), gen() % 200);
+
+            std::string frame = codec.compress(input);
+            ASSERT(codec.decompress(frame, input.size(), output) && output == input);
+
+            std::string corrupt = frame;
+            switch(gen() % 4){
+                case 0:
+                    for(uint32_t flips = 1 + gen() % 4; flips > 0 && !corrupt.empty(); flips--)
+                        corrupt[gen() % corrupt.size()] ^= 1 << (gen() % 8);
+                    break;
+                case 1:
+                    corrupt.resize(gen() % (corrupt.size() + 1));
+                    break;
+                case 2:
+                    for(char& c : corrupt)
+                        c = byte(gen);
+                    break;
+                case 3:
+                    break; // intact, but see the raw size below
+            }
+            uint32_t raw_size = gen() % 3 == 0 ? gen() % 4000 : input.size();
+            bool ok = codec.decompress(corrupt, raw_size, output);
+            ASSERT(output.size() == raw_size);
+            if(ok && corrupt == frame)
+                ASSERT(raw_size == input.size() && output == input);
+        }
+
+        std::vector<std::string> values;
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024 * 1024, 1024 * 1024);
+            store.add_embedding({1, 1}, "before");
+            std::vector<std::string> samples;
+            for(uint32_t i = 0; i < 50; i++)
+                samples.push_back(make_document(300));
+            ASSERT(store.enable_value_compression(samples) == 0);
+            ASSERT(store.value_compression_enabled());
+
+            uint32_t raw_bytes = 0;
+            for(uint32_t i = 0; i < 100; i++){
+                values.push_back(make_document(100 + i * 5));
+                raw_bytes += values.back().size() + sizeof(uint32_t);
+                ASSERT(store.add_embedding({1, (float) i + 2}, values.back()) == 0);
+            }
+            store.add_embedding({5, 5}, "tiny"); // would grow, stays raw
+
+            ASSERT(store.get_value(0) == "before");
+            ASSERT(*store.get_value_view(0) == "before");
+            ASSERT(*store.get_value_view(101) == "tiny");
+            ASSERT(!store.get_value_view(1));
+
+            // rows past the end throw instead of reading whatever is in the mmap
+            for(uint32_t row : {102u, 1000000u, MAX_UINT32}){
+                bool threw = false;
+                try{
+                    store.get_value(row);
+                }catch(const std::out_of_range& e){
+                    threw = true;
+                }
+                ASSERT(threw);
+                threw = false;
+                try{
+                    store.get_value_view(row);
+                }catch(const std::out_of_range& e){
+                    threw = true;
+                }
+                ASSERT(threw);
+            }
+
+            // search results as rows, with the raw values read in place
+            auto rows = store.get_k_closest_rows({5, 5}, 3, 2, DistanceMetric::l2_squared);
+            auto closest = store.get_k_closest({5, 5}, 3, 2, DistanceMetric::l2_squared);
+            ASSERT(rows.size() == 3 && rows[0].second == 101);
+            for(int i = 0; i < 3; i++){
+                ASSERT(rows[i].first == closest[i].first);
+                ASSERT(store.get_value(rows[i].second) == closest[i].second);
+            }
+            ASSERT(store.get_value_view(rows[0].second)->data() > store.get_value_view(0)->data());
+            for(uint32_t i = 0; i < 100; i++){
+                ASSERT(store.get_value(i + 1) == values[i]);
+            }
+            auto stats = store.stats();
+            ASSERT(stats["num_embeddings"] == 102);
+            ASSERT(stats["object_store_bytes"] < raw_bytes / 2);
+            ASSERT(store.get_k_closest({1, 3}, 1, 1, DistanceMetric::l2_squared)[0].second == values[1]);
+        }
+
+        // dictionary and flag survive a reopen
+        EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024 * 1024, 1024 * 1024);
+        ASSERT(store.value_compression_enabled());
+        for(uint32_t i = 0; i < 100; i++){
+            ASSERT(store.get_value(i + 1) == values[i]);
+        }
+        ASSERT(store.get_value(101) == "tiny");
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/multi_vector_test");
+        std::cout << "TEST -- MULTI VECTOR..." << std::endl;
+
+        EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024);
+        ASSERT(store.add_object({{1, 0}, {0.9, 0.1}, {0.8, 0.2}}, "three chunks about x") == 0);
+        ASSERT(store.add_object({{0, 1}}, "one chunk about y") == 0);
+        ASSERT(store.add_object({{0.7, 0.7}, {0, 1}}, "x and y") == 0);
+        ASSERT(store.add_embedding({-1, 0}, "opposite") == 0);
+        ASSERT(store.add_object({}, "empty") == -1);
+        ASSERT(store.add_object({{1, 0}, {1, 2, 3}}, "bad") == -1);
+        ASSERT(store.get_num_embeddings() == 7);
+
+        // the value is stored once and shared by the object's rows
+        ASSERT(store.get_object_store_offset(0) == store.get_object_store_offset(2));
+        ASSERT(store.get_value(2) == "three chunks about x");
+        ASSERT(store.stats()["object_store_bytes"] == 4 * sizeof(uint32_t) + 20 + 17 + 7 + 8);
+
+        // rows would return the same object three times, objects return it once
+        auto rows = store.get_k_closest({1, 0}, 3, 1, DistanceMetric::cosine_similarity);
+        ASSERT(rows[0].second == "three chunks about x" && rows[2].second == "three chunks about x");
+        auto objects = store.get_k_closest_objects({{1, 0}}, 3, 2, DistanceMetric::cosine_similarity);
+        ASSERT(objects.size() == 3);
+        ASSERT(objects[0].second == "three chunks about x" && close(objects[0].first, 0));
+        ASSERT(objects[1].second == "x and y");
+        ASSERT(objects[2].second == "one chunk about y");
+
+        // ColBERT-style: the best object has a close row for every query token
+        auto maxsim = store.get_k_closest_objects({{1, 0}, {0, 1}}, 2, 1, DistanceMetric::cosine_similarity);
+        ASSERT(maxsim[0].second == "x and y");
+        ASSERT(close(maxsim[0].first, compute_distance(std::vector<float>{1, 0}.data(), (char*) std::vector<float>{0.7, 0.7}.data(), 2, DistanceMetric::cosine_similarity)));
+
+        // sum: many matching rows beat one slightly better row
+        auto summed = store.get_k_closest_objects({{1, 0}}, 4, 1, DistanceMetric::cosine_similarity, Aggregation::sum);
+        ASSERT(summed[0].second == "three chunks about x");
+        ASSERT(summed[0].first < -2.9 && summed[3].second == "opposite");
+
+        ASSERT(store.get_k_closest_objects({{1, 0, 0}}, 4).empty());
+
+        // a value that doesn't fit is rejected before any of its rows are written
+        uint32_t object_store_bytes = store.stats()["object_store_bytes"];
+        ASSERT(store.add_object({{1, 1}, {2, 2}}, std::string(2000, 'x')) == -5);
+        ASSERT(store.get_num_embeddings() == 7);
+        ASSERT(store.stats()["object_store_bytes"] == object_store_bytes);
+        ASSERT(store.add_object({{1, 1}}, "fits") == 0);
+        ASSERT(store.get_value(7) == "fits");
+
+        // same answer however the rows are split across threads -- enough objects to span many scan blocks, with
+        // objects straddling the block boundaries
+        EmbeddingStore large((tw.get_dir_path() / "large").c_str(), 2, 1 << 16, 1 << 16);
+        std::mt19937 gen(7);
+        std::normal_distribution<float> dist(0, 1);
+        for(int i = 0; i < 1500; i++){
+            std::vector<std::vector<float>> rows(1 + i % 3);
+            for(auto& row : rows)
+                row = {dist(gen), dist(gen)};
+            ASSERT(large.add_object(rows, std::to_string(i)) == 0);
+        }
+        ASSERT(large.get_num_embeddings() > 4 * get_scan_block_rows(2 * sizeof(float)));
+        for(uint32_t num_threads : {2u, 3u, 8u}){
+            ASSERT(large.get_k_closest_objects({{1, 0}, {0, 1}}, 10, num_threads, DistanceMetric::l2_squared) ==
+                large.get_k_closest_objects({{1, 0}, {0, 1}}, 10, 1, DistanceMetric::l2_squared));
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/diverse_search_test");
+
+        std::cout << "TEST -- DIVERSE SEARCH..." << std::endl;
+        for(ElementType element_type : {ElementType::float32, ElementType::float16}){
+            fs::path dir = tw.get_dir_path() / std::to_string((int) element_type);
+            EmbeddingStore store(dir.c_str(), 2, 1024 * 1024, 1024 * 1024, false, element_type);
+            // three near duplicates right at the query, two different directions a bit further out
+            ASSERT(add_embeddings(store, {
+                {{1.0, 0.0}, "dup 1"},
+                {{1.0, 0.01}, "dup 2"},
+                {{1.0, -0.01}, "dup 3"},
+                {{1.0, 0.5}, "up"},
+                {{1.0, -0.5}, "down"},
+                {{-1.0, 0.0}, "opposite"}
+            }) == 0);
+
+            auto plain = store.get_k_closest({1.0, 0.0}, 3, 1, DistanceMetric::cosine_similarity);
+            ASSERT(plain[0].second.rfind("dup", 0) == 0 && plain[2].second.rfind("dup", 0) == 0);
+
+            // lambda 1 is plain nearest neighbour order
+            auto same = store.get_k_closest_diverse({1.0, 0.0}, 3, 6, 1.0, 1, DistanceMetric::cosine_similarity);
+            ASSERT(same.size() == 3);
+            for(int i = 0; i < 3; i++){
+                ASSERT(same[i].second == plain[i].second);
+            }
+
+            auto diverse = store.get_k_closest_diverse({1.0, 0.0}, 3, 5, 0.3, 1, DistanceMetric::cosine_similarity);
+            ASSERT(diverse.size() == 3);
+            ASSERT(diverse[0].second == "dup 1");
+            ASSERT((diverse[1].second == "up" && diverse[2].second == "down") || (diverse[1].second == "down" && diverse[2].second == "up"));
+            ASSERT(diverse[1].first > plain[2].first); // distances to the query are reported as is
+
+            // the opposite row never made the candidate list; l2 works the same way
+            auto l2 = store.get_k_closest_diverse({1.0, 0.0}, 4, 5, 0.3, 2, DistanceMetric::l2_squared);
+            ASSERT(l2.size() == 4 && l2[0].second == "dup 1");
+            for(auto& [distance, value] : l2){
+                ASSERT(value != "opposite");
+            }
+            ASSERT(store.get_k_closest_diverse({1.0}, 3).empty());
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/columnar_export_test");
+
+        std::cout << "TEST -- COLUMNAR EXPORT AND IMPORT..." << std::endl;
+        for(ElementType element_type : {ElementType::float32, ElementType::float16, ElementType::bfloat16}){
+            fs::path dir = tw.get_dir_path() / std::to_string((int) element_type);
+            EmbeddingStore store((dir / "src").c_str(), 2, 1024 * 1024, 1024 * 1024, false, element_type);
+            ASSERT(store.add_object({{1, 0}, {0.5, 0.5}}, "two rows") == 0);
+            ASSERT(store.add_embedding({0, 1}, "") == 0);
+            ASSERT(store.add_object({{0.25, -1}, {-2, 0}, {0, 0}}, "three rows") == 0);
+            ASSERT((store.get_embedding(3) == std::vector<float>{0.25, -1}));
+            ASSERT(store.get_embedding(6).empty());
+
+            // a tiny chunk size so every column is written in several pieces
+            ASSERT(store.export_columnar((dir / "export").c_str(), 16) == 0);
+            ASSERT(store.export_columnar((dir / "export").c_str()) == -1);
+
+            MappedFile vectors_file(dir / "export" / EXPORT_VECTORS_FN);
+            NpyArray vectors;
+            ASSERT(parse_npy_header(vectors_file.data(), vectors_file.size(), vectors));
+            ASSERT(vectors.descr == (element_type == ElementType::float16 ? "<f2" : "<f4"));
+            ASSERT((vectors.shape == std::vector<uint64_t>{6, 2}));
+            ASSERT(vectors.data_offset % NPY_ALIGNMENT == 0);
+
+            MappedFile ids_file(dir / "export" / EXPORT_IDS_FN);
+            NpyArray ids;
+            ASSERT(parse_npy_header(ids_file.data(), ids_file.size(), ids));
+            std::vector<uint32_t> id_values(6);
+            memcpy(id_values.data(), ids_file.data() + ids.data_offset, 6 * sizeof(uint32_t));
+            ASSERT((id_values == std::vector<uint32_t>{0, 0, 1, 2, 2, 2}));
+
+            EmbeddingStore copy((dir / "copy").c_str(), 2);
+            ASSERT(copy.import_columnar((dir / "export").c_str()) == 0);
+            ASSERT(copy.get_num_embeddings() == 6);
+            for(uint32_t row = 0; row < 6; row++){
+                ASSERT(copy.get_embedding(row) == store.get_embedding(row));
+                ASSERT(copy.get_value(row) == store.get_value(row));
+            }
+            // objects survive the round trip
+            auto objects = copy.get_k_closest_objects({{1, 0}}, 3);
+            ASSERT(objects.size() == 3 && objects[0].second == "two rows");
+
+            EmbeddingStore wrong_dims((dir / "wrong_dims").c_str(), 3);
+            ASSERT(wrong_dims.import_columnar((dir / "export").c_str()) == -2);
+            ASSERT(wrong_dims.import_columnar((dir / "missing").c_str()) == -1);
+        }
+
+        // numpy-style input: float64 vectors, u4 offsets and no ids -- one object per row
+        fs::path numpy_dir = tw.get_dir_path() / "numpy";
+        fs::create_directories(numpy_dir);
+        {
+            std::ofstream vectors(numpy_dir / EXPORT_VECTORS_FN, std::ios::binary);
+            std::vector<double> data = {1, 2, 3, 4, 5, 6};
+            vectors << npy_header("<f8", {3, 2});
+            vectors.write((const char*) data.data(), data.size() * sizeof(double));
+            std::ofstream offsets(numpy_dir / EXPORT_VALUE_OFFSETS_FN, std::ios::binary);
+            std::vector<uint32_t> offset_data = {0, 3, 3, 8};
+            offsets << npy_header("<u4", {4});
+            offsets.write((const char*) offset_data.data(), offset_data.size() * sizeof(uint32_t));
+            std::ofstream values(numpy_dir / EXPORT_VALUES_FN, std::ios::binary);
+            values << "onethree";
+        }
+        EmbeddingStore imported((tw.get_dir_path() / "imported").c_str(), 2);
+        ASSERT(imported.import_columnar(numpy_dir.c_str()) == 0);
+        ASSERT(imported.get_num_embeddings() == 3);
+        ASSERT((imported.get_embedding(2) == std::vector<float>{5, 6}));
+        ASSERT(imported.get_value(0) == "one" && imported.get_value(1) == "" && imported.get_value(2) == "three");
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/numa_placement_test");
+
+        std::cout << "TEST -- NUMA PLACEMENT..." << std::endl;
+        ASSERT((parse_cpu_list("0-3,8,10-11\n") == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+        ASSERT(parse_cpu_list("").empty());
+
+        NumaTopology topology = NumaTopology::detect();
+        ASSERT(topology.num_nodes() >= 1 && !topology.node_cpus[0].empty());
+        NumaTopology simulated = NumaTopology::simulate(3);
+        ASSERT(simulated.simulated && simulated.num_nodes() == 3);
+        for(const auto& cpus : simulated.node_cpus){
+            ASSERT(!cpus.empty());
+        }
+
+        EmbeddingStore store(tw.get_dir_path().c_str(), 4, 4 * 1024 * 1024, 1024 * 1024);
+        std::mt19937 gen(11);
+        std::normal_distribution<float> dist(0, 1);
+        for(uint32_t i = 0; i < 20000; i++){
+            ASSERT(store.add_embedding({dist(gen), dist(gen), dist(gen), dist(gen)}, std::to_string(i)) == 0);
+        }
+        auto expected = store.get_k_closest({1, 0.5, 0, -1}, 10, 4);
+
+        std::vector<int> affinity = NumaTopology::allowed_cpus();
+        for(NumaPlacement placement : {NumaPlacement::interleave, NumaPlacement::partition}){
+            ASSERT(store.set_numa_placement(placement, 2) == 0);
+            ASSERT(store.get_numa_placement() == placement);
+            ASSERT(store.get_k_closest({1, 0.5, 0, -1}, 10, 4) == expected);
+            ASSERT(store.set_numa_placement(placement) >= -1); // real topology -- moving pages may not be allowed here
+            ASSERT(store.get_k_closest({1, 0.5, 0, -1}, 10, 4) == expected);
+        }
+        ASSERT(NumaTopology::allowed_cpus() == affinity); // the calling thread is unpinned after each scan
+        ASSERT(store.set_numa_placement(NumaPlacement::none) == 0);
+        ASSERT(store.get_k_closest({1, 0.5, 0, -1}, 10, 4) == expected);
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/disk_scan_test");
+
+        std::cout << "TEST -- DISK SCAN..." << std::endl;
+        for(ElementType element_type : {ElementType::float32, ElementType::float16}){
+            fs::path dir = tw.get_dir_path() / std::to_string((int) element_type);
+            // 1 MB + change, so the last aligned read runs past eof
+            EmbeddingStore store(dir.c_str(), 12, 1024 * 1024 + 100, 1024 * 1024, false, element_type);
+            ASSERT(store.get_k_closest_disk(std::vector<float>(12, 1), 5).empty());
+
+            std::mt19937 gen(5);
+            std::normal_distribution<float> dist(0, 1);
+            while(true){
+                std::vector<float> embedding(12);
+                for(float& f : embedding){
+                    f = dist(gen);
+                }
+                if(store.add_embedding(embedding, std::to_string(store.get_num_embeddings())) != 0)
+                    break;
+            }
+            ASSERT(store.get_num_embeddings() > 20000);
+
+            std::vector<float> query(12);
+            for(float& f : query){
+                f = dist(gen);
+            }
+            for(DistanceMetric metric : {DistanceMetric::cosine_similarity, DistanceMetric::l2_squared}){
+                auto expected = store.get_k_closest(query, 10, 1, metric);
+                for(bool use_io_uring : {true, false}){
+                    for(bool direct : {false, true}){
+                        DiskScanOptions options;
+                        options.use_io_uring = use_io_uring;
+                        options.direct = direct;
+                        options.chunk_bytes = 10000; // not a multiple of the row size or the alignment
+                        options.queue_depth = 3;
+                        ASSERT(store.get_k_closest_disk(query, 10, 1, metric, options) == expected);
+                        ASSERT(store.get_k_closest_disk(query, 10, 3, metric, options) == expected);
+                    }
+                }
+                ASSERT(store.get_k_closest_disk(query, 10, 2, metric) == expected);
+            }
+            ASSERT(store.get_k_closest_disk({1, 2}, 10).empty());
+
+            // a file that can't be read is an error, not an empty result
+            fs::rename(dir / EMBEDDING_STORE_FN, dir / "moved.bin");
+            for(bool use_io_uring : {true, false}){
+                DiskScanOptions options;
+                options.use_io_uring = use_io_uring;
+                bool threw = false;
+                try{
+                    store.get_k_closest_disk(query, 10, 2, DistanceMetric::cosine_similarity, options);
+                }catch(const std::runtime_error& e){
+                    threw = true;
+                }
+                ASSERT(threw);
+            }
+            fs::rename(dir / "moved.bin", dir / EMBEDDING_STORE_FN);
+            ASSERT(store.get_k_closest_disk(query, 10, 2, DistanceMetric::cosine_similarity) == store.get_k_closest(query, 10));
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/standing_query_test");
+
+        std::cout << "TEST -- STANDING QUERIES..." << std::endl;
+        std::mt19937 gen(21);
+        std::normal_distribution<float> dist(0, 1);
+        auto random_vector = [&](){
+            return std::vector<float>{dist(gen), dist(gen), dist(gen), dist(gen)};
+        };
+        std::vector<float> q1 = random_vector();
+        std::vector<float> q2 = random_vector();
+        uint32_t num_rows = 0;
+        auto add_rows = [&](EmbeddingStore& store, uint32_t n){
+            for(uint32_t i = 0; i < n; i++){
+                if(i % 3 == 0){
+                    ASSERT(store.add_object({random_vector(), random_vector()}, std::to_string(num_rows)) == 0);
+                    num_rows += 2;
+                }else{
+                    ASSERT(store.add_embedding(random_vector(), std::to_string(num_rows)) == 0);
+                    num_rows++;
+                }
+            }
+        };
+
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 4);
+            ASSERT(store.get_standing_query_results(0).empty() && store.take_standing_query_changes().empty());
+            // q1 is registered on the empty store, so its whole top-k arrives as changes
+            ASSERT(store.add_standing_query(q1, 5) == 0);
+            add_rows(store, 100);
+            ASSERT(store.add_standing_query(q2, 3, DistanceMetric::l2_squared) == 1);
+            ASSERT(store.add_standing_query({1, 2}, 3) == -1 && store.add_standing_query(q1, 0) == -1);
+            ASSERT(store.get_num_standing_queries() == 2);
+            ASSERT(store.get_standing_query_results(0) == store.get_k_closest(q1, 5));
+            ASSERT(store.get_standing_query_results(1) == store.get_k_closest(q2, 3, 1, DistanceMetric::l2_squared));
+
+            // replaying the changes always gives the current top-k
+            std::map<uint32_t, float> replayed;
+            for(int batch = 0; batch < 20; batch++){
+                for(const StandingQueryChange& change : store.take_standing_query_changes()){
+                    if(change.query_id != 0)
+                        continue;
+                    if(change.entered){
+                        ASSERT(replayed.emplace(change.row, change.distance).second);
+                    }else{
+                        ASSERT(replayed.erase(change.row) == 1);
+                    }
+                }
+                std::vector<std::pair<float, std::string>> from_changes;
+                for(auto [row, distance] : replayed){
+                    from_changes.push_back(std::make_pair(distance, store.get_value(row)));
+                }
+                std::sort(from_changes.begin(), from_changes.end());
+                auto expected = store.get_k_closest(q1, 5);
+                ASSERT(store.get_standing_query_results(0) == expected);
+                ASSERT(from_changes == expected);
+                add_rows(store, 25);
+            }
+            store.take_standing_query_changes();
+            ASSERT(store.take_standing_query_changes().empty());
+            ASSERT(store.get_standing_query_results(1) == store.get_k_closest(q2, 3, 1, DistanceMetric::l2_squared));
+
+            ASSERT(store.remove_standing_query(1) == 0);
+            ASSERT(store.remove_standing_query(1) == -1 && store.remove_standing_query(7) == -1);
+            ASSERT(store.get_standing_query_results(1).empty() && store.get_num_standing_queries() == 1);
+        }
+
+        // persisted, and kept current after reopening
+        EmbeddingStore store(tw.get_dir_path().c_str(), 4);
+        ASSERT(store.get_num_standing_queries() == 1);
+        ASSERT(store.get_standing_query_results(0) == store.get_k_closest(q1, 5));
+        add_rows(store, 50);
+        ASSERT(store.get_standing_query_results(0) == store.get_k_closest(q1, 5));
+        ASSERT(store.get_standing_query_results(1).empty());
+        ASSERT(store.add_standing_query(q2, 4) == 2);
+
+        // more queries than fit in the initial file: it grows, and every query survives a reopen
+        {
+            fs::path wide_dir = tw.get_dir_path() / "wide";
+            const uint32_t dims = 3072;
+            const uint32_t num_queries = 2000;
+            std::vector<std::vector<float>> wide_queries;
+            {
+                EmbeddingStore wide(wide_dir.c_str(), dims, 64 * dims * sizeof(float), 1024 * 1024);
+                for(uint32_t i = 0; i < 20; i++){
+                    std::vector<float> row(dims);
+                    for(float& f : row){
+                        f = dist(gen);
+                    }
+                    ASSERT(wide.add_embedding(row, std::to_string(i)) == 0);
+                }
+                for(uint32_t i = 0; i < num_queries; i++){
+                    std::vector<float> query(dims, 0);
+                    query[i % dims] = 1;
+                    query[(i * 7 + 1) % dims] = -1;
+                    wide_queries.push_back(query);
+                    ASSERT(wide.add_standing_query(query, 3) == (int) i);
+                }
+                ASSERT(wide.get_num_standing_queries() == num_queries);
+            }
+            ASSERT(fs::file_size(wide_dir / STANDING_QUERIES_FN) > STANDING_QUERIES_FILE_SIZE);
+            EmbeddingStore wide(wide_dir.c_str(), dims, 64 * dims * sizeof(float), 1024 * 1024);
+            ASSERT(wide.get_num_standing_queries() == num_queries);
+            std::vector<float> row(dims, 1);
+            ASSERT(wide.add_embedding(row, "ones") == 0);
+            for(uint32_t i : {0u, 1299u, 1500u, num_queries - 1}){
+                ASSERT(wide.get_standing_query_results(i) == wide.get_k_closest(wide_queries[i], 3));
+            }
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/reduced_search_test");
+
+        std::cout << "TEST -- REDUCED SEARCH..." << std::endl;
+        // 64 dims, but nearly all of the variance in 8 of them
+        std::mt19937 gen(3);
+        std::normal_distribution<float> dist(0, 1);
+        std::vector<std::vector<float>> basis(8, std::vector<float>(64));
+        for(auto& b : basis){
+            for(float& f : b){
+                f = dist(gen);
+            }
+        }
+        auto random_vector = [&](){
+            std::vector<float> v(64);
+            for(const auto& b : basis){
+                float c = dist(gen);
+                for(uint32_t i = 0; i < 64; i++){
+                    v[i] += c * b[i];
+                }
+            }
+            for(float& f : v){
+                f += 0.01f * dist(gen);
+            }
+            return v;
+        };
+
+        {
+            EmbeddingStore store(tw.get_dir_path().c_str(), 64, 4 * 1024 * 1024, 1024 * 1024);
+            for(uint32_t i = 0; i < 3000; i++){
+                ASSERT(store.add_embedding(random_vector(), std::to_string(i)) == 0);
+            }
+            std::vector<float> query = random_vector();
+            ASSERT(store.get_k_closest_reduced(query, 10) == store.get_k_closest(query, 10)); // no reduced copy yet
+
+            ASSERT(store.enable_reduced_search(0) == -1 && store.enable_reduced_search(64) == -1);
+            ASSERT(store.enable_reduced_search(8, Reduction::none) == -1);
+            // PCA from fewer rows than directions would quietly fill the rest in at random -- refused, nothing saved
+            ASSERT(store.enable_reduced_search(8, Reduction::pca, 7) == -1);
+            ASSERT(!fs::exists(tw.get_dir_path() / PROJECTION_FN) && store.get_reduction() == Reduction::none);
+            {
+                EmbeddingStore empty((tw.get_dir_path() / "empty").c_str(), 64);
+                ASSERT(empty.enable_reduced_search(8) == -1);
+                ASSERT(!fs::exists(tw.get_dir_path() / "empty" / PROJECTION_FN));
+            }
+            {
+                // a 3.5 GB half precision store would need a 5 GB copy in 48 dimensions -- refused up front instead of
+                // opening a truncated one. the store is grown sparse, so nothing that big is actually written
+                fs::path huge_path = tw.get_dir_path() / "huge";
+                EmbeddingStore(huge_path.c_str(), 64, 1024 * 1024, 1024 * 1024, false, ElementType::float16).close_store();
+                fs::resize_file(huge_path / EMBEDDING_STORE_FN, 3500ull * 1024 * 1024);
+                EmbeddingStore huge(huge_path.c_str(), 64);
+                ASSERT(huge.enable_reduced_search(48, Reduction::random_projection) == -3);
+                ASSERT(huge.get_reduction() == Reduction::none && !fs::exists(huge_path / REDUCED_STORE_FN));
+            }
+            ASSERT(store.enable_reduced_search(8) == 0);
+            ASSERT(store.get_reduction() == Reduction::pca);
+
+            // the 8 learned directions hold almost everything, so the coarse pass finds the true neighbours
+            for(DistanceMetric metric : {DistanceMetric::cosine_similarity, DistanceMetric::l2_squared}){
+                for(int q = 0; q < 5; q++){
+                    query = random_vector();
+                    ASSERT(store.get_k_closest_reduced(query, 10, 4, 2, metric) == store.get_k_closest(query, 10, 1, metric));
+                }
+            }
+            // the coarse pass pins its workers like a full scan
+            ASSERT(store.set_numa_placement(NumaPlacement::partition, 2) == 0);
+            ASSERT(store.get_k_closest_reduced(query, 10, 4, 2) == store.get_k_closest(query, 10));
+            ASSERT(store.set_numa_placement(NumaPlacement::none) == 0);
+
+            // rows added afterwards get their reduced copy too
+            std::vector<float> added = random_vector();
+            ASSERT(store.add_embedding(added, "added") == 0);
+            ASSERT(store.get_k_closest_reduced(added, 1)[0].second == "added");
+        }
+
+        // the projection and the copy persist; random projection draws fewer good directions but re-ranks exactly
+        EmbeddingStore store(tw.get_dir_path().c_str(), 64);
+        ASSERT(store.get_reduction() == Reduction::pca);
+        std::vector<float> query = random_vector();
+        ASSERT(store.get_k_closest_reduced(query, 5, 8) == store.get_k_closest(query, 5));
+
+        EmbeddingStore random_store((tw.get_dir_path() / "random").c_str(), 64, 4 * 1024 * 1024, 1024 * 1024);
+        for(uint32_t i = 0; i < 1000; i++){
+            ASSERT(random_store.add_embedding(random_vector(), std::to_string(i)) == 0);
+        }
+        ASSERT(random_store.enable_reduced_search(16, Reduction::random_projection) == 0);
+        auto exact = random_store.get_k_closest(query, 10);
+        auto reduced = random_store.get_k_closest_reduced(query, 10, 20);
+        ASSERT(reduced.size() == 10);
+        for(uint32_t i = 0; i < 10; i++){
+            ASSERT(reduced[i].first >= exact[i].first); // exact distances, so never better than the true top-k
+            if(i > 0)
+                ASSERT(reduced[i].first >= reduced[i - 1].first);
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
 
-}
\ No newline at end of file
+}
@@ -8,6 +8,7 @@
 #include <numeric>
 
 #include "inverted_index.h"
+#include "positional_index.h"
 #include "test_utils.h"
 
 bool equal_vecs(std::vector<uint32_t> v1, std::vector<uint32_t> v2){
@@ -102,4 +103,217 @@ int main(int argc, char** argv){
         std::cout << "PASSED" << std::endl;
     }
 
+    {
+        TestWrapper tw("test_files/full_ii_test");
+
+        std::cout << "TEST -- FULL INDEX..." << std::endl;
+
+        InvertedIndex ii(tw.get_dir_path().c_str(), DEFAULT_WRITE_IDX + 4 * 32, 32, 16); // 4 blocks of max 4 vals
+
+        // more values than a block holds take several blocks of the same key
+        std::vector<uint32_t> vals(10);
+        std::iota(vals.begin(), vals.end(), 0);
+        ASSERT(ii.insert("key", vals) == 0);
+        ASSERT(ii.get_num_keys() == 3);
+        std::vector<uint32_t> key_vals = ii.search("key");
+        std::sort(key_vals.begin(), key_vals.end());
+        ASSERT(equal_vecs(key_vals, vals));
+        ASSERT(ii.has_room_for(1, 4) && !ii.has_room_for(2, 4) && !ii.has_room_for(1, 5));
+
+        ASSERT(ii.insert("other", {100}) == 0);
+        ASSERT(!ii.has_room_for(1, 1));
+
+        // the free slots take 3, the other 2 would need a block that doesn't fit -- none of them are written
+        ASSERT(ii.insert("other", {101, 102, 103, 104, 105}) == -2);
+        ASSERT(equal_vecs(ii.search("other"), {100}));
+        ASSERT(ii.insert("other", {101, 102, 103}) == 0);
+        ASSERT(equal_vecs(ii.search("other"), {100, 101, 102, 103}));
+
+        ASSERT(ii.insert("new", {1}) == -2);
+        ASSERT(ii.search("new").empty());
+        key_vals = ii.search("key");
+        std::sort(key_vals.begin(), key_vals.end());
+        ASSERT(equal_vecs(key_vals, vals));
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/skip_list_ii_test");
+
+        std::cout << "TEST -- SKIP LIST SEEK..." << std::endl;
+
+        PostingList list;
+        std::vector<uint32_t> evens;
+        for(uint32_t doc = 0; doc < 1000; doc += 2){
+            list.append(doc, {doc});
+            evens.push_back(doc);
+        }
+        ASSERT(list.skips.size() == (500 + POSTING_SKIP_INTERVAL - 1) / POSTING_SKIP_INTERVAL);
+        for(uint32_t target = 0; target < 1002; target += 7){
+            for(size_t from : {(size_t) 0, (size_t) 100, (size_t) 499}){
+                size_t expected = std::max(from, (size_t) (std::lower_bound(evens.begin(), evens.end(), target) - evens.begin()));
+                ASSERT(list.seek(from, target) == expected);
+                ASSERT(gallop_to(evens, from, target) == expected);
+            }
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/boolean_query_ii_test");
+
+        std::cout << "TEST -- BOOLEAN AND PHRASE QUERIES..." << std::endl;
+
+        Analyzer analyzer;
+
+        std::vector<std::string> docs = {
+            "harry potter and the chamber of secrets",  // 0
+            "potter harry",                             // 1
+            "the chamber of commerce",                  // 2
+            "Harry's wand, and Potter's broom",         // 3
+            "secrets of the dragon",                    // 4
+        };
+        {
+            PositionalIndex pi(tw.get_dir_path().c_str(), 64 * 1024);
+            uint32_t row = 0;
+            for(const std::string& doc : docs){
+                ASSERT(pi.insert(row, 2, doc, analyzer) == 0); // two rows per doc
+                row += 2;
+            }
+            ASSERT(pi.insert(0, 1, "out of order", analyzer) == -1);
+
+            ASSERT(equal_vecs(pi.match("harry", analyzer), {0, 1}));
+            ASSERT(equal_vecs(pi.match("harry potter", analyzer), {0, 1}));
+            ASSERT(equal_vecs(pi.match("harry AND potter", analyzer), {0, 1}));
+            ASSERT(equal_vecs(pi.match("\"harry potter\"", analyzer), {0}));
+            ASSERT(equal_vecs(pi.match("harry OR secrets", analyzer), {0, 1, 4}));
+            ASSERT(equal_vecs(pi.match("chamber -harry", analyzer), {2}));
+            ASSERT(equal_vecs(pi.match("chamber NOT harry", analyzer), {2}));
+            ASSERT(equal_vecs(pi.match("NOT chamber", analyzer), {1, 3, 4}));
+            ASSERT(equal_vecs(pi.match("(harry OR dragon) -chamber", analyzer), {1, 4}));
+            ASSERT(equal_vecs(pi.match("+harrys +wand", analyzer), {3}));
+            // common words leave a gap the phrase still has to line up across
+            ASSERT(equal_vecs(pi.match("\"chamber of secrets\"", analyzer), {0}));
+            ASSERT(equal_vecs(pi.match("\"chamber secrets\"", analyzer), {}));
+            // common words alone don't restrict anything; malformed queries don't throw
+            ASSERT(equal_vecs(pi.match("dragon AND the", analyzer), {4}));
+            ASSERT(equal_vecs(pi.match("the", analyzer), {}));
+            ASSERT(equal_vecs(pi.match("((dragon OR", analyzer), {4}));
+            ASSERT(equal_vecs(pi.match("dragon) AND", analyzer), {4}));
+
+            ASSERT(equal_vecs(pi.match_rows("\"harry potter\" OR dragon", analyzer), {0, 1, 8, 9}));
+        }
+
+        // postings come back from the log
+        PositionalIndex reopened(tw.get_dir_path().c_str(), 64 * 1024);
+        ASSERT(reopened.get_num_docs() == docs.size());
+        ASSERT(reopened.get_num_rows() == 2 * docs.size());
+        ASSERT(equal_vecs(reopened.match("\"chamber of secrets\" OR commerce", analyzer), {0, 2}));
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/large_boolean_query_ii_test");
+
+        std::cout << "TEST -- LARGE INTERSECTIONS..." << std::endl;
+
+        Analyzer analyzer;
+
+        PositionalIndex pi(tw.get_dir_path().c_str(), 1024); // far too small -- the index carries on in memory
+        std::vector<uint32_t> expected_and, expected_phrase;
+        bool log_filled = false;
+        for(uint32_t doc = 0; doc < 5000; doc++){
+            std::string value = "filler";
+            if(doc % 3 == 0)
+                value += " mango";
+            if(doc % 1000 == 0)
+                value += " zebra";
+            if(doc % 500 == 0)
+                value += " stripes zebra";
+            int code = pi.insert(doc, 1, value, analyzer);
+            ASSERT(code == 0 || code == -2);
+            log_filled = log_filled || code == -2;
+            if(doc % 3 == 0 && (doc % 1000 == 0 || doc % 500 == 0))
+                expected_and.push_back(doc);
+            if(doc % 500 == 0)
+                expected_phrase.push_back(doc);
+        }
+        ASSERT(log_filled);
+        ASSERT(equal_vecs(pi.match("mango zebra", analyzer), expected_and));
+        ASSERT(equal_vecs(pi.match("\"stripes zebra\"", analyzer), expected_phrase));
+        ASSERT(pi.match("mango -zebra", analyzer).size() == 1667 - expected_and.size());
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/long_key_ii_test");
+
+        std::cout << "TEST -- LONG KEYS..." << std::endl;
+
+        InvertedIndex ii(tw.get_dir_path().c_str(), 1024, 32, 16);
+        ASSERT(ii.insert("internationalization", {1}) == 0);
+        ASSERT(ii.insert("internationalizing", {2}) == 0); // same first 16 bytes
+        ASSERT(equal_vecs(ii.search("internationalization"), {1}));
+        ASSERT(equal_vecs(ii.search("internationalizing"), {2}));
+        ASSERT(ii.search("internationalizat").empty());
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/analyzer_ii_test");
+
+        std::cout << "TEST -- ANALYZER..." << std::endl;
+
+        auto tokens = [](const Analyzer& analyzer, const std::string& text){
+            std::vector<std::string> out;
+            analyzer.analyze(text, [&out](std::string_view token, uint32_t position, bool is_ngram){
+                out.push_back(std::string(token) + "@" + std::to_string(position));
+            });
+            return out;
+        };
+
+        // the default analyzer is the original cleanup
+        Analyzer legacy;
+        for(std::string text : {"harry potter's favorite dessert was Butterbeer.", "potter-- shut  your mouth!", "a\tb  c"}){
+            std::vector<std::string> keys = legacy.keys(text);
+            std::vector<std::string> expected = get_keys_from_string(text);
+            ASSERT(keys == expected);
+        }
+        ASSERT((tokens(legacy, "the potter's wand") == std::vector<std::string>{"potters@1", "wand@2"}));
+
+        AnalyzerOptions options;
+        options.unicode = true;
+        Analyzer unicode(options);
+        ASSERT((tokens(unicode, "Café DÉJÀ-vu, naïve Straße") == std::vector<std::string>{"cafe@0", "deja@1", "vu@2", "naive@3", "strasse@4"}));
+        ASSERT((tokens(unicode, "cafe\xcc\x81 \xce\x91\xce\x98\xce\x97\xce\x9d\xce\x91") == std::vector<std::string>{"cafe@0", "\xce\xb1\xce\xb8\xce\xb7\xce\xbd\xce\xb1@1"}));
+        ASSERT((tokens(unicode, "potter\xe2\x80\x99s wand\xe2\x80\x94" "broom") == std::vector<std::string>{"potters@0", "wand@1", "broom@2"}));
+        ASSERT(unicode.keys(std::string(100, 'a'))[0].size() == MAX_TOKEN_BYTES);
+
+        options.stem = true;
+        Analyzer stemmer(options);
+        std::vector<std::pair<std::string, std::string>> stems = {
+            {"caresses", "caress"}, {"ponies", "poni"}, {"cats", "cat"}, {"agreed", "agre"}, {"plastered", "plaster"},
+            {"motoring", "motor"}, {"conflict", "conflict"}, {"conflated", "conflat"}, {"hopping", "hop"}, {"falling", "fall"},
+            {"filing", "file"}, {"sunny", "sunni"}, {"relational", "relat"}, {"conditional", "condit"},
+            {"generalization", "gener"}, {"effective", "effect"}, {"hopeful", "hope"}, {"goodness", "good"},
+            {"adjustable", "adjust"}, {"controlling", "control"}, {"running", "run"}, {"runs", "run"}, {"x2s", "x2s"}
+        };
+        for(auto [word, stem] : stems){
+            ASSERT(stemmer.keys(word)[0] == stem);
+        }
+
+        options.ngram_size = 3;
+        Analyzer ngrams(options);
+        ASSERT((ngrams.keys("Cats ox") == std::vector<std::string>{"#cat", "#ats", "cat", "ox"}));
+        // grams step over whole characters
+        ASSERT((ngrams.keys("\xce\x91\xce\x98\xce\x97\xce\x9d") == std::vector<std::string>{"#\xce\xb1\xce\xb8\xce\xb7", "#\xce\xb8\xce\xb7\xce\xbd", "\xce\xb1\xce\xb8\xce\xb7\xce\xbd"}));
+
+        std::cout << "PASSED" << std::endl;
+    }
+
 }
\ No newline at end of file
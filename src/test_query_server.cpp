@@ -0,0 +1,195 @@
+#include <vector>
+#include <iostream>
+#include <cassert>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "query_server.h"
+#include "query_client.h"
+#include "test_utils.h"
+
+int main(int argc, char** argv){
+    {
+        TestWrapper tw("test_files/query_server_test");
+
+        std::cout << "TEST -- QUERY SERVER..." << std::endl;
+        EmbeddingStore store(tw.get_dir_path().c_str(), 2, 1024, 1024, true);
+        std::string socket_path = (tw.get_dir_path() / "server.sock").string();
+        QueryServer server(store, socket_path, 2);
+        std::thread server_thread([&](){ server.run(); });
+
+        QueryClient client(socket_path);
+        ASSERT(client.ping());
+        ASSERT(client.get_num_embeddings() == 0);
+
+        std::vector<std::vector<float>> embeddings;
+        std::vector<std::string> values;
+        std::vector<float> keys = {1, 2, 3, 4, 5};
+        for(float k1 : keys){
+            for(float k2 : keys){
+                embeddings.push_back({k1, k2});
+                values.push_back(std::to_string((int) k1) + std::to_string((int) k2));
+            }
+        }
+        ASSERT(client.add_embeddings(embeddings, values) == 0);
+        ASSERT(client.get_num_embeddings() == 25);
+        ASSERT(client.add_embedding({1, 2, 3}, "wrong size") == -1);
+        ASSERT(client.get_num_embeddings() == 25);
+
+        // same answers as asking the store directly
+        auto expected = store.get_k_closest({2.1, 3.9}, 3, 1, DistanceMetric::l2_squared);
+        auto closest = client.get_k_closest({2.1, 3.9}, 3, 0, DistanceMetric::l2_squared);
+        ASSERT(closest == expected);
+        ASSERT(closest[0].second == "24");
+
+        auto hybrid = client.get_k_closest_hybrid_weighted("24", {2.1, 3.9}, 1, 1, DistanceMetric::l2_squared, 0.5);
+        ASSERT(hybrid.size() == 1);
+        ASSERT(hybrid[0].second == "24");
+
+        ASSERT(client.get_k_closest({1, 2, 3}, 3).empty());
+
+        // batched in one frame and pipelined over several give the same results, in query order
+        std::vector<std::vector<float>> queries = {{1, 1}, {5, 5}, {2, 4}, {4.9, 1.1}, {3, 3}};
+        auto batch = client.get_k_closest_batch(queries, 2, 1, DistanceMetric::l2_squared);
+        auto pipelined = client.get_k_closest_pipelined(queries, 2, 2, 1, DistanceMetric::l2_squared);
+        ASSERT(batch.size() == queries.size());
+        ASSERT(batch == pipelined);
+        ASSERT(batch[1][0].second == "55");
+        ASSERT(batch[3][0].second == "51");
+
+        // several clients at once
+        std::vector<std::thread> workers;
+        std::vector<bool> ok(4, false);
+        for(uint32_t w = 0; w < ok.size(); w++){
+            workers.emplace_back([&, w](){
+                QueryClient worker(socket_path);
+                auto r = worker.get_k_closest_pipelined(queries, 1, 1, 1, DistanceMetric::l2_squared);
+                ok[w] = r.size() == queries.size() && r[0][0].second == "11";
+            });
+        }
+        for(auto& t : workers){
+            t.join();
+        }
+        ASSERT(ok == std::vector<bool>(4, true));
+
+        // garbage on the wire only costs that connection
+        {
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, socket_path.c_str());
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            ASSERT(connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0);
+            uint32_t bad_size = 1;
+            ASSERT(write(fd, &bad_size, sizeof(bad_size)) == sizeof(bad_size));
+            char c;
+            ASSERT(read(fd, &c, 1) == 0);
+            close(fd);
+        }
+        ASSERT(client.ping());
+
+        // counts the frame can't possibly hold are refused before anything is allocated for them
+        {
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, socket_path.c_str());
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            ASSERT(connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0);
+            auto send_and_read_status = [&](const FrameWriter& request){
+                std::string frame = finish_frame(request.buf);
+                ASSERT(write(fd, frame.data(), frame.size()) == (ssize_t) frame.size());
+                char header[FRAME_SIZE_BYTES + 2 * sizeof(uint32_t)];
+                size_t got = 0;
+                while(got < sizeof(header)){
+                    ssize_t n = read(fd, header + got, sizeof(header) - got);
+                    ASSERT(n > 0);
+                    got += n;
+                }
+                FrameReader reader(header + FRAME_SIZE_BYTES, 2 * sizeof(uint32_t));
+                ASSERT(reader.get_u32() == 9);
+                return reader.get_i32();
+            };
+            for(QueryOp op : {QueryOp::get_k_closest, QueryOp::get_k_closest_hybrid}){
+                FrameWriter request;
+                request.put_u32(9);
+                request.put_u8((uint8_t) op);
+                request.put_u32(3);
+                request.put_u32(1);
+                request.put_u8((uint8_t) DistanceMetric::l2_squared);
+                if(op == QueryOp::get_k_closest_hybrid)
+                    request.put_f32(0.5);
+                request.put_u32(0xffffffff);
+                request.put_floats({1, 1});
+                ASSERT(send_and_read_status(request) == QUERY_BAD_REQUEST);
+            }
+            FrameWriter add_request;
+            add_request.put_u32(9);
+            add_request.put_u8((uint8_t) QueryOp::add_embeddings);
+            add_request.put_u32(0xffffffff);
+            add_request.put_floats({1, 1});
+            add_request.put_str("x");
+            ASSERT(send_and_read_status(add_request) == QUERY_BAD_REQUEST);
+            close(fd);
+        }
+        ASSERT(client.ping());
+        ASSERT(client.get_num_embeddings() == 25);
+
+        // a client that half-closes right after sending still gets every byte of an answer bigger than the
+        // socket buffer
+        {
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, socket_path.c_str());
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            ASSERT(connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0);
+            FrameWriter request;
+            request.put_u32(7);
+            request.put_u8((uint8_t) QueryOp::get_k_closest);
+            request.put_u32(25);
+            request.put_u32(1);
+            request.put_u8((uint8_t) DistanceMetric::l2_squared);
+            uint32_t num_queries = 8000;
+            request.put_u32(num_queries);
+            for(uint32_t i = 0; i < num_queries; i++)
+                request.put_floats({(float) (i % 5), 1});
+            std::string frame = finish_frame(request.buf);
+            for(size_t sent = 0; sent < frame.size();){
+                ssize_t n = write(fd, frame.data() + sent, frame.size() - sent);
+                ASSERT(n > 0);
+                sent += n;
+            }
+            ASSERT(shutdown(fd, SHUT_WR) == 0);
+            std::this_thread::sleep_for(std::chrono::milliseconds(200)); // the server fills the socket buffer and waits
+
+            std::string response;
+            char buf[64 * 1024];
+            ssize_t n;
+            while((n = read(fd, buf, sizeof(buf))) > 0)
+                response.append(buf, n);
+            close(fd);
+            ASSERT(response.size() > 1024 * 1024);
+            ASSERT(response.size() == FRAME_SIZE_BYTES + char_to_uint32_t(response.data()));
+            FrameReader reader(response.data() + FRAME_SIZE_BYTES, response.size() - FRAME_SIZE_BYTES);
+            ASSERT(reader.get_u32() == 7 && reader.get_i32() == QUERY_OK && reader.get_u32() == num_queries);
+        }
+
+        // a second server can't take over the socket of a live one
+        bool threw = false;
+        try{
+            QueryServer other(store, socket_path);
+        }catch(const std::runtime_error& e){
+            threw = true;
+        }
+        ASSERT(threw);
+        ASSERT(fs::exists(socket_path));
+        ASSERT(QueryClient(socket_path).ping());
+
+        server.stop();
+        server_thread.join();
+        ASSERT(server.get_requests_served() > 10);
+        std::cout << "PASSED" << std::endl;
+    }
+}
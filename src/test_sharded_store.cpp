@@ -0,0 +1,131 @@
+#include <vector>
+#include <iostream>
+#include <cassert>
+#include <filesystem>
+#include <stdint.h>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+
+#include "sharded_embedding_store.h"
+#include "test_utils.h"
+
+int main(int argc, char** argv){
+    {
+        TestWrapper tw("test_files/basic_sharded_test");
+
+        std::cout << "TEST -- BASIC..." << std::endl;
+        ShardedEmbeddingStore store(tw.get_dir_path().c_str(), 4, 2, 1024, 1024);
+
+        std::vector<uint64_t> ids;
+        std::vector<std::vector<float>> embeddings;
+        std::vector<std::string> values;
+        std::vector<float> keys = {1, 2, 3, 4, 5};
+        for(float k1 : keys){
+            for(float k2 : keys){
+                ids.push_back(ids.size());
+                embeddings.push_back({k1, k2});
+                values.push_back(std::to_string((int) k1) + std::to_string((int) k2));
+            }
+        }
+        ASSERT(store.add_embeddings(ids, embeddings, values) == 0);
+        ASSERT(store.add_embeddings(ids, embeddings, {}) == -1);
+
+        // every shard got something, nothing got lost
+        uint32_t total = 0;
+        for(uint32_t s = 0; s < store.get_num_shards(); s++){
+            uint32_t n = store.get_shard(s)->stats()["num_embeddings"];
+            ASSERT(n > 0);
+            total += n;
+        }
+        ASSERT(total == 25);
+
+        auto closest = store.get_k_closest({1, 1}, 5, 1, DistanceMetric::cosine_similarity);
+        ASSERT(closest.size() == 5);
+        std::unordered_set<std::string> closest_values;
+        for(auto c : closest){
+            ASSERT(close(c.first, 0.));
+            closest_values.insert(c.second);
+        }
+        ASSERT(closest_values == std::unordered_set<std::string>({"11", "22", "33", "44", "55"}));
+
+        auto l2 = store.get_k_closest({2.1, 3.9}, 3, 2, DistanceMetric::l2_squared);
+        ASSERT(l2.size() == 3);
+        ASSERT(l2[0].second == "24");
+        ASSERT(l2[0].first <= l2[1].first && l2[1].first <= l2[2].first);
+
+        std::cout << "PASSED" << std::endl;
+    }
+
+    {
+        TestWrapper tw("test_files/reopen_sharded_test");
+
+        std::cout << "TEST -- REOPEN AND RESET SHARD..." << std::endl;
+        {
+            ShardedEmbeddingStore store(tw.get_dir_path().c_str(), 3, 2, 1024, 1024, true);
+            for(uint64_t id = 0; id < 12; id++){
+                ASSERT(store.add_embedding(id, {(float) id, 1}, "doc " + std::to_string(id) + (id % 2 ? " odd" : " even")) == 0);
+            }
+        }
+
+        bool threw = false;
+        try{
+            ShardedEmbeddingStore store(tw.get_dir_path().c_str(), 2, 2);
+        }catch(const std::runtime_error& e){
+            threw = true;
+        }
+        ASSERT(threw);
+
+        ShardedEmbeddingStore store(tw.get_dir_path().c_str(), 3, 2, 1024, 1024, true);
+        auto closest = store.get_k_closest({11, 1}, 1, 1, DistanceMetric::cosine_similarity);
+        ASSERT(closest.size() == 1 && closest[0].second == "doc 11 odd");
+
+        auto hybrid = store.get_k_closest_hybrid_weighted("odd", {1, 1}, 6, 1, DistanceMetric::cosine_similarity, 1);
+        ASSERT(hybrid.size() == 6);
+        for(auto h : hybrid){
+            ASSERT(h.second.find("odd") != std::string::npos);
+        }
+
+        uint32_t shard = store.get_shard_for_id(11);
+        store.reset_shard(shard);
+        ASSERT(store.get_shard(shard)->stats()["num_embeddings"] == 0);
+        ASSERT(store.get_k_closest({11, 1}, 1, 1, DistanceMetric::cosine_similarity)[0].second != "doc 11 odd");
+        ASSERT(store.add_embedding(11, {11, 1}, "doc 11 odd") == 0);
+        ASSERT(store.get_k_closest({11, 1}, 1, 1, DistanceMetric::cosine_similarity)[0].second == "doc 11 odd");
+
+        // a copy held across a reset keeps serving its old rows
+        auto old_copy = store.get_shard(shard);
+        store.reset_shard(shard);
+        ASSERT(old_copy->get_k_closest({11, 1}, 1, 1, DistanceMetric::cosine_similarity)[0].second == "doc 11 odd");
+        ASSERT(store.get_shard(shard)->get_num_embeddings() == 0);
+
+        // resets while other threads search
+        for(uint64_t id = 0; id < 30; id++)
+            store.add_embedding(id, {(float) id, 1}, "doc " + std::to_string(id));
+        std::atomic<bool> done{false};
+        std::vector<std::thread> readers;
+        std::atomic<uint32_t> searches{0};
+        for(int r = 0; r < 3; r++){
+            readers.emplace_back([&](){
+                while(!done){
+                    auto results = store.get_k_closest({1, 1}, 3, 1, DistanceMetric::cosine_similarity);
+                    auto hybrid = store.get_k_closest_hybrid_weighted("doc", {1, 1}, 3, 1, DistanceMetric::cosine_similarity, 0.5);
+                    if(results.size() <= 3 && hybrid.size() <= 3)
+                        searches++;
+                }
+            });
+        }
+        for(int i = 0; i < 20; i++){
+            uint32_t before = searches;
+            store.reset_shard(i % store.get_num_shards());
+            while(searches < before + 2) // at least one search runs across each reset
+                std::this_thread::yield();
+        }
+        done = true;
+        for(auto& t : readers){
+            t.join();
+        }
+
+        std::cout << "PASSED" << std::endl;
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+
+#include <zstd.h>
+#include <zdict.h>
+
+// object store values are compressed one by one, so reading one value never decodes its neighbours. what makes
+// that pay off for short documents is a shared dictionary trained from sample values
+enum class ValueCodec : uint32_t {
+    none = 0,
+    zstd = 1  // zstd (third_party/zstd) with the trained dictionary
+};
+
+const int VALUE_COMPRESSION_LEVEL = 3;
+
+const uint32_t VALUE_DICTIONARY_SIZE = 32 * 1024;
+const uint32_t DICTIONARY_SEGMENT_SIZE = 64;
+const uint32_t DICTIONARY_KMER_SIZE = 8;
+
+// picks the sample segments whose 8-byte substrings occur in the most samples and concatenates them, best last
+// (closest to the data, so the cheapest to reference). a raw content dictionary, for when there are too few
+// samples for zstd's trainer
+std::string select_dictionary_segments(const std::vector<std::string>& samples, uint32_t dictionary_size = VALUE_DICTIONARY_SIZE){
+    std::unordered_map<std::string_view, uint32_t> kmer_counts;
+    for(const std::string& sample : samples){
+        std::unordered_map<std::string_view, bool> seen;
+        for(size_t i = 0; i + DICTIONARY_KMER_SIZE <= sample.size(); i++){
+            std::string_view kmer(sample.data() + i, DICTIONARY_KMER_SIZE);
+            if(!seen[kmer]){
+                seen[kmer] = true;
+                kmer_counts[kmer]++;
+            }
+        }
+    }
+
+    struct Segment {
+        uint64_t score;
+        std::string_view text;
+    };
+    std::vector<Segment> segments;
+    for(const std::string& sample : samples){
+        for(size_t start = 0; start < sample.size(); start += DICTIONARY_SEGMENT_SIZE){
+            std::string_view text(sample.data() + start, std::min((size_t) DICTIONARY_SEGMENT_SIZE, sample.size() - start));
+            uint64_t score = 0;
+            for(size_t i = 0; i + DICTIONARY_KMER_SIZE <= text.size(); i++){
+                uint32_t count = kmer_counts[text.substr(i, DICTIONARY_KMER_SIZE)];
+                score += count > 1 ? count : 0; // a kmer seen in one sample only helps that sample
+            }
+            if(score > 0)
+                segments.push_back(Segment{score, text});
+        }
+    }
+    std::stable_sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b){
+        return a.score > b.score;
+    });
+
+    std::vector<std::string_view> chosen;
+    std::unordered_map<std::string_view, bool> used;
+    size_t total = 0;
+    for(const Segment& segment : segments){
+        if(total + segment.text.size() > dictionary_size)
+            continue;
+        if(used[segment.text])
+            continue;
+        used[segment.text] = true;
+        chosen.push_back(segment.text);
+        total += segment.text.size();
+    }
+
+    std::string dictionary;
+    dictionary.reserve(total);
+    for(auto it = chosen.rbegin(); it != chosen.rend(); it++){
+        dictionary.append(*it);
+    }
+    return dictionary;
+}
+
+// zstd's trainer over the samples, falling back to select_dictionary_segments when it can't train on so few.
+// zstd takes either kind of dictionary
+std::string train_value_dictionary(const std::vector<std::string>& samples, uint32_t dictionary_size = VALUE_DICTIONARY_SIZE){
+    std::string joined;
+    std::vector<size_t> sample_sizes;
+    for(const std::string& sample : samples){
+        joined += sample;
+        sample_sizes.push_back(sample.size());
+    }
+    std::string dictionary(dictionary_size, '\0');
+    size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), joined.data(), sample_sizes.data(), sample_sizes.size());
+    if(ZDICT_isError(size))
+        return select_dictionary_segments(samples, dictionary_size);
+    dictionary.resize(size);
+    return dictionary;
+}
+
+// zstd with a fixed dictionary, digested once. frames leave out the content size, checksum and dictionary id --
+// the object store keeps the raw size next to every value, and a store has one dictionary. safe to share across
+// threads: each thread gets its own contexts
+class ZstdValueCodec {
+    private:
+    std::shared_ptr<ZSTD_CDict> cdict;
+    std::shared_ptr<ZSTD_DDict> ddict;
+
+    public:
+
+    ZstdValueCodec() = default;
+
+    ZstdValueCodec(std::string_view dictionary) :
+        cdict(ZSTD_createCDict(dictionary.data(), dictionary.size(), VALUE_COMPRESSION_LEVEL), ZSTD_freeCDict),
+        ddict(ZSTD_createDDict(dictionary.data(), dictionary.size()), ZSTD_freeDDict)
+    {}
+
+    // empty if zstd failed
+    std::string compress(std::string_view input) const {
+        static thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        ZSTD_CCtx_reset(cctx.get(), ZSTD_reset_session_and_parameters);
+        ZSTD_CCtx_refCDict(cctx.get(), cdict.get());
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_contentSizeFlag, 0);
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_checksumFlag, 0);
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_dictIDFlag, 0);
+        std::string out(ZSTD_compressBound(input.size()), '\0');
+        size_t size = ZSTD_compress2(cctx.get(), out.data(), out.size(), input.data(), input.size());
+        if(ZSTD_isError(size))
+            return {};
+        out.resize(size);
+        return out;
+    }
+
+    // false if the input is corrupt or doesn't decode to exactly raw_size bytes
+    bool decompress(std::string_view input, uint32_t raw_size, std::string& out) const {
+        static thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        out.resize(raw_size);
+        size_t size = ZSTD_decompress_usingDDict(dctx.get(), out.data(), out.size(), input.data(), input.size(), ddict.get());
+        return !ZSTD_isError(size) && size == raw_size;
+    }
+};